@@ -0,0 +1,130 @@
+#include "audio_ring.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <array>
+#include <thread>
+
+namespace gb {
+
+static std::size_t round_up_to_power_of_2(std::size_t value) {
+  std::size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+AudioRing::AudioRing(u32 sample_rate, u32 latency_ms)
+    : m_frames(round_up_to_power_of_2(
+          std::max<std::size_t>(u64{sample_rate} * latency_ms / 1000, 1))),
+      m_mask{m_frames.size() - 1} {}
+
+std::size_t AudioRing::push(nonstd::span<const StereoFrame> frames) noexcept {
+  const std::size_t head = m_head.load(std::memory_order_relaxed);
+  const std::size_t tail = m_tail.load(std::memory_order_acquire);
+  const std::size_t count = std::min(
+      static_cast<std::size_t>(frames.size()), capacity() - (head - tail));
+  if (count < static_cast<std::size_t>(frames.size())) {
+    m_overruns.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Copy in up to two pieces around the end of the storage
+  const std::size_t start = head & m_mask;
+  const std::size_t first = std::min(count, capacity() - start);
+  std::copy_n(frames.begin(), first, m_frames.begin() + start);
+  std::copy_n(frames.begin() + first, count - first, m_frames.begin());
+
+  m_head.store(head + count, std::memory_order_release);
+  return count;
+}
+
+std::size_t AudioRing::pop(nonstd::span<StereoFrame> frames) noexcept {
+  const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+  const std::size_t head = m_head.load(std::memory_order_acquire);
+  const std::size_t count =
+      std::min(static_cast<std::size_t>(frames.size()), head - tail);
+
+  const std::size_t start = tail & m_mask;
+  const std::size_t first = std::min(count, capacity() - start);
+  std::copy_n(m_frames.begin() + start, first, frames.begin());
+  std::copy_n(m_frames.begin(), count - first, frames.begin() + first);
+
+  m_tail.store(tail + count, std::memory_order_release);
+
+  if (count < static_cast<std::size_t>(frames.size())) {
+    std::fill(frames.begin() + count, frames.end(), StereoFrame{});
+    m_underruns.fetch_add(1, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+void AudioRing::sdl_callback(void* userdata, u8* stream, int len) {
+  auto* ring = static_cast<AudioRing*>(userdata);
+  ring->pop({reinterpret_cast<StereoFrame*>(stream),
+             len / static_cast<int>(sizeof(StereoFrame))});
+}
+
+TEST_CASE("AudioRing should drop on overrun and pad on underrun") {
+  AudioRing ring{1000, 5};
+  CHECK(ring.capacity() == 8);
+
+  std::vector<StereoFrame> input(6);
+  for (std::size_t i = 0; i < input.size(); ++i) {
+    input[i] = {static_cast<float>(i), -static_cast<float>(i)};
+  }
+  CHECK(ring.push(input) == 6);
+  CHECK(ring.push(input) == 2);
+  CHECK(ring.overruns() == 1);
+  CHECK(ring.size() == 8);
+
+  std::vector<StereoFrame> output(5);
+  CHECK(ring.pop(output) == 5);
+  CHECK(output[4].left == 4.0f);
+
+  // Wraps around the end of the storage
+  CHECK(ring.push(input) == 5);
+  CHECK(ring.pop(output) == 5);
+  CHECK(output[0].left == 5.0f);
+  CHECK(output[1].left == 0.0f);
+  CHECK(output[2].right == -1.0f);
+  CHECK(ring.underruns() == 0);
+
+  CHECK(ring.pop(output) == 3);
+  CHECK(output[2].left == 4.0f);
+  CHECK(output[3].left == 0.0f);
+  CHECK(output[4].right == 0.0f);
+  CHECK(ring.underruns() == 1);
+  CHECK(ring.size() == 0);
+}
+
+TEST_CASE("AudioRing should keep frames in order across threads") {
+  AudioRing ring{48000, 2};
+  constexpr int FrameCount = 100000;
+
+  std::thread producer{[&ring] {
+    int next = 0;
+    std::array<StereoFrame, 37> frames;
+    while (next < FrameCount) {
+      const int count =
+          std::min(static_cast<int>(frames.size()), FrameCount - next);
+      for (int i = 0; i < count; ++i) {
+        frames[i] = {static_cast<float>(next + i), 0.0f};
+      }
+      next += static_cast<int>(ring.push({frames.data(), count}));
+    }
+  }};
+
+  bool in_order = true;
+  int expected = 0;
+  std::array<StereoFrame, 53> frames;
+  while (expected < FrameCount) {
+    const std::size_t count = ring.pop(frames);
+    for (std::size_t i = 0; i < count; ++i) {
+      in_order &= frames[i].left == static_cast<float>(expected++);
+    }
+  }
+  producer.join();
+  CHECK(in_order);
+}
+
+}  // namespace gb
@@ -0,0 +1,73 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <nonstd/span.hpp>
+#include "types.h"
+
+namespace gb {
+
+struct StereoFrame {
+  float left = 0.0f;
+  float right = 0.0f;
+};
+
+// Wait-free single producer, single consumer queue of stereo frames between
+// the emulation thread and the audio thread. The producer never blocks:
+// frames that don't fit are dropped, and a consumer that runs dry is padded
+// with silence. Both are counted so the latency target can be tuned.
+class AudioRing {
+ public:
+  // Holds at least latency_ms worth of frames, rounded up to a power of 2
+  AudioRing(u32 sample_rate, u32 latency_ms);
+  AudioRing(const AudioRing&) = delete;
+  AudioRing& operator=(const AudioRing&) = delete;
+
+  // Producer side. Returns how many frames were queued.
+  std::size_t push(nonstd::span<const StereoFrame> frames) noexcept;
+
+  // Consumer side. Fills all of frames, returns how many weren't silence.
+  std::size_t pop(nonstd::span<StereoFrame> frames) noexcept;
+
+  // SDL_AudioCallback for an AUDIO_F32SYS stereo device, with the ring as
+  // userdata
+  static void sdl_callback(void* userdata, u8* stream, int len);
+
+  // Safe from either thread. Tail is read first, so the head read after it
+  // can't be behind it, but the producer may have refilled past the old
+  // tail by then.
+  [[nodiscard]] std::size_t size() const noexcept {
+    const std::size_t tail = m_tail.load(std::memory_order_acquire);
+    const std::size_t head = m_head.load(std::memory_order_acquire);
+    return std::min(head - tail, capacity());
+  }
+
+  [[nodiscard]] std::size_t capacity() const noexcept {
+    return m_frames.size();
+  }
+
+  // Times pop had to pad with silence
+  [[nodiscard]] u64 underruns() const noexcept {
+    return m_underruns.load(std::memory_order_relaxed);
+  }
+
+  // Times push had to drop frames
+  [[nodiscard]] u64 overruns() const noexcept {
+    return m_overruns.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<StereoFrame> m_frames;
+  std::size_t m_mask;
+
+  // Free running positions, only masked when indexing. Each side owns one
+  // and keeps it on its own cache line.
+  alignas(64) std::atomic<std::size_t> m_head{0};
+  alignas(64) std::atomic<std::size_t> m_tail{0};
+
+  std::atomic<u64> m_underruns{0};
+  std::atomic<u64> m_overruns{0};
+};
+
+}  // namespace gb
@@ -14,4 +14,8 @@ constexpr int SOUND_SAMPLE_FREQUENCY = 48000;
 constexpr int SOUND_SAMPLE_FREQUENCY = 48100;
 #endif
 constexpr int SOUND_SAMPLE_BUFFER_SIZE = 1024;
+// Audio queued between the emulator and the device, in milliseconds
+constexpr int SOUND_LATENCY_MS = 64;
+// Frames handed to the audio ring at a time
+constexpr int SOUND_PUSH_FRAMES = 128;
 }  // namespace gb
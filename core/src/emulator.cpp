@@ -155,14 +155,17 @@ void run_with_options(const std::string& rom_name, bool trace, bool save) {
 
   SDL_RenderSetLogicalSize(sdl_renderer.get(), 160, 144);
 
+  gb::AudioRing audio_ring{gb::SOUND_SAMPLE_FREQUENCY, gb::SOUND_LATENCY_MS};
+
   SDL_AudioSpec want, have;
   std::memset(&want, 0, sizeof(want));
 
   want.freq = gb::SOUND_SAMPLE_FREQUENCY;
-  want.format = AUDIO_F32;
+  want.format = AUDIO_F32SYS;
   want.channels = 2;
-  want.samples = 4096;
-  want.callback = nullptr;
+  want.samples = gb::SOUND_SAMPLE_BUFFER_SIZE;
+  want.callback = gb::AudioRing::sdl_callback;
+  want.userdata = &audio_ring;
 
   SDL_AudioDeviceID audio_device =
       SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
@@ -209,7 +212,7 @@ void run_with_options(const std::string& rom_name, bool trace, bool save) {
 
   gb::Lcd lcd{cpu, gpu};
   gb::Input input;
-  gb::Sound sound{memory, audio_device};
+  gb::Sound sound{memory, audio_ring};
 
   gb::Hardware hardware{&cpu,   &memory, &hdma, &timers,
                         &sound, &input,  &lcd,  &gpu};
@@ -364,6 +367,8 @@ void run_with_options(const std::string& rom_name, bool trace, bool save) {
     // if (diff < step_ms) {
     // SDL_Delay(step_ms - diff);
   }
+  // The callback reads audio_ring, so stop it before the ring goes away
+  SDL_CloseAudioDevice(audio_device);
   std::cout << "exit" << std::endl;
 }  // namespace gb
 }  // namespace gb
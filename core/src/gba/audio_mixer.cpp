@@ -0,0 +1,120 @@
+#include "gba/audio_mixer.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <cstring>
+#include "utils.h"
+
+namespace gb::advance {
+
+AudioMixer::AudioMixer(Callback callback, AudioFormat format)
+    : m_callback{std::move(callback)},
+      m_format{format},
+      m_blips{BlipBuffer{format.sample_rate}, BlipBuffer{format.sample_rate}} {
+  m_events.reserve(1024);
+  m_mixed.reserve(m_format.buffer_frames * 4);
+}
+
+void AudioMixer::add_output_step(u64 cycle) {
+  for (u32 side = 0; side < 2; ++side) {
+    const int level = m_levels[0] * m_gains_a[side] +
+                      m_levels[1] * m_gains_b[side] +
+                      (m_levels[PsgLeft + side] >> m_psg_shift) + m_bias;
+    const int output = std::clamp(level, 0, 0x3ff) - 0x200;
+    if (output != m_output_levels[side]) {
+      m_blips[side].add_delta(cycle, output - m_output_levels[side]);
+      m_output_levels[side] = output;
+    }
+  }
+}
+
+void AudioMixer::mix_until(u64 cycle, u16 soundcnt_high, u16 soundbias) {
+  // Volume and panning become per side gains. They apply from the last mix
+  // on, like the levels did before.
+  const int gain_a = gb::test_bit(soundcnt_high, 2) ? 4 : 2;
+  const int gain_b = gb::test_bit(soundcnt_high, 3) ? 4 : 2;
+  m_gains_a = {gb::test_bit(soundcnt_high, 9) ? gain_a : 0,
+               gb::test_bit(soundcnt_high, 8) ? gain_a : 0};
+  m_gains_b = {gb::test_bit(soundcnt_high, 13) ? gain_b : 0,
+               gb::test_bit(soundcnt_high, 12) ? gain_b : 0};
+  // 25%, 50% or 100% PSG volume, 3 is prohibited
+  m_psg_shift = 2 - std::min(soundcnt_high & 0b11, 2);
+  m_bias = soundbias & 0x3fe;
+  add_output_step(m_mixed_cycle);
+
+  // Changes that land on the same cycle make a single step
+  std::size_t event = 0;
+  while (event < m_events.size() && m_events[event].cycle <= cycle) {
+    const u64 event_cycle = m_events[event].cycle;
+    for (; event < m_events.size() && m_events[event].cycle == event_cycle;
+         ++event) {
+      m_levels[m_events[event].input] = m_events[event].level;
+    }
+    add_output_step(event_cycle);
+  }
+  m_events.erase(m_events.begin(), m_events.begin() + event);
+  m_mixed_cycle = cycle;
+
+  // Both sides see the same cycles, so they always have the same count
+  const u32 frames = m_blips[0].samples_until(cycle);
+  const std::size_t begin = m_mixed.size();
+  m_mixed.resize(begin + frames * 2);
+  m_blips[0].read_samples(frames, m_mixed.data() + begin, 2);
+  m_blips[1].read_samples(frames, m_mixed.data() + begin + 1, 2);
+
+  emit_buffers();
+}
+
+void AudioMixer::emit_buffers() {
+  const std::size_t samples = m_format.buffer_frames * 2;
+  std::size_t offset = 0;
+  for (; m_mixed.size() - offset >= samples; offset += samples) {
+    const s32* const mixed = m_mixed.data() + offset;
+    m_output.resize(samples * (m_format.sample_format == SampleFormat::S16
+                                   ? sizeof(s16)
+                                   : sizeof(float)));
+    if (m_format.sample_format == SampleFormat::S16) {
+      auto* const output = reinterpret_cast<s16*>(m_output.data());
+      // The 10 bit range becomes the full 16 bit one. Ringing around
+      // steps can overshoot it.
+      constexpr u32 Shift = BlipBuffer::SampleBits - 6;
+      for (std::size_t i = 0; i < samples; ++i) {
+        output[i] = static_cast<s16>(
+            std::clamp(mixed[i] >> Shift, s32{-0x8000}, s32{0x7fff}));
+      }
+    } else {
+      auto* const output = reinterpret_cast<float*>(m_output.data());
+      for (std::size_t i = 0; i < samples; ++i) {
+        constexpr float Scale = 1.0F / (512 << BlipBuffer::SampleBits);
+        output[i] = static_cast<float>(mixed[i]) * Scale;
+      }
+    }
+    m_callback(m_output);
+  }
+  m_mixed.erase(m_mixed.begin(), m_mixed.begin() + offset);
+}
+
+TEST_CASE("AudioMixer should hold FIFO levels and apply SOUNDCNT_H") {
+  std::vector<s16> output;
+  AudioMixer mixer{[&output](nonstd::span<const u8> bytes) {
+                     output.resize(bytes.size() / sizeof(s16));
+                     std::memcpy(output.data(), bytes.data(), bytes.size());
+                   },
+                   {SampleFormat::S16, 32768, 64}};
+
+  // A at full volume on both sides, B at half volume on the left only
+  constexpr u16 soundcnt_high = 0b0010'0011'0000'0100;
+  mixer.push(0, DirectSoundChannel::A, 16);
+  mixer.push(0, DirectSoundChannel::B, -32);
+  // Frames are 512 cycles apart, so this lands on the 40th frame
+  mixer.push(40 * 512, DirectSoundChannel::A, 0);
+  mixer.mix_until(64 * 512, soundcnt_high, 0x200);
+
+  // Steps are spread over the kernel, then settle on the exact level
+  REQUIRE(output.size() == 128);
+  CHECK(output[20 * 2] == (16 * 4 - 32 * 2) * 64);
+  CHECK(output[20 * 2 + 1] == 16 * 4 * 64);
+  CHECK(output[60 * 2] == -32 * 2 * 64);
+  CHECK(output[60 * 2 + 1] == 0);
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <vector>
+#include <nonstd/span.hpp>
+#include "gba/blip_buffer.h"
+#include "types.h"
+
+namespace gb::advance {
+
+enum class SampleFormat { S16, F32 };
+
+struct AudioFormat {
+  SampleFormat sample_format = SampleFormat::F32;
+  u32 sample_rate = 44100;
+  // Stereo frames handed to the callback at a time
+  u32 buffer_frames = 512;
+};
+
+enum class DirectSoundChannel : u32 { A, B };
+
+// Records the FIFO and PSG outputs as they change and turns them into
+// interleaved stereo frames a buffer at a time. A level holds until the next
+// change, and each change goes into a BlipBuffer as a band-limited step at
+// its exact cycle, so any sample rate works without aliasing.
+class AudioMixer {
+ public:
+  static constexpr u64 CyclesPerSecond = u64{1}
+                                         << BlipBuffer::CyclesPerSecondBits;
+
+  // Receives buffer_frames interleaved frames in the sample format
+  using Callback = std::function<void(nonstd::span<const u8>)>;
+
+  AudioMixer(Callback callback, AudioFormat format);
+
+  [[nodiscard]] const AudioFormat& format() const noexcept { return m_format; }
+
+  // Cycles covered by one buffer, rounded down
+  [[nodiscard]] u32 buffer_cycles() const noexcept {
+    return static_cast<u32>(CyclesPerSecond * m_format.buffer_frames /
+                            m_format.sample_rate);
+  }
+
+  void push(u64 cycle, DirectSoundChannel channel, s8 sample) {
+    m_events.push_back({cycle, static_cast<u32>(channel), sample});
+  }
+
+  // The PSG output on each side, before the SOUNDCNT_H volume
+  void push_psg(u64 cycle, u16 left, u16 right) {
+    m_events.push_back({cycle, PsgLeft, static_cast<s16>(left)});
+    m_events.push_back({cycle, PsgLeft + 1, static_cast<s16>(right)});
+  }
+
+  // Mixes every frame up to cycle using SOUNDCNT_H and SOUNDBIAS, and hands
+  // each full buffer to the callback
+  void mix_until(u64 cycle, u16 soundcnt_high, u16 soundbias);
+
+ private:
+  // Inputs 0 and 1 are the FIFOs, then the PSG sides
+  static constexpr u32 PsgLeft = 2;
+
+  struct SampleEvent {
+    u64 cycle;
+    u32 input;
+    s16 level;
+  };
+
+  // Adds the change in the DAC output since the last call as a step at cycle
+  void add_output_step(u64 cycle);
+
+  void emit_buffers();
+
+  Callback m_callback;
+  AudioFormat m_format;
+  std::vector<SampleEvent> m_events;
+  std::array<s16, 4> m_levels{};
+
+  // Per side gains and the PSG shift from SOUNDCNT_H, and the bias from
+  // SOUNDBIAS, as of the last mix
+  std::array<int, 2> m_gains_a{};
+  std::array<int, 2> m_gains_b{};
+  int m_psg_shift = 2;
+  int m_bias = 0x200;
+
+  // Left then right, the DAC output centered around 0 with a 10 bit range
+  std::array<BlipBuffer, 2> m_blips;
+  std::array<int, 2> m_output_levels{};
+  u64 m_mixed_cycle = 0;
+
+  // Interleaved frames scaled by BlipBuffer::SampleBits
+  std::vector<s32> m_mixed;
+  std::vector<u8> m_output;
+};
+
+}  // namespace gb::advance
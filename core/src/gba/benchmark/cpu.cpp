@@ -0,0 +1,137 @@
+#include "gba/cpu.h"
+#include <benchmark/benchmark.h>
+#include <array>
+#include "gba/mmu.h"
+
+using namespace gb::advance;
+using namespace gb;
+
+template <std::size_t N>
+static void load_program(Mmu& mmu,
+                         u32 addr,
+                         const std::array<u16, N>& program) {
+  for (std::size_t i = 0; i < N; ++i) {
+    mmu.set<u16>(addr + i * sizeof(u16), program[i]);
+  }
+}
+
+// Thumb loop where every instruction sets flags and only the final bne
+// reads them. Arg 0 runs with eager flags, arg 1 with lazy flags.
+static void bench_thumb_flags(benchmark::State& state) {
+  static constexpr std::array<u16, 7> program = {
+      0x3001,  // add r0, #1
+      0x3901,  // sub r1, #1
+      0x00c2,  // lsl r2, r0, #3
+      0x404a,  // eor r2, r1
+      0x189b,  // add r3, r3, r2
+      0x4281,  // cmp r1, r0
+      0xd1f8,  // bne start
+  };
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  load_program(mmu, Mmu::IWramBegin, program);
+
+  cpu.set_lazy_flags(state.range(0) != 0);
+  cpu.set_thumb(true);
+  cpu.set_reg(Register::R15, Mmu::IWramBegin);
+
+  s64 cycles = 0;
+  for ([[maybe_unused]] auto _ : state) {
+    cycles += cpu.execute(1000);
+  }
+  state.SetItemsProcessed(cycles);
+}
+
+BENCHMARK(bench_thumb_flags)->Arg(0)->Arg(1);
+
+// Short Thumb blocks chained by branches, run the way execute_hardware runs
+// them. Arg 0 returns after every block, arg 1 uses threaded dispatch.
+static void bench_dispatch(benchmark::State& state) {
+  static constexpr std::array<u16, 8> program = {
+      0x3001,  // add r0, #1
+      0xe7ff,  // b next
+      0x3101,  // add r1, #1
+      0xe7ff,  // b next
+      0x3201,  // add r2, #1
+      0xe7ff,  // b next
+      0x3b01,  // sub r3, #1
+      0xd1f7,  // bne start
+  };
+  static constexpr int Budget = 1000;
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  load_program(mmu, Mmu::IWramBegin, program);
+
+  cpu.set_threaded_dispatch(state.range(0) != 0);
+  cpu.set_thumb(true);
+  cpu.set_reg(Register::R15, Mmu::IWramBegin);
+
+  s64 cycles = 0;
+  for ([[maybe_unused]] auto _ : state) {
+    int remaining = Budget;
+    while (remaining > 0) {
+      remaining -= static_cast<int>(cpu.execute(remaining));
+    }
+    cycles += Budget - remaining;
+  }
+  state.SetItemsProcessed(cycles);
+}
+
+BENCHMARK(bench_dispatch)->Arg(0)->Arg(1);
+
+// IRQ entry followed by the SPSR restore the BIOS handler ends with
+static void bench_irq_round_trip(benchmark::State& state) {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  cpu.ime = 1;
+  cpu.interrupts_enabled.set_interrupt(Interrupt::VBlank, true);
+  cpu.set_reg(Register::R15, Mmu::IWramBegin);
+
+  for ([[maybe_unused]] auto _ : state) {
+    cpu.interrupts_requested.set_interrupt(Interrupt::VBlank, true);
+    cpu.handle_interrupts();
+    cpu.interrupts_requested.set_interrupt(Interrupt::VBlank, false);
+    cpu.move_spsr_to_cpsr();
+    cpu.set_reg(Register::R15, Mmu::IWramBegin);
+    benchmark::DoNotOptimize(cpu.reg(Register::R14));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bench_irq_round_trip);
+
+// Thumb loop of loads and stores, so most of the time goes to memory
+// accesses and their timing. Arg 0 is the address the data lives at. Items
+// are loop iterations, since the cycles per iteration depend on the region.
+static void bench_memory_timing(benchmark::State& state) {
+  static constexpr std::array<u16, 6> program = {
+      0x6821,  // ldr r1, [r4]
+      0x6061,  // str r1, [r4, #4]
+      0x1c2e,  // add r6, r5, #0
+      0xce06,  // ldmia r6!, {r1, r2}
+      0x3001,  // add r0, #1
+      0xe7f9,  // b start
+  };
+  const auto data_addr = static_cast<u32>(state.range(0));
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  load_program(mmu, Mmu::IWramBegin, program);
+
+  cpu.set_thumb(true);
+  cpu.set_reg(Register::R4, data_addr);
+  cpu.set_reg(Register::R5, data_addr + 0x10);
+  cpu.set_reg(Register::R15, Mmu::IWramBegin);
+
+  for ([[maybe_unused]] auto _ : state) {
+    (void)cpu.execute(1000);
+  }
+  state.SetItemsProcessed(cpu.reg(Register::R0));
+}
+
+BENCHMARK(bench_memory_timing)
+    ->Arg(Mmu::EWramBegin)
+    ->Arg(Mmu::IWramBegin + 0x1000);
@@ -0,0 +1,53 @@
+#include "gba/gpu.h"
+#include <benchmark/benchmark.h>
+#include <random>
+
+using namespace gb::advance;
+using namespace gb;
+
+// Mode 0 with all four backgrounds, 32 16x16 sprites and alpha blending
+// between BG0 and OBJ over BG1, BG2 and the backdrop
+static void bench_render_scanline(benchmark::State& state) {
+  Mmu mmu;
+  std::mt19937 rng{1234};
+  for (const auto region : {mmu.vram(), mmu.palette_ram()}) {
+    std::generate(region.begin(), region.end(),
+                  [&rng] { return static_cast<u8>(rng()); });
+  }
+
+  // Spread out sprites with a priority each, skipping the affine modes
+  const auto oam = mmu.oam_ram();
+  std::fill(oam.begin(), oam.end(), u8{0});
+  for (u32 i = 0; i < 128; ++i) {
+    const bool visible = i < 32;
+    const u16 attrib0 = visible ? static_cast<u16>((i * 5) % 160) : 1 << 9;
+    const u16 attrib1 = static_cast<u16>((i * 7) % 240 | (1 << 14));
+    const u16 attrib2 = static_cast<u16>(i * 4 | (i % 4) << 10);
+    for (const auto& [offset, value] :
+         {std::pair{0U, attrib0}, {2U, attrib1}, {4U, attrib2}}) {
+      oam[i * 8 + offset] = static_cast<u8>(value);
+      oam[i * 8 + offset + 1] = static_cast<u8>(value >> 8);
+    }
+  }
+
+  Gpu gpu{mmu};
+  gpu.bg0.control.set_data(0x0000 | (8 << 8));
+  gpu.bg1.control.set_data(0x0001 | (9 << 8));
+  gpu.bg2.control.set_data(0x0002 | (10 << 8));
+  gpu.bg3.control.set_data(0x0003 | (11 << 8));
+  gpu.bg1.scroll = {3, 5};
+  gpu.dispcnt.set_data(0x1f40);
+  gpu.sort_backgrounds();
+  gpu.bldcnt.set_data(0x2611 | (1 << 6));
+  gpu.bldalpha.set_data(0x0a06);
+
+  u32 scanline = 0;
+  for ([[maybe_unused]] auto _ : state) {
+    gpu.render_scanline(scanline);
+    scanline = (scanline + 1) % Gpu::ScreenHeight;
+  }
+  benchmark::DoNotOptimize(gpu.framebuffer().data());
+  state.SetItemsProcessed(state.iterations() * Gpu::ScreenWidth);
+}
+
+BENCHMARK(bench_render_scanline);
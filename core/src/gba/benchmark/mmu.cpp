@@ -38,7 +38,7 @@ struct Emulator {
 
   Lcd lcd{cpu, dmas, gpu};
   Input input;
-  Sound sound{[](auto) {}, dmas};
+  Sound sound{[](auto) {}, cpu.scheduler(), dmas};
 
   Timers timers{cpu, sound};
 
@@ -65,11 +65,52 @@ static void bench_integration(benchmark::State& state) {
   }
 }
 
+// The transfers games actually run. Arg 0 picks one of them:
+// 0: DMA3 64 KB EWRAM to VRAM upload
+// 1: DMA3 fixed source clear of 32 KB of VRAM
+// 2: HBlank DMA of two words into the BG2 affine registers
+// 3: Sound DMA of four words into FIFO A
+// 4: DMA3 halfword copy from ROM to IWRAM
+static void bench_dma_shapes(benchmark::State& state) {
+  Emulator emu;
+  emu.mmu.load_rom(std::vector<u8>(1024_kb, 0x11));
+  emu.mmu.set<u32>(Mmu::IWramBegin, 0x12345678);
+
+  struct Shape {
+    Mmu::AddrParam source;
+    Mmu::AddrParam dest;
+    u32 count;
+    u32 type_size;
+  };
+  using Op = Mmu::AddrOp;
+  const std::array<Shape, 5> shapes{{
+      {{Mmu::EWramBegin, Op::Increment}, {Mmu::VramBegin, Op::Increment},
+       0x4000, 4},
+      {{Mmu::IWramBegin, Op::Fixed}, {Mmu::VramBegin, Op::Increment},
+       0x2000, 4},
+      {{Mmu::EWramBegin, Op::Increment}, {0x04000028, Op::Increment}, 2, 4},
+      {{Mmu::EWramBegin, Op::Increment}, {hardware::FIFO_A, Op::Fixed}, 4, 4},
+      {{Mmu::RomRegion0Begin, Op::Increment},
+       {Mmu::IWramBegin + 0x100, Op::Increment},
+       0x1000, 2},
+  }};
+  const Shape& shape = shapes[static_cast<std::size_t>(state.range(0))];
+
+  for ([[maybe_unused]] auto _ : state) {
+    emu.mmu.copy_memory(shape.source, shape.dest, shape.count,
+                        shape.type_size);
+  }
+  state.SetBytesProcessed(state.iterations() * shape.count * shape.type_size);
+}
+
+// Arg 0 is the address to read
 static void bench_at(benchmark::State& state) {
   Emulator emu;
+  emu.mmu.load_rom(std::vector<u8>(1024_kb, 0));
+  const auto addr = static_cast<u32>(state.range(0));
 
   for ([[maybe_unused]] auto _ : state) {
-    benchmark::DoNotOptimize(emu.mmu.at<u16>(0x040000dc));
+    benchmark::DoNotOptimize(emu.mmu.at<u16>(addr));
   }
 }
 
@@ -86,11 +127,25 @@ static void bench_at_sequential(benchmark::State& state) {
   }
 }
 
+// Arg 0 is the address to write
 static void bench_set(benchmark::State& state) {
   Emulator emu;
+  const auto addr = static_cast<u32>(state.range(0));
   for ([[maybe_unused]] auto _ : state) {
-    emu.mmu.set<u16>(0x04000000, 10);
+    emu.mmu.set<u16>(addr, 10);
+  }
+}
+
+// Word copies between EWRAM and IWRAM, the way a memcpy loop would do them
+static void bench_ram_sequential(benchmark::State& state) {
+  Emulator emu;
+  for ([[maybe_unused]] auto _ : state) {
+    for (u32 i = 0; i < 0x400; i += 4) {
+      emu.mmu.set<u32>(Mmu::IWramBegin + i,
+                       emu.mmu.at<u32>(Mmu::EWramBegin + i));
+    }
   }
+  state.SetItemsProcessed(state.iterations() * 0x100);
 }
 
 static void bench_set_sequential(benchmark::State& state) {
@@ -110,10 +165,21 @@ BENCHMARK(bench_integration)
     ->Repetitions(4)
     ->Unit(benchmark::TimeUnit::kMillisecond);
 BENCHMARK(copy_memory);
-BENCHMARK(bench_at);
+BENCHMARK(bench_dma_shapes)->DenseRange(0, 4);
+BENCHMARK(bench_at)
+    ->Arg(0x040000dc)
+    ->Arg(Mmu::EWramBegin)
+    ->Arg(Mmu::IWramBegin)
+    ->Arg(Mmu::VramBegin)
+    ->Arg(Mmu::RomRegion0Begin);
 BENCHMARK(bench_at_sequential);
-BENCHMARK(bench_set);
+BENCHMARK(bench_set)
+    ->Arg(0x04000000)
+    ->Arg(Mmu::EWramBegin)
+    ->Arg(Mmu::IWramBegin)
+    ->Arg(Mmu::VramBegin);
 BENCHMARK(bench_set_sequential);
+BENCHMARK(bench_ram_sequential);
 
 int main(int argc, char** argv) {
   std::vector<char*> args(argv, argv + argc);
@@ -0,0 +1,55 @@
+#include "gba/shifter.h"
+#include <benchmark/benchmark.h>
+#include <array>
+
+using namespace gb::advance;
+using namespace gb;
+
+// Runs every register-specified amount for the shift type in arg 0
+static void bench_shift_by_register(benchmark::State& state) {
+  const auto type = static_cast<ShiftType>(state.range(0));
+  u32 value = 0x12345678;
+  bool carry = false;
+  for ([[maybe_unused]] auto _ : state) {
+    for (u32 amount = 0; amount < 256; ++amount) {
+      const auto result = shift_by_register(type, value, amount, carry);
+      value ^= result.value + 1;
+      carry = result.carry;
+    }
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations() * 256);
+}
+
+BENCHMARK(bench_shift_by_register)->DenseRange(0, 3);
+
+// Immediate shifts, including LSR #32, ASR #32 and RRX
+static void bench_shift_by_immediate(benchmark::State& state) {
+  const auto type = static_cast<ShiftType>(state.range(0));
+  u32 value = 0x12345678;
+  bool carry = false;
+  for ([[maybe_unused]] auto _ : state) {
+    for (u32 amount = 0; amount < 32; ++amount) {
+      const auto result = shift_by_immediate(type, value, amount, carry);
+      value ^= result.value + 1;
+      carry = result.carry;
+    }
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations() * 32);
+}
+
+BENCHMARK(bench_shift_by_immediate)->DenseRange(0, 3);
+
+static void bench_rotated_immediate(benchmark::State& state) {
+  u32 value = 0;
+  for ([[maybe_unused]] auto _ : state) {
+    for (u32 instruction = 0; instruction < 0x1000; ++instruction) {
+      value += rotated_immediate(instruction, false).value;
+    }
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations() * 0x1000);
+}
+
+BENCHMARK(bench_rotated_immediate);
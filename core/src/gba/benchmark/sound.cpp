@@ -0,0 +1,34 @@
+#include "gba/audio_mixer.h"
+#include <benchmark/benchmark.h>
+
+using namespace gb::advance;
+using namespace gb;
+
+// A buffer of 512 frames with both FIFOs fed at 32 kHz. Arg 0 is the
+// SampleFormat.
+static void bench_audio_mix(benchmark::State& state) {
+  const auto format = static_cast<SampleFormat>(state.range(0));
+  AudioMixer mixer{[](nonstd::span<const u8> frames) {
+                     benchmark::DoNotOptimize(frames.data());
+                   },
+                   {format, 44100, 512}};
+  const u32 buffer_cycles = mixer.buffer_cycles();
+  constexpr u32 FifoCycles = 16777216 / 32768;
+
+  u64 cycle = 0;
+  s8 sample = 0;
+  for ([[maybe_unused]] auto _ : state) {
+    const u64 end = cycle + buffer_cycles;
+    for (; cycle < end; cycle += FifoCycles) {
+      mixer.push(cycle, DirectSoundChannel::A, sample);
+      mixer.push(cycle, DirectSoundChannel::B, static_cast<s8>(-sample));
+      sample = static_cast<s8>(sample + 3);
+    }
+    mixer.mix_until(end, 0xbb0c, 0x200);
+  }
+  state.SetItemsProcessed(state.iterations() * 512);
+}
+
+BENCHMARK(bench_audio_mix)
+    ->Arg(static_cast<int>(SampleFormat::S16))
+    ->Arg(static_cast<int>(SampleFormat::F32));
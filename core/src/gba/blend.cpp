@@ -0,0 +1,333 @@
+#include "gba/blend.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define GBEMU_BLEND_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define GBEMU_BLEND_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+namespace gb::advance::blend {
+namespace {
+constexpr u32 Max = 31;
+
+struct Kernels {
+  void (*alpha)(const u16*, const u16*, u16*, u32 count, u32 eva, u32 evb);
+  void (*brighten)(const u16*, u16*, u32 count, u32 evy);
+  void (*darken)(const u16*, u16*, u32 count, u32 evy);
+};
+
+template <typename Op>
+u16 per_channel(Op op) {
+  u32 result = 0;
+  for (u32 shift = 0; shift < 15; shift += 5) {
+    result |= std::min(op(shift), Max) << shift;
+  }
+  return static_cast<u16>(result);
+}
+
+void alpha_scalar(const u16* first,
+                  const u16* second,
+                  u16* out,
+                  u32 count,
+                  u32 eva,
+                  u32 evb) {
+  for (u32 i = 0; i < count; ++i) {
+    out[i] = per_channel([&](u32 shift) {
+      return ((first[i] >> shift & Max) * eva +
+              (second[i] >> shift & Max) * evb) >>
+             4;
+    });
+  }
+}
+
+void brighten_scalar(const u16* colors, u16* out, u32 count, u32 evy) {
+  for (u32 i = 0; i < count; ++i) {
+    out[i] = per_channel([&](u32 shift) {
+      const u32 channel = colors[i] >> shift & Max;
+      return channel + ((Max - channel) * evy >> 4);
+    });
+  }
+}
+
+void darken_scalar(const u16* colors, u16* out, u32 count, u32 evy) {
+  for (u32 i = 0; i < count; ++i) {
+    out[i] = per_channel([&](u32 shift) {
+      const u32 channel = colors[i] >> shift & Max;
+      return channel - (channel * evy >> 4);
+    });
+  }
+}
+
+constexpr Kernels ScalarKernels{alpha_scalar, brighten_scalar, darken_scalar};
+
+#ifdef GBEMU_BLEND_SSE2
+// The SSE2 and AVX2 kernels do the scalar math on 8 or 16 colors at a time.
+// No intermediate goes past 31 * 16 * 2, so 16 bit lanes are enough.
+template <int Shift>
+__m128i channel_sse2(__m128i colors) {
+  return _mm_and_si128(_mm_srli_epi16(colors, Shift),
+                       _mm_set1_epi16(static_cast<s16>(Max)));
+}
+
+__m128i pack_sse2(__m128i red, __m128i green, __m128i blue) {
+  const __m128i max = _mm_set1_epi16(static_cast<s16>(Max));
+  return _mm_or_si128(
+      _mm_or_si128(_mm_min_epi16(red, max),
+                   _mm_slli_epi16(_mm_min_epi16(green, max), 5)),
+      _mm_slli_epi16(_mm_min_epi16(blue, max), 10));
+}
+
+__m128i alpha_channel_sse2(__m128i first,
+                           __m128i second,
+                           __m128i eva,
+                           __m128i evb) {
+  return _mm_srli_epi16(
+      _mm_add_epi16(_mm_mullo_epi16(first, eva), _mm_mullo_epi16(second, evb)),
+      4);
+}
+
+__m128i brighten_channel_sse2(__m128i channel, __m128i evy) {
+  const __m128i max = _mm_set1_epi16(static_cast<s16>(Max));
+  return _mm_add_epi16(
+      channel,
+      _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(max, channel), evy), 4));
+}
+
+__m128i darken_channel_sse2(__m128i channel, __m128i evy) {
+  return _mm_sub_epi16(channel,
+                       _mm_srli_epi16(_mm_mullo_epi16(channel, evy), 4));
+}
+
+void alpha_sse2(const u16* first,
+                const u16* second,
+                u16* out,
+                u32 count,
+                u32 eva,
+                u32 evb) {
+  const __m128i first_weight = _mm_set1_epi16(static_cast<s16>(eva));
+  const __m128i second_weight = _mm_set1_epi16(static_cast<s16>(evb));
+  u32 i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i));
+    const auto channel = [&](__m128i a_channel, __m128i b_channel) {
+      return alpha_channel_sse2(a_channel, b_channel, first_weight,
+                                second_weight);
+    };
+    const __m128i result =
+        pack_sse2(channel(channel_sse2<0>(a), channel_sse2<0>(b)),
+                  channel(channel_sse2<5>(a), channel_sse2<5>(b)),
+                  channel(channel_sse2<10>(a), channel_sse2<10>(b)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+  }
+  alpha_scalar(first + i, second + i, out + i, count - i, eva, evb);
+}
+
+template <__m128i (*Channel)(__m128i, __m128i),
+          void (*Scalar)(const u16*, u16*, u32, u32)>
+void fade_sse2(const u16* colors, u16* out, u32 count, u32 evy) {
+  const __m128i weight = _mm_set1_epi16(static_cast<s16>(evy));
+  u32 i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i color =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+    const __m128i result = pack_sse2(Channel(channel_sse2<0>(color), weight),
+                                     Channel(channel_sse2<5>(color), weight),
+                                     Channel(channel_sse2<10>(color), weight));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+  }
+  Scalar(colors + i, out + i, count - i, evy);
+}
+
+constexpr Kernels Sse2Kernels{
+    alpha_sse2, fade_sse2<brighten_channel_sse2, brighten_scalar>,
+    fade_sse2<darken_channel_sse2, darken_scalar>};
+#endif
+
+#ifdef GBEMU_BLEND_AVX2
+// Compiled for AVX2 whatever the build targets, and only called when the
+// host has it
+#define GBEMU_AVX2 __attribute__((target("avx2")))
+
+template <int Shift>
+GBEMU_AVX2 __m256i channel_avx2(__m256i colors) {
+  return _mm256_and_si256(_mm256_srli_epi16(colors, Shift),
+                          _mm256_set1_epi16(static_cast<s16>(Max)));
+}
+
+GBEMU_AVX2 __m256i pack_avx2(__m256i red, __m256i green, __m256i blue) {
+  const __m256i max = _mm256_set1_epi16(static_cast<s16>(Max));
+  return _mm256_or_si256(
+      _mm256_or_si256(_mm256_min_epi16(red, max),
+                      _mm256_slli_epi16(_mm256_min_epi16(green, max), 5)),
+      _mm256_slli_epi16(_mm256_min_epi16(blue, max), 10));
+}
+
+GBEMU_AVX2 __m256i alpha_channel_avx2(__m256i first,
+                                      __m256i second,
+                                      __m256i eva,
+                                      __m256i evb) {
+  return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(first, eva),
+                                            _mm256_mullo_epi16(second, evb)),
+                           4);
+}
+
+GBEMU_AVX2 __m256i brighten_channel_avx2(__m256i channel, __m256i evy) {
+  const __m256i max = _mm256_set1_epi16(static_cast<s16>(Max));
+  return _mm256_add_epi16(
+      channel, _mm256_srli_epi16(
+                   _mm256_mullo_epi16(_mm256_sub_epi16(max, channel), evy), 4));
+}
+
+GBEMU_AVX2 __m256i darken_channel_avx2(__m256i channel, __m256i evy) {
+  return _mm256_sub_epi16(
+      channel, _mm256_srli_epi16(_mm256_mullo_epi16(channel, evy), 4));
+}
+
+GBEMU_AVX2 void alpha_avx2(const u16* first,
+                           const u16* second,
+                           u16* out,
+                           u32 count,
+                           u32 eva,
+                           u32 evb) {
+  const __m256i first_weight = _mm256_set1_epi16(static_cast<s16>(eva));
+  const __m256i second_weight = _mm256_set1_epi16(static_cast<s16>(evb));
+  u32 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + i));
+    const __m256i result = pack_avx2(
+        alpha_channel_avx2(channel_avx2<0>(a), channel_avx2<0>(b),
+                           first_weight, second_weight),
+        alpha_channel_avx2(channel_avx2<5>(a), channel_avx2<5>(b),
+                           first_weight, second_weight),
+        alpha_channel_avx2(channel_avx2<10>(a), channel_avx2<10>(b),
+                           first_weight, second_weight));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+  }
+  alpha_scalar(first + i, second + i, out + i, count - i, eva, evb);
+}
+
+template <__m256i (*Channel)(__m256i, __m256i),
+          void (*Scalar)(const u16*, u16*, u32, u32)>
+GBEMU_AVX2 void fade_avx2(const u16* colors, u16* out, u32 count, u32 evy) {
+  const __m256i weight = _mm256_set1_epi16(static_cast<s16>(evy));
+  u32 i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m256i color =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + i));
+    const __m256i result =
+        pack_avx2(Channel(channel_avx2<0>(color), weight),
+                  Channel(channel_avx2<5>(color), weight),
+                  Channel(channel_avx2<10>(color), weight));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+  }
+  Scalar(colors + i, out + i, count - i, evy);
+}
+
+constexpr Kernels Avx2Kernels{
+    alpha_avx2, fade_avx2<brighten_channel_avx2, brighten_scalar>,
+    fade_avx2<darken_channel_avx2, darken_scalar>};
+#endif
+
+const Kernels& kernels() {
+  static const Kernels& selected = []() -> const Kernels& {
+#ifdef GBEMU_BLEND_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+      return Avx2Kernels;
+    }
+#endif
+#ifdef GBEMU_BLEND_SSE2
+    return Sse2Kernels;
+#else
+    return ScalarKernels;
+#endif
+  }();
+  return selected;
+}
+}  // namespace
+
+void alpha(nonstd::span<const u16> first,
+           nonstd::span<const u16> second,
+           nonstd::span<u16> out,
+           u32 eva,
+           u32 evb) {
+  kernels().alpha(first.data(), second.data(), out.data(),
+                  static_cast<u32>(out.size()), eva, evb);
+}
+
+void brighten(nonstd::span<const u16> colors, nonstd::span<u16> out, u32 evy) {
+  kernels().brighten(colors.data(), out.data(), static_cast<u32>(out.size()),
+                     evy);
+}
+
+void darken(nonstd::span<const u16> colors, nonstd::span<u16> out, u32 evy) {
+  kernels().darken(colors.data(), out.data(), static_cast<u32>(out.size()),
+                   evy);
+}
+
+TEST_CASE("blend kernels should match the hardware's 5 bit math") {
+  constexpr auto bgr = [](u32 r, u32 g, u32 b) {
+    return static_cast<u16>(r | g << 5 | b << 10);
+  };
+  std::array<u16, 3> first = {bgr(31, 0, 0), bgr(31, 31, 31), bgr(20, 10, 3)};
+  std::array<u16, 3> second = {bgr(0, 0, 31), bgr(31, 31, 31), bgr(0, 0, 0)};
+  std::array<u16, 3> out{};
+
+  alpha(first, second, out, 8, 8);
+  CHECK(out[0] == bgr(15, 0, 15));
+  // Saturates rather than wrapping
+  CHECK(out[1] == bgr(31, 31, 31));
+  brighten(first, out, 8);
+  CHECK(out[2] == bgr(25, 20, 17));
+  darken(first, out, 16);
+  CHECK(out[2] == bgr(0, 0, 0));
+
+  // Every SIMD path the host has agrees with the scalar one, including
+  // the tails
+  std::vector<const Kernels*> simd_kernels;
+#ifdef GBEMU_BLEND_SSE2
+  simd_kernels.push_back(&Sse2Kernels);
+#endif
+#ifdef GBEMU_BLEND_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    simd_kernels.push_back(&Avx2Kernels);
+  }
+#endif
+  std::mt19937 rng{42};
+  std::array<u16, 37> a;
+  std::array<u16, 37> b;
+  std::generate(a.begin(), a.end(), [&rng] { return rng() & 0x7fff; });
+  std::generate(b.begin(), b.end(), [&rng] { return rng() & 0x7fff; });
+  for (const Kernels* simd : simd_kernels) {
+    for (u32 coefficient = 0; coefficient <= 16; ++coefficient) {
+      std::array<u16, 37> expected;
+      std::array<u16, 37> actual;
+      ScalarKernels.alpha(a.data(), b.data(), expected.data(), 37,
+                          coefficient, 16 - coefficient / 2);
+      simd->alpha(a.data(), b.data(), actual.data(), 37, coefficient,
+                  16 - coefficient / 2);
+      CHECK(expected == actual);
+      ScalarKernels.brighten(a.data(), expected.data(), 37, coefficient);
+      simd->brighten(a.data(), actual.data(), 37, coefficient);
+      CHECK(expected == actual);
+      ScalarKernels.darken(a.data(), expected.data(), 37, coefficient);
+      simd->darken(a.data(), actual.data(), 37, coefficient);
+      CHECK(expected == actual);
+    }
+  }
+}
+
+}  // namespace gb::advance::blend
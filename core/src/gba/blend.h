@@ -0,0 +1,25 @@
+#pragma once
+#include <nonstd/span.hpp>
+#include "types.h"
+
+namespace gb::advance::blend {
+
+// Color special effects on BGR555 colors with the hardware's integer math.
+// Coefficients are EVA, EVB and EVY in sixteenths, from 0 to 16, and every
+// channel saturates at 31. Each picks the widest SIMD path the host supports
+// the first time it runs.
+
+// first * eva + second * evb
+void alpha(nonstd::span<const u16> first,
+           nonstd::span<const u16> second,
+           nonstd::span<u16> out,
+           u32 eva,
+           u32 evb);
+
+// color + (31 - color) * evy
+void brighten(nonstd::span<const u16> colors, nonstd::span<u16> out, u32 evy);
+
+// color - color * evy
+void darken(nonstd::span<const u16> colors, nonstd::span<u16> out, u32 evy);
+
+}  // namespace gb::advance::blend
@@ -0,0 +1,83 @@
+#include "gba/blip_buffer.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace gb::advance {
+
+// Each phase is a Blackman windowed sinc cut off a little under the output
+// Nyquist rate, centered (KernelTaps - 1) / 2 samples after the step. The
+// taps of a phase add up to exactly 1 << SampleBits so steps never drift.
+static BlipBuffer::Kernel make_kernel() {
+  constexpr double Pi = 3.14159265358979323846;
+  constexpr double Cutoff = 0.9;
+  constexpr double Center = (BlipBuffer::KernelTaps - 1) / 2.0;
+  constexpr double HalfWidth = Center + 1.0;
+  constexpr s32 Unity = 1 << BlipBuffer::SampleBits;
+
+  BlipBuffer::Kernel kernel{};
+  for (u32 phase = 0; phase < BlipBuffer::Phases; ++phase) {
+    std::array<double, BlipBuffer::KernelTaps> impulse{};
+    for (u32 i = 0; i < BlipBuffer::KernelTaps; ++i) {
+      const double x = i - Center -
+                       static_cast<double>(phase) / BlipBuffer::Phases;
+      const double sinc =
+          x == 0.0 ? 1.0 : std::sin(Pi * Cutoff * x) / (Pi * Cutoff * x);
+      const double window = 0.42 + 0.5 * std::cos(Pi * x / HalfWidth) +
+                            0.08 * std::cos(2.0 * Pi * x / HalfWidth);
+      impulse[i] = sinc * window;
+    }
+    const double sum = std::accumulate(impulse.begin(), impulse.end(), 0.0);
+    auto& taps = kernel[phase];
+    for (u32 i = 0; i < BlipBuffer::KernelTaps; ++i) {
+      taps[i] = static_cast<s32>(std::lround(impulse[i] / sum * Unity));
+    }
+    // Rounding leftovers go to the largest tap
+    const s32 error =
+        Unity - std::accumulate(taps.begin(), taps.end(), s32{0});
+    *std::max_element(taps.begin(), taps.end()) += error;
+  }
+  return kernel;
+}
+
+const BlipBuffer::Kernel& BlipBuffer::kernel() {
+  static const Kernel kernel = make_kernel();
+  return kernel;
+}
+
+void BlipBuffer::read_samples(u32 count, s32* output, u32 stride) {
+  if (m_deltas.size() < count) {
+    m_deltas.resize(count);
+  }
+  s32 sum = m_sum;
+  for (u32 i = 0; i < count; ++i) {
+    sum += m_deltas[i];
+    output[i * stride] = sum;
+  }
+  m_sum = sum;
+  m_deltas.erase(m_deltas.begin(), m_deltas.begin() + count);
+  m_offset += count;
+}
+
+TEST_CASE("BlipBuffer steps should settle on the exact level") {
+  constexpr s32 Unity = 1 << BlipBuffer::SampleBits;
+  BlipBuffer blip{48000};
+  // Lands halfway between samples 10 and 11
+  blip.add_delta(u64{16777216} * 21 / 96000, 100);
+  // A millisecond, minus the sample that isn't complete yet
+  const u32 count = blip.samples_until(16777216 / 1000);
+  REQUIRE(count == 47);
+
+  std::vector<s32> samples(count);
+  blip.read_samples(count, samples.data(), 1);
+  CHECK(samples[9] == 0);
+  // The kernel centers it 7.5 samples later, between samples 17 and 18
+  CHECK(samples[17] < 50 * Unity);
+  CHECK(samples[18] > 50 * Unity);
+  for (u32 i = 10 + BlipBuffer::KernelTaps; i < count; ++i) {
+    CHECK(samples[i] == 100 * Unity);
+  }
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "types.h"
+
+namespace gb::advance {
+
+// Band-limited step synthesis in the style of blip_buf. Level changes are
+// added as steps at their exact cycle, each one spread over KernelTaps
+// output samples with a windowed sinc picked by its fractional position.
+// Reading integrates the steps back into samples at any host rate.
+class BlipBuffer {
+ public:
+  static constexpr u32 CyclesPerSecondBits = 24;
+  static constexpr u32 KernelTaps = 16;
+  static constexpr u32 PhaseBits = 6;
+  static constexpr u32 Phases = 1 << PhaseBits;
+  // Read samples are the level scaled by this many bits
+  static constexpr u32 SampleBits = 15;
+
+  using Kernel = std::array<std::array<s32, KernelTaps>, Phases>;
+
+  explicit BlipBuffer(u32 sample_rate)
+      : m_sample_rate{sample_rate}, m_kernel{&kernel()} {}
+
+  // Adds delta to the level from cycle on
+  void add_delta(u64 cycle, s32 delta) {
+    const u64 position = cycle * m_sample_rate;
+    const u64 index = position >> CyclesPerSecondBits;
+    if (index < m_offset) {
+      add_delta_at(0, 0, delta);
+      return;
+    }
+    const u32 phase = (position >> (CyclesPerSecondBits - PhaseBits)) &
+                      (Phases - 1);
+    add_delta_at(static_cast<std::size_t>(index - m_offset), phase, delta);
+  }
+
+  // Samples whose steps are all in by cycle
+  [[nodiscard]] u32 samples_until(u64 cycle) const noexcept {
+    const u64 end = (cycle * m_sample_rate) >> CyclesPerSecondBits;
+    return end > m_offset ? static_cast<u32>(end - m_offset) : 0;
+  }
+
+  // Integrates count samples into output, stride apart, and drops them
+  void read_samples(u32 count, s32* output, u32 stride);
+
+ private:
+  void add_delta_at(std::size_t index, u32 phase, s32 delta) {
+    if (m_deltas.size() < index + KernelTaps) {
+      m_deltas.resize(index + KernelTaps);
+    }
+    // Fixed length and contiguous, so this vectorizes
+    const auto& taps = (*m_kernel)[phase];
+    s32* const deltas = m_deltas.data() + index;
+    for (u32 i = 0; i < KernelTaps; ++i) {
+      deltas[i] += delta * taps[i];
+    }
+  }
+
+  static const Kernel& kernel();
+
+  u32 m_sample_rate;
+  const Kernel* m_kernel;
+  // Absolute index of the sample at m_deltas[0]
+  u64 m_offset = 0;
+  s32 m_sum = 0;
+  std::vector<s32> m_deltas;
+};
+
+}  // namespace gb::advance
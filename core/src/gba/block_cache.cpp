@@ -0,0 +1,56 @@
+#include "gba/block_cache.h"
+#include <algorithm>
+
+namespace gb::advance {
+
+ArmBlock& BlockCache::insert(u32 pc, ArmBlock block) {
+  register_pages(pc, block.instructions.size() * sizeof(u32), false);
+  return m_arm_blocks.insert_or_assign(pc, std::move(block)).first->second;
+}
+
+ThumbBlock& BlockCache::insert(u32 pc, ThumbBlock block) {
+  register_pages(pc, block.instructions.size() * sizeof(u16), true);
+  return m_thumb_blocks.insert_or_assign(pc, std::move(block)).first->second;
+}
+
+void BlockCache::register_pages(u32 pc, u32 size_bytes, bool thumb) {
+  const u32 first_page = code_page(pc);
+  if (first_page == NoCodePage) {
+    return;
+  }
+  const u32 last_page = code_page(pc + size_bytes - 1);
+  for (u32 page = first_page; page <= last_page && page < CodePageCount;
+       ++page) {
+    auto& keys = m_page_blocks[page];
+    // A block that was dropped through another page leaves its key behind
+    if (std::none_of(keys.begin(), keys.end(), [pc, thumb](BlockKey key) {
+          return key.pc == pc && key.thumb == thumb;
+        })) {
+      keys.push_back({pc, thumb});
+    }
+  }
+}
+
+void BlockCache::invalidate_page(u32 page) {
+  auto& keys = m_page_blocks[page];
+  for (const auto [pc, thumb] : keys) {
+    if (thumb) {
+      m_thumb_blocks.erase(pc);
+    } else {
+      m_arm_blocks.erase(pc);
+    }
+  }
+  keys.clear();
+  ++m_generation;
+}
+
+void BlockCache::clear() {
+  m_arm_blocks.clear();
+  m_thumb_blocks.clear();
+  for (auto& keys : m_page_blocks) {
+    keys.clear();
+  }
+  ++m_generation;
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <unordered_map>
+#include <vector>
+#include "gba/hardware.h"
+#include "gba/thumb_instructions.h"
+#include "types.h"
+#include "utils.h"
+
+namespace gb::advance {
+
+using InstFunc = u32 (*)(Cpu&, u32);
+
+// Host code for a block. Takes the register file, the cycle budget and the
+// cache generation at entry, and returns the cycles used.
+using CompiledBlock = u32 (*)(Cpu& cpu,
+                              u32* regs,
+                              int cycle_budget,
+                              u32 generation);
+
+template <typename Func, typename Opcode>
+struct DecodedInstruction {
+  Func handler;
+  Opcode opcode;
+};
+
+// A run of pre-decoded instructions starting at a fixed guest address. Blocks
+// end at the first instruction that can write R15.
+template <typename Func, typename Opcode>
+struct Block {
+  using OpcodeType = Opcode;
+  std::vector<DecodedInstruction<Func, Opcode>> instructions;
+  u32 run_count = 0;
+  CompiledBlock compiled = nullptr;
+  bool idle_loop = false;
+};
+
+using ArmBlock = Block<InstFunc, u32>;
+using ThumbBlock = Block<ThumbInstFunc, u16>;
+
+class BlockCache {
+ public:
+  // EWRAM and IWRAM are tracked in 256 byte pages so that stack and data
+  // writes next to code don't throw away blocks.
+  static constexpr u32 CodePageSize = 256;
+  static constexpr u32 EWramCodePages = 256_kb / CodePageSize;
+  static constexpr u32 CodePageCount = EWramCodePages + 32_kb / CodePageSize;
+
+  static constexpr u32 NoCodePage = 0xffffffff;
+
+  // Returns the code page for addresses in writable memory, or NoCodePage if
+  // the address can't be written by the guest.
+  [[nodiscard]] static constexpr u32 code_page(u32 addr) noexcept {
+    switch (addr >> 24) {
+      case 0x02:
+        return (addr & 0x3ffff) / CodePageSize;
+      case 0x03:
+        return EWramCodePages + (addr & 0x7fff) / CodePageSize;
+      default:
+        return NoCodePage;
+    }
+  }
+
+  [[nodiscard]] ArmBlock* find_arm(u32 pc) {
+    const auto block = m_arm_blocks.find(pc);
+    return block != m_arm_blocks.end() ? &block->second : nullptr;
+  }
+
+  [[nodiscard]] ThumbBlock* find_thumb(u32 pc) {
+    const auto block = m_thumb_blocks.find(pc);
+    return block != m_thumb_blocks.end() ? &block->second : nullptr;
+  }
+
+  ArmBlock& insert(u32 pc, ArmBlock block);
+  ThumbBlock& insert(u32 pc, ThumbBlock block);
+
+  // Drops every block that overlaps the code page.
+  void invalidate_page(u32 page);
+
+  void clear();
+
+  // Incremented whenever blocks are dropped so a running block can tell that
+  // it was overwritten.
+  [[nodiscard]] u32 generation() const noexcept { return m_generation; }
+
+ private:
+  struct BlockKey {
+    u32 pc;
+    bool thumb;
+  };
+
+  void register_pages(u32 pc, u32 size_bytes, bool thumb);
+
+  std::unordered_map<u32, ArmBlock> m_arm_blocks;
+  std::unordered_map<u32, ThumbBlock> m_thumb_blocks;
+  std::array<std::vector<BlockKey>, CodePageCount> m_page_blocks;
+  u32 m_generation = 0;
+};
+
+}  // namespace gb::advance
@@ -1,5 +1,6 @@
 #pragma once
 #include "cpu.h"
+#include "gba/shifter.h"
 
 namespace gb::advance {
 template <typename T>
@@ -18,7 +19,7 @@ void run_load(Cpu& cpu, u32 addr, Register dest_reg) {
   }();
   cpu.set_reg(dest_reg,
               static_cast<std::conditional_t<std::is_signed_v<T>, s32, u32>>(
-                  rotate_right(value, rotate_amount)));
+                  rotr(value, rotate_amount)));
 }
 
 constexpr Cycles load_store_cycles(Register dest_reg, bool load) {
@@ -87,252 +88,25 @@ template <typename T>
 }
 
 }  // namespace multiply::detail
-enum class ShiftType : u32 {
-  LogicalLeft = 0,
-  LogicalRight,
-  ArithmeticRight,
-  RotateRight,
-};
-
-struct ShiftResult {
-  ShiftType shift_type;
-  u32 shift_amount;
-  u32 shift_value;
-  std::optional<u32> result;
-  std::optional<bool> set_carry;
-};
-
-constexpr ShiftResult compute_shift_value(u32 value, const Cpu& cpu) {
-  const auto shift_type = static_cast<ShiftType>((value >> 5) & 0b11);
-  const auto reg = static_cast<Register>(value & 0xf);
-  const bool register_specified =
-      gb::test_bit(value, 4);  // Shift is specified by a register
-
-  const u8 shift_amount = [&]() -> u8 {
-    if (register_specified) {
-      // Shift by bottom byte of register
-      const u32 shift_reg = (value >> 8) & 0xf;
-      const u8 amount =
-          shift_reg == 15
-              ? 0
-              : static_cast<u8>(cpu.reg(static_cast<Register>(shift_reg)) &
-                                0xff);
-      return amount;
-    }
-
-    // Shift by 5 bit number
-    return static_cast<u8>((value >> 7) & 0b0001'1111);
-  }();
-
-  const u32 reg_value =
-      cpu.reg(reg) +
-      // TODO: Is this offset correct?
-      (register_specified && reg == Register::R15 ? 4 : 0);  // Rm
-
-  if (shift_amount > 0 && shift_amount < 32) {
-    return {shift_type, shift_amount, reg_value, std::nullopt, std::nullopt};
+// Operand 2 of a data processing instruction, or the offset of a single
+// data transfer, when it is a shifted register
+inline ShifterOutput shifted_register(const Cpu& cpu, u32 instruction) {
+  const auto shift_type = static_cast<ShiftType>((instruction >> 5) & 0b11);
+  const auto reg = static_cast<Register>(instruction & 0xf);
+  const bool carry = cpu.carry() != 0;
+
+  // Shift is specified by a register
+  if (gb::test_bit(instruction, 4)) {
+    const u32 shift_reg = (instruction >> 8) & 0xf;
+    const u32 amount =
+        shift_reg == 15 ? 0 : cpu.reg(static_cast<Register>(shift_reg));
+    // TODO: Is this offset correct?
+    const u32 value = cpu.reg(reg) + (reg == Register::R15 ? 4 : 0);
+    return shift_by_register(shift_type, value, amount, carry);
   }
-  // Allow carry and the result to be overridden
-  const auto [error_value, set_carry] =
-      [&]() -> std::pair<std::optional<u32>, std::optional<bool>> {
-    if (register_specified && shift_amount == 0) {
-      return {{}, cpu.program_status().carry()};
-    }
-    switch (shift_type) {
-      case ShiftType::LogicalLeft:
-        if (register_specified) {
-          if (shift_amount == 32) {
-            return {0, gb::test_bit(reg_value, 0)};
-          }
-          if (shift_amount > 32) {
-            return {0, false};
-          }
-        } else {
-          if (shift_amount == 0) {
-            // return {0, gb::test_bit(reg_value, 31)};
-            return {reg_value, cpu.program_status().carry()};
-          }
-        }
-        return {std::nullopt, std::nullopt};
 
-      case ShiftType::LogicalRight:
-        if (register_specified) {
-          if (shift_amount == 32) {
-            return {0, gb::test_bit(reg_value, 31)};
-          }
-          if (shift_amount > 32) {
-            return {0, false};
-          }
-        } else {
-          if (shift_amount == 0) {
-            return {0, gb::test_bit(reg_value, 31)};
-            // return {reg_value, gb::test_bit(reg_value, 31)};
-          }
-        }
-        return {std::nullopt, std::nullopt};
-      case ShiftType::ArithmeticRight:
-        if (shift_amount >= 32 || shift_amount == 0) {
-          const bool is_negative = gb::test_bit(reg_value, 31);
-          return {is_negative ? 0xffffffff : 0, is_negative};
-        }
-        return {std::nullopt, std::nullopt};
-
-      case ShiftType::RotateRight:
-        if (shift_amount == 0) {
-          const bool carry = gb::test_bit(reg_value, 0);
-          return {(cpu.carry() << 31) | (reg_value >> 1), carry};
-        }
-        return {std::nullopt, std::nullopt};
-
-      default:
-        return {std::nullopt, std::nullopt};
-    }
-  }();
-
-  return {shift_type, shift_amount, reg_value, error_value, set_carry};
-}
-
-constexpr bool compute_carry(ShiftType shift_type,
-                             u32 shift_operand,
-                             u32 shift_amount) {
-  if (shift_amount == 0) {
-    return false;
-  }
-  switch (shift_type) {
-    case ShiftType::LogicalLeft:
-      if (shift_amount > 31) {
-        return false;
-      }
-      return shift_amount != 0 &&
-             gb::test_bit(shift_operand, 32 - shift_amount);
-    case ShiftType::LogicalRight:
-      if (shift_amount > 31) {
-        return test_bit(shift_operand, 31);
-      }
-      return gb::test_bit(shift_operand, shift_amount - 1);
-    case ShiftType::ArithmeticRight:
-      if (shift_amount > 31) {
-        return test_bit(shift_operand, 31);
-      }
-      return gb::test_bit(shift_operand, shift_amount - 1);
-    case ShiftType::RotateRight:
-      if (shift_amount > 32) {
-        return test_bit(shift_operand, shift_amount - 32 - 1);
-      }
-      return shift_amount != 0 && gb::test_bit(shift_operand, shift_amount - 1);
-  }
-  GB_UNREACHABLE();
-}
-
-struct ShiftFlags {
-  std::optional<u32> result;
-  bool set_carry;
-};
-
-inline ShiftFlags compute_carry(Cpu& cpu,
-                                ShiftType shift_type,
-                                bool register_specified,
-                                u32 reg_value,
-                                u32 shift_amount) {
-  const auto [error_value, set_carry] =
-      [&]() -> std::pair<std::optional<u32>, std::optional<bool>> {
-    if (register_specified && shift_amount == 0) {
-      return {{}, cpu.program_status().carry()};
-    }
-    switch (shift_type) {
-      case ShiftType::LogicalLeft:
-        if (register_specified) {
-          if (shift_amount == 32) {
-            return {0, gb::test_bit(reg_value, 0)};
-          }
-          if (shift_amount > 32) {
-            return {0, false};
-          }
-        } else {
-          if (shift_amount == 0) {
-            return {reg_value, cpu.program_status().carry()};
-          }
-        }
-        return {std::nullopt, std::nullopt};
-
-      case ShiftType::LogicalRight:
-        if (register_specified) {
-          if (shift_amount == 32) {
-            return {0, gb::test_bit(reg_value, 31)};
-          }
-          if (shift_amount > 32) {
-            return {0, false};
-          }
-        } else {
-          if (shift_amount == 0) {
-            return {0, gb::test_bit(reg_value, 31)};
-          }
-        }
-        return {std::nullopt, std::nullopt};
-      case ShiftType::ArithmeticRight:
-        if (shift_amount >= 32 || shift_amount == 0) {
-          const bool is_negative = gb::test_bit(reg_value, 31);
-          return {is_negative ? 0xffffffff : 0, is_negative};
-        }
-        return {std::nullopt, std::nullopt};
-
-      case ShiftType::RotateRight:
-        if (shift_amount == 0) {
-          const bool carry = gb::test_bit(reg_value, 0);
-          return {(cpu.carry() << 31) | (reg_value >> 1), carry};
-        }
-        return {std::nullopt, std::nullopt};
-
-      default:
-        return {std::nullopt, std::nullopt};
-    }
-  }();
-  return {error_value,
-          set_carry.value_or(!set_carry.has_value() && [&]() -> bool {
-            switch (shift_type) {
-              case ShiftType::LogicalLeft:
-                return shift_amount != 0 &&
-                       gb::test_bit(reg_value, 32 - shift_amount);
-              case ShiftType::LogicalRight:
-                return gb::test_bit(reg_value, shift_amount - 1);
-              case ShiftType::ArithmeticRight:
-                return gb::test_bit(reg_value, shift_amount - 1);
-              case ShiftType::RotateRight:
-                return gb::test_bit(
-                    reg_value,
-                    (shift_amount > 32 ? shift_amount - 32 : shift_amount) - 1);
-            }
-            GB_UNREACHABLE();
-          }())};
-}
-
-constexpr u32 compute_result(ShiftType shift_type,
-                             u32 shift_operand,
-                             u32 shift_amount) {
-  switch (shift_type) {
-    case ShiftType::LogicalLeft:
-      return shift_operand << shift_amount;
-    case ShiftType::LogicalRight:
-      return shift_operand >> shift_amount;
-    case ShiftType::ArithmeticRight:
-      return arithmetic_shift_right(shift_operand, shift_amount);
-    case ShiftType::RotateRight:
-      return rotate_right(shift_operand, shift_amount);
-  }
-  GB_UNREACHABLE();
-}
-
-constexpr std::tuple<bool, u32> compute_shifted_operand(
-    const ShiftResult shift_result) {
-  const auto [shift_type, shift_amount, shift_operand, result, set_carry] =
-      shift_result;
-
-  return {set_carry.value_or(
-              compute_carry(shift_type, shift_operand, shift_amount)),
-          result.value_or(
-              !result.has_value()
-                  ? compute_result(shift_type, shift_operand, shift_amount)
-                  : 0xdeadbeef)};
+  return shift_by_immediate(shift_type, cpu.reg(reg),
+                            (instruction >> 7) & 0b1'1111, carry);
 }
 
 namespace common {
@@ -351,9 +125,7 @@ void data_processing(Cpu& cpu,
 
   const auto run_logical = [&, shift_carry](u32 result, bool write = true) {
     if constexpr (SetConditionCode) {
-      cpu.set_carry(shift_carry);
-      cpu.set_zero(result == 0);
-      cpu.set_negative(gb::test_bit(result, 31));
+      cpu.set_logical_flags(result, shift_carry);
     } else {
       static_cast<void>(shift_carry);
     }
@@ -370,18 +142,13 @@ void data_processing(Cpu& cpu,
 
     const u32 result_32 = static_cast<u32>(result & 0xffffffff);
     if constexpr (SetConditionCode) {
-      const bool overflow =
-          invert_carry
-              ? (((op1 ^ op2) >> 31) & 0b1) && (((op1 ^ result_32) >> 31) & 0b1)
-              : (!(((op1 ^ op2) >> 31) & 0b1)) &&
-                    (((op2 ^ result_32) >> 31) & 0b1);
-      cpu.set_overflow(overflow);
-      cpu.set_zero(result_32 == 0);
-      cpu.set_negative(gb::test_bit(result_32, 31));
-      if (carry_override) {
-        cpu.set_carry(carry_override_value);
+      const auto lhs = static_cast<u32>(op1);
+      const auto rhs = static_cast<u32>(op2);
+      if (invert_carry) {
+        cpu.set_sub_flags(lhs, rhs, result_32,
+                          carry_override ? carry_override_value : op2 <= op1);
       } else {
-        cpu.set_carry((invert_carry ? (op2 <= op1) : gb::test_bit(result, 32)));
+        cpu.set_add_flags(lhs, rhs, result_32, gb::test_bit(result, 32));
       }
     } else {
       static_cast<void>(carry_override_value);
@@ -417,6 +184,8 @@ void data_processing(Cpu& cpu,
           [carry_value](u64 op1, u64 op2) { return op1 + op2 + carry_value; },
           false);
       break;
+    // The borrow includes the carry in, so C is computed here and stored in
+    // the pending flags along with the operands
     case Opcode::Sbc:
       run_arithmetic(
           operand1, operand2, true,
@@ -428,13 +197,14 @@ void data_processing(Cpu& cpu,
               operand1);
       break;
     case Opcode::Rsc:
+      // op2 - op1
       run_arithmetic(
-          operand1, operand2, true,
+          operand2, operand1, true,
           [carry_value](u64 op1, u64 op2) {
-            return op2 - op1 + carry_value - 1;
+            return op1 - op2 + carry_value - 1;
           },
           true, true,
-          static_cast<u64>(operand1) + static_cast<u64>(carry_value) - 1 <=
+          (static_cast<u64>(operand1) - static_cast<u64>(carry_value) + 1) <=
               operand2);
       break;
     case Opcode::Cmp:
@@ -480,30 +250,14 @@ inline void run_shift(Cpu& cpu,
                       u32 value,
                       u32 shift_amount,
                       bool register_specified) {
-  const u32 shifted_value = [&]() -> u32 {
-    switch (shift_type) {
-      // LSL
-      case ShiftType::LogicalLeft:
-        return shift_amount < 32 ? (value << shift_amount) : 0;
-      case ShiftType::LogicalRight:
-        return value >> shift_amount;
-      case ShiftType::ArithmeticRight:
-        return static_cast<s32>(value) >> shift_amount;
-      case ShiftType::RotateRight:
-        return rotate_right(value, shift_amount);
-      default:
-        GB_UNREACHABLE();
-    }
-  }();
-
-  const auto [override_result, carry] =
-      compute_carry(cpu, shift_type, register_specified, value, shift_amount);
-
-  cpu.set_negative(test_bit(shifted_value, 31));
-  cpu.set_zero(override_result.value_or(shifted_value) == 0);
-  cpu.set_carry(carry);
-
-  cpu.set_reg(dest_reg, override_result.value_or(shifted_value));
+  const bool carry = cpu.carry() != 0;
+  const auto [result, carry_out] =
+      register_specified
+          ? shift_by_register(shift_type, value, shift_amount, carry)
+          : shift_by_immediate(shift_type, value, shift_amount, carry);
+  cpu.set_logical_flags(result, carry_out);
+
+  cpu.set_reg(dest_reg, result);
 }
 
 inline void multiply(
@@ -521,8 +275,7 @@ inline void multiply(
   cpu.set_reg(dest_register, res);
 
   if (set_condition_code) {
-    cpu.set_zero(res == 0);
-    cpu.set_negative(gb::test_bit(res, 31));
+    cpu.set_multiply_flags(res);
   }
 }
 
@@ -0,0 +1,269 @@
+#include "gba/compositor.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include "gba/blend.h"
+#include "utils.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace gb::advance {
+namespace {
+constexpr u32 EffectsBit = 5;
+
+enum class BlendMode : u32 {
+  None = 0,
+  Alpha = 1,
+  BrightnessIncrease = 2,
+  BrightnessDecrease = 3,
+};
+
+// What compose picks for each pixel
+enum class Effect : u8 { None, Alpha, Fade };
+
+// BGR555 to 8 bits per channel, as convert_space<32, 256>
+void to_colors(nonstd::span<const u16> colors, nonstd::span<Color> out) {
+  const auto count = static_cast<u32>(colors.size());
+  u32 x = 0;
+#ifdef __SSE2__
+  static_assert(sizeof(Color) == 4);
+  const __m128i channel_mask = _mm_set1_epi16(0x1f << 3);
+  const __m128i opaque = _mm_set1_epi16(static_cast<s16>(0xff00));
+  for (; x + 8 <= count; x += 8) {
+    const __m128i color =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors.data() + x));
+    const __m128i red = _mm_and_si128(_mm_slli_epi16(color, 3), channel_mask);
+    const __m128i green = _mm_and_si128(_mm_srli_epi16(color, 2), channel_mask);
+    const __m128i blue = _mm_and_si128(_mm_srli_epi16(color, 7), channel_mask);
+    // Interleave r | g << 8 with b | a << 8 into RGBA
+    const __m128i red_green = _mm_or_si128(red, _mm_slli_epi16(green, 8));
+    const __m128i blue_alpha = _mm_or_si128(blue, opaque);
+    auto* const dest = reinterpret_cast<__m128i*>(out.data() + x);
+    _mm_storeu_si128(dest, _mm_unpacklo_epi16(red_green, blue_alpha));
+    _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(red_green, blue_alpha));
+  }
+#endif
+  for (; x < count; ++x) {
+    const u16 color = colors[x];
+    out[x] = {static_cast<u8>(convert_space<32, 256>(color & 0x1f)),
+              static_cast<u8>(convert_space<32, 256>((color >> 5) & 0x1f)),
+              static_cast<u8>(convert_space<32, 256>((color >> 10) & 0x1f)),
+              255};
+  }
+}
+
+bool is_target(u32 targets, Compositor::Layer layer) {
+  return ((targets >> static_cast<u32>(layer)) & 1) != 0;
+}
+}  // namespace
+
+void Compositor::begin_scanline(u16 backdrop) {
+  for (auto& keys : m_keys) {
+    keys.fill(Transparent);
+  }
+  m_colors[static_cast<u32>(Layer::Backdrop)].fill(backdrop);
+  m_window.fill(0xff);
+  m_semi_transparent.fill(false);
+}
+
+void Compositor::hide_windowed_layers() {
+  for (u32 layer = 0; layer < KeyedLayers; ++layer) {
+    u8* const keys = m_keys[layer].data();
+    const auto bit = static_cast<u8>(1 << layer);
+    u32 x = 0;
+#ifdef __SSE2__
+    const __m128i layer_bit = _mm_set1_epi8(static_cast<char>(bit));
+    for (; x + 16 <= Width; x += 16) {
+      const __m128i window = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(m_window.data() + x));
+      const __m128i hidden = _mm_cmpeq_epi8(_mm_and_si128(window, layer_bit),
+                                            _mm_setzero_si128());
+      auto* const out = reinterpret_cast<__m128i*>(keys + x);
+      _mm_storeu_si128(out, _mm_or_si128(_mm_loadu_si128(out), hidden));
+    }
+#endif
+    for (; x < Width; ++x) {
+      keys[x] |= (m_window[x] & bit) != 0 ? 0 : Transparent;
+    }
+  }
+}
+
+void Compositor::find_top_layers(std::array<u8, Width>& top,
+                                 std::array<u8, Width>& second) const {
+  // Keeping the lowest two of each pixel's keys only needs min and max
+  u32 x = 0;
+#ifdef __SSE2__
+  for (; x + 16 <= Width; x += 16) {
+    __m128i lowest = _mm_set1_epi8(static_cast<char>(BackdropKey));
+    __m128i next = _mm_set1_epi8(static_cast<char>(Transparent));
+    for (const auto& keys : m_keys) {
+      const __m128i key =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys.data() + x));
+      next = _mm_min_epu8(next, _mm_max_epu8(lowest, key));
+      lowest = _mm_min_epu8(lowest, key);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(top.data() + x), lowest);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(second.data() + x), next);
+  }
+#endif
+  for (; x < Width; ++x) {
+    u8 lowest = BackdropKey;
+    u8 next = Transparent;
+    for (const auto& keys : m_keys) {
+      next = std::min(next, std::max(lowest, keys[x]));
+      lowest = std::min(lowest, keys[x]);
+    }
+    top[x] = lowest;
+    second[x] = next;
+  }
+}
+
+void Compositor::compose(const Blend& blend, nonstd::span<Color> out) {
+  hide_windowed_layers();
+  std::array<u8, Width> top;
+  std::array<u8, Width> second;
+  find_top_layers(top, second);
+
+  const auto mode = static_cast<BlendMode>((blend.control >> 6) & 0b11);
+  const u32 first_targets = blend.control & 0x3f;
+  const u32 second_targets = (blend.control >> 8) & 0x3f;
+  const Effect target_effect = mode == BlendMode::None    ? Effect::None
+                               : mode == BlendMode::Alpha ? Effect::Alpha
+                                                          : Effect::Fade;
+
+  // Gather the colors the effects need, then run each kernel over the whole
+  // line if any pixel uses it
+  std::array<u16, Width> first_colors;
+  std::array<u16, Width> second_colors;
+  std::array<Effect, Width> effects;
+  bool any_alpha = false;
+  bool any_fade = false;
+  for (u32 x = 0; x < Width; ++x) {
+    const Layer top_layer = layer_of(top[x]);
+    const Layer second_layer = layer_of(second[x]);
+    // Nothing is under a backdrop pixel, so it has no second target
+    const bool has_second = second_layer != Layer::None;
+    first_colors[x] = m_colors[static_cast<u32>(top_layer)][x];
+    const Layer under = has_second ? second_layer : Layer::Backdrop;
+    second_colors[x] = m_colors[static_cast<u32>(under)][x];
+    const bool second_target =
+        has_second && is_target(second_targets, second_layer);
+
+    Effect effect = Effect::None;
+    // Semi-transparent sprites blend whatever BLDCNT and the window say
+    if (top_layer == Layer::Obj && m_semi_transparent[x] && second_target) {
+      effect = Effect::Alpha;
+    } else if (gb::test_bit(m_window[x], EffectsBit) &&
+               is_target(first_targets, top_layer) &&
+               (target_effect != Effect::Alpha || second_target)) {
+      effect = target_effect;
+    }
+    effects[x] = effect;
+    any_alpha |= effect == Effect::Alpha;
+    any_fade |= effect == Effect::Fade;
+  }
+
+  std::array<u16, Width> alpha_colors;
+  std::array<u16, Width> faded_colors;
+  if (any_alpha) {
+    blend::alpha(first_colors, second_colors, alpha_colors,
+                 blend.first_weight, blend.second_weight);
+  }
+  if (any_fade) {
+    if (mode == BlendMode::BrightnessIncrease) {
+      blend::brighten(first_colors, faded_colors, blend.brightness);
+    } else {
+      blend::darken(first_colors, faded_colors, blend.brightness);
+    }
+  }
+
+  if (!any_alpha && !any_fade) {
+    to_colors(first_colors, out);
+    return;
+  }
+
+  std::array<u16, Width> colors;
+  for (u32 x = 0; x < Width; ++x) {
+    switch (effects[x]) {
+      case Effect::None:
+        colors[x] = first_colors[x];
+        break;
+      case Effect::Alpha:
+        colors[x] = alpha_colors[x];
+        break;
+      case Effect::Fade:
+        colors[x] = faded_colors[x];
+        break;
+    }
+  }
+  to_colors(colors, out);
+}
+
+TEST_CASE("Compositor should blend the top two layers of each pixel") {
+  using Layer = Compositor::Layer;
+  constexpr u16 backdrop = 0;
+  constexpr u16 red = 25;
+  constexpr u16 blue = 20 << 10;
+
+  Compositor compositor;
+  compositor.begin_scanline(backdrop);
+  // BG1 over BG0 by priority
+  compositor.put(Layer::Bg0, 0, blue, 1);
+  compositor.put(Layer::Bg1, 0, red, 0);
+  // Sprites win ties with backgrounds
+  compositor.put(Layer::Bg1, 1, blue, 0);
+  compositor.put_obj(1, red, 0, false);
+  // The window hides BG1 and blending
+  compositor.put(Layer::Bg0, 2, blue, 1);
+  compositor.put(Layer::Bg1, 2, red, 0);
+  compositor.set_window(2, 0b01'1101);
+  // Semi-transparent sprites blend even where the window doesn't
+  compositor.put(Layer::Bg0, 3, blue, 3);
+  compositor.put_obj(3, red, 0, true);
+  compositor.set_window(3, 0b01'1111);
+  // Every channel converts to 8 bits
+  compositor.put(Layer::Bg0, 5, 3 | 17 << 5 | 30 << 10, 0);
+
+  // Alpha with BG1 as the first target and BG0 as the second
+  const Compositor::Blend blend{1 << 6 | 1 << 1 | 1 << 8, 8, 8, 0};
+  std::array<Color, Compositor::Width> out;
+  compositor.compose(blend, out);
+
+  const auto check_color = [&out](u32 x, Color expected) {
+    CAPTURE(x);
+    CHECK(out[x].r == expected.r);
+    CHECK(out[x].g == expected.g);
+    CHECK(out[x].b == expected.b);
+    CHECK(out[x].a == 255);
+  };
+  // 25 and 20 halved, then scaled to 8 bits
+  check_color(0, {96, 0, 80});
+  check_color(1, {200, 0, 0});
+  check_color(2, {0, 0, 160});
+  check_color(3, {96, 0, 80});
+  check_color(4, {0, 0, 0});
+  check_color(5, {24, 136, 240});
+}
+
+TEST_CASE("Compositor should not blend backdrop pixels with anything") {
+  using Layer = Compositor::Layer;
+  constexpr u16 backdrop = 20 << 10;
+
+  Compositor compositor;
+  compositor.begin_scanline(backdrop);
+  compositor.put(Layer::Bg0, 1, 25, 0);
+
+  // Alpha with the backdrop as the first target and every layer as the
+  // second
+  const Compositor::Blend blend{1 << 6 | 1 << 5 | 0x3f << 8, 8, 8, 0};
+  std::array<Color, Compositor::Width> out;
+  compositor.compose(blend, out);
+
+  CHECK(out[0].r == 0);
+  CHECK(out[0].b == 160);
+  CHECK(out[1].r == 200);
+  CHECK(out[1].b == 0);
+}
+
+}  // namespace gb::advance
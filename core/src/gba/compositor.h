@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <nonstd/span.hpp>
+#include "color.h"
+#include "types.h"
+
+namespace gb::advance {
+
+// Combines the layers of a scanline. The renderers fill a line of BGR555
+// colors and a key line for each layer, where the key holds the priority and
+// the order equal priorities stack in. Composing masks out what the window hides, finds
+// the top two layers of every pixel with min passes over the key lines, and
+// blends those that BLDCNT selects.
+class Compositor {
+ public:
+  static constexpr u32 Width = 240;
+
+  // In the bit order of BLDCNT and the window registers
+  enum class Layer : u32 { Bg0, Bg1, Bg2, Bg3, Obj, Backdrop, None };
+
+  struct Blend {
+    // BLDCNT
+    u16 control;
+    // EVA, EVB and EVY in sixteenths
+    u32 first_weight;
+    u32 second_weight;
+    u32 brightness;
+  };
+
+  // Clears every layer but the backdrop, and shows all of them through the
+  // window
+  void begin_scanline(u16 backdrop);
+
+  void put(Layer layer, u32 x, u16 color, u32 priority) {
+    const auto index = static_cast<u32>(layer);
+    m_colors[index][x] = color;
+    m_keys[index][x] = key(layer, priority);
+  }
+
+  // Sprites drawn later cover earlier ones whatever their priorities
+  void put_obj(u32 x, u16 color, u32 priority, bool semi_transparent) {
+    put(Layer::Obj, x, color, priority);
+    m_semi_transparent[x] = semi_transparent;
+  }
+
+  // Bits 0 to 4 show each layer, bit 5 enables blending
+  void set_window(u32 x, u8 bits) { m_window[x] = bits; }
+
+  void compose(const Blend& blend, nonstd::span<Color> out);
+
+ private:
+  static constexpr u8 Transparent = 0xff;
+  // The backdrop is always there, so it doesn't need a key line
+  static constexpr u32 KeyedLayers = 5;
+
+  // Priority in bits 3 and up, then sprites, BG0, BG1, BG2, BG3 and the
+  // backdrop. The lowest key is on top.
+  static constexpr u8 key(Layer layer, u32 priority) {
+    const u32 order = layer == Layer::Obj ? 0 : static_cast<u32>(layer) + 1;
+    return static_cast<u8>(priority << 3 | order);
+  }
+
+  // Below every priority, as key(Layer::Backdrop, 4)
+  static constexpr u8 BackdropKey = 4 << 3 | 6;
+
+  static constexpr Layer layer_of(u8 key) {
+    constexpr std::array<Layer, 8> layers = {
+        Layer::Obj, Layer::Bg0,  Layer::Bg1,      Layer::Bg2,
+        Layer::Bg3, Layer::None, Layer::Backdrop, Layer::None};
+    return layers[key & 0b111];
+  }
+
+  void hide_windowed_layers();
+  void find_top_layers(std::array<u8, Width>& top,
+                       std::array<u8, Width>& second) const;
+
+  std::array<std::array<u16, Width>, 6> m_colors{};
+  std::array<std::array<u8, Width>, KeyedLayers> m_keys{};
+  std::array<u8, Width> m_window{};
+  std::array<bool, Width> m_semi_transparent{};
+};
+
+}  // namespace gb::advance
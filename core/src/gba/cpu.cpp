@@ -1,9 +1,12 @@
 #include "gba/cpu.h"
 #include <fmt/printf.h>
+#include <bitset>
 #include <type_traits>
 #include "error_handling.h"
 #include "gba/common_instructions.h"
 #include "gba/hle.h"
+#include "gba/idle_loop.h"
+#include "gba/m4a.h"
 #include "gba/thumb_instructions.h"
 #include "utils.h"
 
@@ -27,6 +30,7 @@ enum class SoftwareInterruptType : u32 {
   SoundDriverVSyncOff = 0x28,
   NonstdStopExecution = 0xff,
   NonstdPrintInt = 0xfe,
+  NonstdM4aSoundMainRam = hle::m4a::SoundMainRamSwi,
 };
 
 u32 execute_software_interrupt(Cpu& cpu, u32 instruction) {
@@ -43,7 +47,7 @@ u32 execute_software_interrupt(Cpu& cpu, u32 instruction) {
     case SoftwareInterruptType::RegisterRamReset:
       break;
     case SoftwareInterruptType::Halt:
-      cpu.halted = true;
+      cpu.halt();
       break;
     case SoftwareInterruptType::VBlankIntrWait: {
       const u32 next_pc = cpu.reg(Register::R15) - cpu.prefetch_offset();
@@ -102,20 +106,24 @@ u32 execute_software_interrupt(Cpu& cpu, u32 instruction) {
       if (memory_region(src) == 0) {
         break;
       }
+      const u32 size = cpu.mmu()->at<u32>(src) >> 8;
       const auto [source_storage, source_addr] = cpu.mmu()->select_storage(src);
       const auto [dest_storage, dest_addr] =
           cpu.mmu()->select_storage(cpu.reg(Register::R1));
       lz77_decompress(source_storage.subspan(source_addr),
                       dest_storage.subspan(dest_addr), 1);
+      cpu.mmu()->notify_write(cpu.reg(Register::R1), size);
       break;
     }
     case SoftwareInterruptType::Lz77Vram: {
+      const u32 dest = cpu.reg(Register::R1) & ~1;
+      const u32 size = cpu.mmu()->at<u32>(cpu.reg(Register::R0)) >> 8;
       const auto [source_storage, source_addr] =
           cpu.mmu()->select_storage(cpu.reg(Register::R0));
-      const auto [dest_storage, dest_addr] =
-          cpu.mmu()->select_storage(cpu.reg(Register::R1) & ~1);
+      const auto [dest_storage, dest_addr] = cpu.mmu()->select_storage(dest);
       lz77_decompress(source_storage.subspan(source_addr),
                       dest_storage.subspan(dest_addr), 2);
+      cpu.mmu()->notify_write(dest, size);
       break;
     }
     case SoftwareInterruptType::MidiKeyToFreq: {
@@ -136,6 +144,9 @@ u32 execute_software_interrupt(Cpu& cpu, u32 instruction) {
     case SoftwareInterruptType::NonstdPrintInt:
       fmt::printf("%d\n", cpu.reg(Register::R0));
       break;
+    case SoftwareInterruptType::NonstdM4aSoundMainRam:
+      hle::m4a::sound_main_ram(cpu);
+      break;
     default:
       throw std::runtime_error(fmt::format("unimplemented swi {}",
                                            static_cast<u32>(interrupt_type)));
@@ -167,7 +178,7 @@ void Cpu::handle_interrupts() {
     if (gb::test_bit(ime, 0) && program_status().irq_enabled()) {
       const u32 next_pc = reg(Register::R15) - prefetch_offset() + 4;
 
-      set_saved_program_status_for_mode(Mode::IRQ, m_current_program_status);
+      set_saved_program_status_for_mode(Mode::IRQ, program_status());
       change_mode(Mode::IRQ);
       set_reg(Register::R14, next_pc);
 
@@ -180,8 +191,7 @@ void Cpu::handle_interrupts() {
 #endif
 }
 
-[[nodiscard]] bool should_execute(u32 instruction,
-                                  ProgramStatus program_status) {
+bool should_execute(u32 instruction, ProgramStatus program_status) {
   const auto condition = static_cast<Condition>((instruction >> 28) & 0b1111);
 
   switch (condition) {
@@ -221,8 +231,6 @@ void Cpu::handle_interrupts() {
   throw std::runtime_error("invalid condition");
 }
 
-using InstFunc = u32 (*)(Cpu&, u32);
-
 template <bool link>
 constexpr u32 make_branch(Cpu& cpu, u32 instruction) {
   const bool negative = test_bit(instruction, 23);
@@ -253,27 +261,13 @@ constexpr Register rd(u32 instruction) noexcept {
   return static_cast<Register>((instruction >> 12) & 0xf);
 }
 
-template <bool immediate_operand>
-constexpr auto shift_value(const Cpu& cpu, u32 instruction) -> ShiftResult {
-  if constexpr (immediate_operand) {
-    const auto shift_amount = static_cast<u8>(((instruction >> 8) & 0xf) * 2);
-    const auto shift_operand = instruction & 0xff;
-    return {ShiftType::RotateRight,
-            shift_amount,
-            shift_operand,
-            {},
-            shift_amount == 0 ? false
-                              : gb::test_bit(shift_operand, shift_amount - 1)};
-  }
-  return compute_shift_value(instruction, cpu);
-}
-
 template <bool immediate_operand>
 auto compute_operand2(const Cpu& cpu, u32 instruction)
     -> std::tuple<bool, u32> {
-  const ShiftResult shift_result =
-      shift_value<immediate_operand>(cpu, instruction);
-  return compute_shifted_operand(shift_result);
+  const auto [value, carry] =
+      immediate_operand ? rotated_immediate(instruction, cpu.carry() != 0)
+                        : shifted_register(cpu, instruction);
+  return {carry, value};
 }
 
 namespace arm {
@@ -304,8 +298,7 @@ u32 make_multiply(Cpu& cpu, u32 instruction) {
   cpu.set_reg(dest_register(), res);
 
   if (set_condition_code) {
-    cpu.set_zero(res == 0);
-    cpu.set_negative(gb::test_bit(res, 31));
+    cpu.set_multiply_flags(res);
   }
 
   return multiply::detail::multiply_cycles(rhs_operand, accumulate).sum();
@@ -350,8 +343,7 @@ u32 make_multiply_long(Cpu& cpu, u32 instruction) {
   cpu.set_reg(dest_register_low, res & 0xffffffff);
 
   if (set_condition_code) {
-    cpu.set_zero(res == 0);
-    cpu.set_negative(gb::test_bit(res, 63));
+    cpu.set_multiply_long_flags(res);
   }
   return multiply::detail::multiply_long_cycles(rhs, accumulate, is_signed)
       .sum();
@@ -486,7 +478,8 @@ u32 make_halfword_data_transfer(Cpu& cpu, u32 instruction) {
     }
   }
 
-  return mmu.wait_cycles(addr, load_store_cycles(rd(instruction), load));
+  return mmu.wait_cycles(addr, load_store_cycles(rd(instruction), load),
+                         access_width<Type>());
 }
 
 template <bool byte_swap>
@@ -512,7 +505,7 @@ u32 make_single_data_swap(Cpu& cpu, u32 instruction) {
   }
   cpu.set_reg(rd(instruction), mem_value);
 
-  return mmu.wait_cycles(base_value, cycles);
+  return mmu.wait_cycles(base_value, cycles, access_width<T>());
 }
 
 template <bool immediate_offset,
@@ -528,10 +521,7 @@ u32 make_single_data_transfer(Cpu& cpu, u32 instruction) {
       return instruction & 0xfff;
     }
 
-    const ShiftResult shift_result = compute_shift_value(instruction, cpu);
-    const auto [set_carry, offset] = compute_shifted_operand(shift_result);
-
-    return offset;
+    return shifted_register(cpu, instruction).value;
   };
   const auto dest = rd(instruction);
 
@@ -564,7 +554,7 @@ u32 make_single_data_transfer(Cpu& cpu, u32 instruction) {
     if constexpr (word_transfer) {
       // load a word
       const u32 loaded_value =
-          rotate_right(mmu.at<u32>(aligned_addr & ~0b11), rotate_amount);
+          rotr(mmu.at<u32>(aligned_addr & ~0b11), rotate_amount);
       cpu.set_reg(dest, loaded_value);
     } else {
       // load a byte
@@ -597,7 +587,9 @@ u32 make_single_data_transfer(Cpu& cpu, u32 instruction) {
                                  : (1_seq + 1_nonseq + 1_intern);
   }();
 
-  return mmu.wait_cycles(aligned_addr, cycles);
+  return mmu.wait_cycles(
+      aligned_addr, cycles,
+      word_transfer ? AccessWidth::Word : AccessWidth::Byte);
 }
 
 template <bool immediate_operand, bool use_spsr_dest, bool to_status>
@@ -698,7 +690,7 @@ u32 make_block_data_transfer(Cpu& cpu, u32 instruction) {
       offset = change_offset(offset);
     }
 
-    addr_cycles += cpu.mmu()->wait_cycles(offset, 1_seq);
+    addr_cycles += cpu.mmu()->wait_cycles(offset, 1_seq, AccessWidth::Word);
     if (load_register) {
       cpu.set_reg(reg, cpu.mmu()->at<u32>(offset));
     } else {
@@ -906,13 +898,421 @@ static constexpr std::array<InstFunc, 4096> arm_lookup_table = [] {
   return res;
 }();
 
-u32 Cpu::execute() {
-#if 1
-  if (/*interrupts_waiting.data() > 0 ||*/ halted) {
+static constexpr u32 MaxBlockSize = 32;
+
+static u32 thumb_conditional_branch(Cpu& cpu, u16 instruction) {
+  const u32 condition = (instruction >> 8) & 0b1111;
+  if (should_execute(condition << 28, cpu.program_status())) {
+    return thumb::conditional_branch(cpu, instruction);
+  }
+  return 0;
+}
+
+[[nodiscard]] static ThumbInstFunc decode_thumb(u16 instruction) {
+  if (const u32 condition = (instruction >> 8) & 0b1111;
+      (instruction & 0b1101'0000'0000'0000) == 0b1101'0000'0000'0000 &&
+      ((instruction >> 12) != 0b1111) && condition != 0b1111) {
+    return thumb_conditional_branch;
+  }
+  return thumb_instruction_tables.interpreter_table[(instruction >> 6) & 0x3ff];
+}
+
+[[nodiscard]] static InstFunc decode_arm(u32 instruction) {
+  return arm_lookup_table[(((instruction >> 20) & 0xff) << 4) |
+                          ((instruction >> 4) & 0b1111)];
+}
+
+// Instructions that may write R15 or switch state. Anything missed here is
+// still caught at runtime by checking R15 after each instruction.
+[[nodiscard]] static constexpr bool ends_block(u16 instruction) {
+  // Conditional branch, SWI
+  if ((instruction & 0xf000) == 0xd000) {
+    return true;
+  }
+  // Unconditional branch, second half of BL
+  if ((instruction & 0xf800) == 0xe000 || (instruction & 0xf800) == 0xf800) {
+    return true;
+  }
+  // POP {..., pc}
+  if ((instruction & 0xff00) == 0xbd00) {
+    return true;
+  }
+  // Hi register operations and BX
+  if ((instruction & 0xfc00) == 0x4400) {
+    const u32 op = (instruction >> 8) & 0b11;
+    const u32 rd = (instruction & 0b111) | ((instruction >> 4) & 0b1000);
+    return op == 0b11 || (op != 0b01 && rd == 15);
+  }
+  return false;
+}
+
+[[nodiscard]] static constexpr bool ends_block(u32 instruction) {
+  // B, BL, SWI
+  if ((instruction & 0x0e000000) == 0x0a000000 ||
+      (instruction & 0x0f000000) == 0x0f000000) {
+    return true;
+  }
+  // BX
+  if ((instruction & 0x0ffffff0) == 0x012fff10) {
+    return true;
+  }
+  // LDM with R15 in the register list
+  if ((instruction & 0x0e100000) == 0x08100000) {
+    return test_bit(instruction, 15);
+  }
+  // Data processing, MSR, and loads with Rd = R15
+  return (instruction & 0x08000000) == 0 && ((instruction >> 12) & 0xf) == 15;
+}
+
+[[nodiscard]] static constexpr bool is_cacheable(u32 addr) {
+  switch (addr >> 24) {
+    case 0x00:
+    case 0x02:
+    case 0x03:
+    case 0x08:
+    case 0x09:
+    case 0x0a:
+    case 0x0b:
+    case 0x0c:
+      return true;
+    default:
+      return false;
+  }
+}
+
+template <typename BlockType>
+static BlockType decode_block(nonstd::span<const u8> storage, u32 offset) {
+  using OpcodeType = typename BlockType::OpcodeType;
+  BlockType block;
+  const auto storage_size = static_cast<u32>(storage.size());
+  for (u32 i = offset; i + sizeof(OpcodeType) <= storage_size &&
+                       block.instructions.size() < MaxBlockSize;
+       i += sizeof(OpcodeType)) {
+    OpcodeType instruction;
+    std::memcpy(&instruction, &storage[i], sizeof(OpcodeType));
+    if constexpr (std::is_same_v<OpcodeType, u16>) {
+      block.instructions.push_back({decode_thumb(instruction), instruction});
+    } else {
+      block.instructions.push_back({decode_arm(instruction), instruction});
+    }
+    if (ends_block(instruction)) {
+      break;
+    }
+  }
+  return block;
+}
+
+void Cpu::mark_code_pages(u32 pc, u32 size_bytes) {
+  const u32 first_page = BlockCache::code_page(pc);
+  if (first_page == BlockCache::NoCodePage || size_bytes == 0) {
+    return;
+  }
+  const u32 last_page = BlockCache::code_page(pc + size_bytes - 1);
+  for (u32 page = first_page;
+       page <= last_page && page < BlockCache::CodePageCount; ++page) {
+    m_mmu->mark_code_page(page);
+  }
+}
+
+template <typename BlockType>
+BlockType& Cpu::insert_block(u32 pc, BlockType block) {
+  constexpr bool thumb = std::is_same_v<BlockType, ThumbBlock>;
+  const auto size = static_cast<u32>(block.instructions.size());
+  mark_code_pages(pc, size * sizeof(typename BlockType::OpcodeType));
+
+  if (m_idle_loop_detection && is_idle_loop(block, pc)) {
+    block.idle_loop = true;
+    if (std::none_of(m_idle_loops.begin(), m_idle_loops.end(),
+                     [pc](IdleLoop loop) {
+                       return loop.pc == pc && loop.thumb == thumb;
+                     })) {
+      m_idle_loops.push_back({pc, thumb, size});
+    }
+  }
+  return m_block_cache.insert(pc, std::move(block));
+}
+
+ArmBlock& Cpu::compile_arm_block(u32 pc) {
+  const auto [storage, offset] = m_mmu->select_storage(pc);
+  return insert_block(pc, decode_block<ArmBlock>(storage, offset));
+}
+
+ThumbBlock& Cpu::compile_thumb_block(u32 pc) {
+  const auto [storage, offset] = m_mmu->select_storage(pc);
+  return insert_block(pc, decode_block<ThumbBlock>(storage, offset));
+}
+
+template <typename BlockType>
+u32 Cpu::run_block(const BlockType& block, u32 pc, int cycle_budget) {
+  constexpr bool thumb = std::is_same_v<BlockType, ThumbBlock>;
+  const u32 generation = m_block_cache.generation();
+  u32 cycles = 0;
+  for (const auto& [handler, opcode] : block.instructions) {
+    pc += sizeof(opcode);
+    m_regs[15] = pc;
+    if constexpr (thumb) {
+      cycles += handler(*this, opcode);
+    } else if (condition_passed(opcode)) {
+      cycles += handler(*this, opcode);
+    }
+    // The handler may have overwritten this block, so it can't be touched
+    // after the generation changes
+    if (m_regs[15] != pc || block_interrupted(generation, thumb) ||
+        static_cast<int>(cycles) >= cycle_budget) {
+      break;
+    }
+  }
+  return cycles;
+}
+
+template <typename BlockType>
+u32 Cpu::run_cached_block(BlockType& block, u32 pc, int cycle_budget) {
+  if (block.instructions.empty()) {
+    return execute_instruction();
+  }
+
+  // The block may be gone once it has run
+  const bool idle_loop = block.idle_loop;
+  const u32 volatile_reads = m_mmu->volatile_reads();
+  const u32 cycles = run_compiled_or_interpreted(block, pc, cycle_budget);
+  // Loops polling a timer counter aren't waiting for an event
+  m_idle = idle_loop && m_regs[15] == pc &&
+           m_mmu->volatile_reads() == volatile_reads;
+  return cycles;
+}
+
+template <typename BlockType>
+u32 Cpu::run_compiled_or_interpreted(BlockType& block,
+                                     u32 pc,
+                                     int cycle_budget) {
+  if (m_jit) {
+    if (block.compiled == nullptr && ++block.run_count == Jit::HotThreshold) {
+      block.compiled = m_jit->compile(block, pc);
+      if (block.compiled == nullptr) {
+        // Out of space for host code, start over
+        m_block_cache.clear();
+        m_jit->reset();
+        return execute_instruction();
+      }
+    }
+    if (block.compiled != nullptr) {
+      if (m_jit_verification) {
+        return run_verified(block, pc, cycle_budget);
+      }
+      return block.compiled(*this, m_regs.data(), cycle_budget,
+                            m_block_cache.generation());
+    }
+  }
+
+  return run_block(block, pc, cycle_budget);
+}
+
+template <typename BlockType>
+u32 Cpu::run_verified(const BlockType& block, u32 pc, int cycle_budget) {
+  const u32 generation = m_block_cache.generation();
+  const State before = save_state();
+  const u32 compiled_cycles =
+      block.compiled(*this, m_regs.data(), cycle_budget, generation);
+  if (m_block_cache.generation() != generation) {
+    // The block may be gone, so it can't be run again
+    return compiled_cycles;
+  }
+
+  const State compiled = save_state();
+  restore_state(before);
+  const u32 cycles = run_block(block, pc, cycle_budget);
+  const State interpreted = save_state();
+
+  const auto mismatch = [&]() -> std::string {
+    if (cycles != compiled_cycles) {
+      return fmt::format("cycles {} != {}", compiled_cycles, cycles);
+    }
+    for (u32 reg = 0; reg < 16; ++reg) {
+      if (compiled.regs[reg] != interpreted.regs[reg]) {
+        return fmt::format("r{} {:08x} != {:08x}", reg, compiled.regs[reg],
+                           interpreted.regs[reg]);
+      }
+    }
+    if (compiled.program_status != interpreted.program_status) {
+      return fmt::format("cpsr {:08x} != {:08x}", compiled.program_status,
+                         interpreted.program_status);
+    }
+    if (compiled.saved_program_status != interpreted.saved_program_status ||
+        compiled.banked_r8_r12 != interpreted.banked_r8_r12 ||
+        compiled.banked_r13_r14 != interpreted.banked_r13_r14 ||
+        compiled.halted != interpreted.halted ||
+        compiled.stalled_cycles != interpreted.stalled_cycles) {
+      return "banked state";
+    }
+    if (compiled.memory != interpreted.memory) {
+      return "memory";
+    }
+    return {};
+  }();
+  if (!mismatch.empty()) {
+    throw std::runtime_error(fmt::format(
+        "compiled block at {:08x} differs from the interpreter: {}", pc,
+        mismatch));
+  }
+  return cycles;
+}
+
+Cpu::State Cpu::save_state() const {
+  State state;
+  state.regs = m_regs;
+  state.program_status = program_status().data();
+  for (u32 bank = 0; bank < RegisterBankCount; ++bank) {
+    state.saved_program_status[bank] = m_saved_program_status[bank].data();
+  }
+  state.banked_r8_r12 = m_banked_r8_r12;
+  state.banked_r13_r14 = m_banked_r13_r14;
+  state.halted = halted;
+  state.stalled_cycles = m_stalled_cycles;
+  for (const auto memory : {m_mmu->ewram(), m_mmu->iwram(), m_mmu->vram(),
+                            m_mmu->palette_ram(), m_mmu->oam_ram()}) {
+    state.memory.insert(state.memory.end(), memory.begin(), memory.end());
+  }
+  return state;
+}
+
+void Cpu::restore_state(const State& state) {
+  m_regs = state.regs;
+  m_current_program_status = ProgramStatus{state.program_status};
+  m_pending_flags.op = FlagOp::None;
+  for (u32 bank = 0; bank < RegisterBankCount; ++bank) {
+    m_saved_program_status[bank] =
+        ProgramStatus{state.saved_program_status[bank]};
+  }
+  m_banked_r8_r12 = state.banked_r8_r12;
+  m_banked_r13_r14 = state.banked_r13_r14;
+  halted = state.halted;
+  m_stalled_cycles = state.stalled_cycles;
+  auto saved = state.memory.begin();
+  for (const auto memory : {m_mmu->ewram(), m_mmu->iwram(), m_mmu->vram(),
+                            m_mmu->palette_ram(), m_mmu->oam_ram()}) {
+    std::copy_n(saved, memory.size(), memory.begin());
+    saved += memory.ssize();
+  }
+}
+
+u32 Cpu::run_thumb_block(int cycle_budget) {
+  const u32 pc = m_regs[15];
+  ThumbBlock* block = m_block_cache.find_thumb(pc);
+  if (block == nullptr) {
+    block = &compile_thumb_block(pc);
+  }
+  return run_cached_block(*block, pc, cycle_budget);
+}
+
+u32 Cpu::run_arm_block(int cycle_budget) {
+  const u32 pc = m_regs[15];
+  ArmBlock* block = m_block_cache.find_arm(pc);
+  if (block == nullptr) {
+    block = &compile_arm_block(pc);
+  }
+  return run_cached_block(*block, pc, cycle_budget);
+}
+
+#if GBEMU_THREADED_DISPATCH
+// Runs blocks back to back until the budget is used up, the CPU halts or it
+// lands in an idle loop. Each block is charged to the scheduler as soon as it
+// ends, and like the block loop in execute_hardware, the run stops once a
+// block moves the next event earlier or stalls the CPU. Each stage jumps
+// straight to the next one through a label table on GCC and Clang, so every
+// jump site gets its own prediction. Other compilers go through a switch.
+u32 Cpu::run_threaded(int cycle_budget) {
+  enum Stage : u8 { Thumb, Arm, Uncached, Exit };
+
+  u32 cycles = 0;
+  const auto remaining = [&] {
+    return cycle_budget - static_cast<int>(cycles);
+  };
+  const auto charge = [&](u32 block_cycles) {
+    cycles += block_cycles;
+    m_scheduler.advance(block_cycles);
+  };
+  const auto stage_for_pc = [this] {
+    if (!is_cacheable(m_regs[15])) {
+      return Uncached;
+    }
+    return m_current_program_status.thumb_mode() ? Thumb : Arm;
+  };
+  const auto next_stage = [&] {
+    if (remaining() <= 0 || halted || m_idle || m_stalled_cycles != 0 ||
+        m_scheduler.cycles_until_next_event() < remaining()) {
+      return Exit;
+    }
+    return stage_for_pc();
+  };
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+  static const void* const stages[] = {&&thumb_stage, &&arm_stage,
+                                       &&uncached_stage, &&exit_stage};
+#define GB_STAGE(stage, label) label:
+#define GB_DISPATCH(stage) goto* stages[stage]
+  GB_DISPATCH(stage_for_pc());
+#else
+  Stage current_stage = stage_for_pc();
+#define GB_STAGE(stage, label) case stage:
+#define GB_DISPATCH(stage) \
+  current_stage = stage;   \
+  goto dispatch
+dispatch:
+  switch (current_stage) {
+#endif
+  GB_STAGE(Thumb, thumb_stage)
+    charge(run_thumb_block(remaining()));
+    GB_DISPATCH(next_stage());
+  GB_STAGE(Arm, arm_stage)
+    charge(run_arm_block(remaining()));
+    GB_DISPATCH(next_stage());
+  GB_STAGE(Uncached, uncached_stage)
+    charge(execute_instruction());
+    GB_DISPATCH(next_stage());
+  GB_STAGE(Exit, exit_stage)
+    return cycles;
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#else
+  }
+  GB_UNREACHABLE();
+#endif
+#undef GB_STAGE
+#undef GB_DISPATCH
+}
+#endif
+
+u32 Cpu::execute(int cycle_budget) {
+  m_idle = false;
+  if (halted) {
+    m_scheduler.advance(1);
     return 1;
   }
+
+#if GBEMU_THREADED_DISPATCH
+  if (m_threaded_dispatch) {
+    return run_threaded(cycle_budget);
+  }
 #endif
 
+  const u32 cycles = run_next_block(cycle_budget);
+  m_scheduler.advance(cycles);
+  return cycles;
+}
+
+u32 Cpu::run_next_block(int cycle_budget) {
+  if (!is_cacheable(m_regs[15])) {
+    return execute_instruction();
+  }
+  if (m_current_program_status.thumb_mode()) {
+    return run_thumb_block(cycle_budget);
+  }
+  return run_arm_block(cycle_budget);
+}
+
+u32 Cpu::execute_instruction() {
   if (const u32 pc_region = m_regs[15] & 0xff000000;
       m_current_memory_region != pc_region) {
     const auto [storage, _] = m_mmu->select_storage(reg(Register::R15));
@@ -930,17 +1330,7 @@ u32 Cpu::execute() {
                 sizeof(u16));
     m_regs[15] = pc + 2;
 
-    if (const u32 condition = (instruction >> 8) & 0b1111;
-        (instruction & 0b1101'0000'0000'0000) == 0b1101'0000'0000'0000 &&
-        ((instruction >> 12) != 0b1111) && condition != 0b1111) {
-      if (should_execute(condition << 28, m_current_program_status)) {
-        return thumb::conditional_branch(*this, instruction);
-      }
-      return 0;
-    }
-    const auto inst_func =
-        thumb_instruction_tables.interpreter_table[(instruction >> 6) & 0x3ff];
-    return inst_func(*this, instruction);
+    return decode_thumb(instruction)(*this, instruction);
   }
 
   const u32 pc = (m_regs[15] & ~0b11);
@@ -949,14 +1339,306 @@ u32 Cpu::execute() {
   std::memcpy(&arm_instruction, &m_current_memory[pc - m_memory_offset],
               sizeof(u32));
   m_regs[15] = pc + 4;
-  const auto inst_func =
-      arm_lookup_table[(((arm_instruction >> 20) & 0xff) << 4) |
-                       ((arm_instruction >> 4) & 0b1111)];
-
-  if (should_execute(arm_instruction, m_current_program_status)) {
-    return inst_func(*this, arm_instruction);
+  if (condition_passed(arm_instruction)) {
+    return decode_arm(arm_instruction)(*this, arm_instruction);
   }
   return 0;
 }
 
+TEST_CASE("writes to cached code should invalidate the block") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  cpu.set_thumb(true);
+
+  // mov r0, #1
+  mmu.set<u16>(0x03000000, 0x2001);
+  // b .
+  mmu.set<u16>(0x03000002, 0xe7fe);
+
+  cpu.set_reg(Register::R15, 0x03000000);
+  (void)cpu.execute();
+  CHECK(cpu.reg(Register::R0) == 1);
+
+  // mov r0, #2
+  mmu.set<u16>(0x03000000, 0x2002);
+
+  cpu.set_reg(Register::R15, 0x03000000);
+  (void)cpu.execute();
+  CHECK(cpu.reg(Register::R0) == 2);
+}
+
+TEST_CASE("threaded dispatch should match the block loop") {
+  for (const bool threaded : {false, true}) {
+    Mmu mmu;
+    Cpu cpu{mmu};
+    mmu.hardware.cpu = &cpu;
+    cpu.set_threaded_dispatch(threaded);
+    cpu.set_thumb(true);
+
+    // mov r1, #10; loop: add r0, #3; sub r1, #1; bne loop; b .
+    u32 addr = 0x03000000;
+    for (const u16 opcode : {0x210a, 0x3003, 0x3901, 0xd1fc, 0xe7fe}) {
+      mmu.set<u16>(addr, opcode);
+      addr += sizeof(u16);
+    }
+    cpu.set_reg(Register::R15, 0x03000000);
+
+    u32 cycles = 0;
+    while (cycles < 500) {
+      cycles += cpu.execute(500 - static_cast<int>(cycles));
+    }
+    CHECK(cpu.reg(Register::R0) == 30);
+    CHECK(cpu.reg(Register::R1) == 0);
+  }
+}
+
+TEST_CASE("an IRQ unmasked by an IE write should be taken after the block") {
+  for (const bool threaded : {false, true}) {
+    Mmu mmu;
+    Cpu cpu{mmu};
+    mmu.hardware.cpu = &cpu;
+    cpu.set_threaded_dispatch(threaded);
+    cpu.set_thumb(true);
+    cpu.ime = 1;
+    cpu.interrupts_requested.set_interrupt(Interrupt::VBlank, true);
+
+    // strh r0, [r1]; loop: add r2, #1; b loop
+    u32 addr = 0x03000000;
+    for (const u16 opcode : {0x8008, 0x3201, 0xe7fd}) {
+      mmu.set<u16>(addr, opcode);
+      addr += sizeof(u16);
+    }
+    cpu.set_reg(Register::R0, 1U << static_cast<u32>(Interrupt::VBlank));
+    cpu.set_reg(Register::R1, hardware::IE);
+    cpu.set_reg(Register::R15, 0x03000000);
+
+    const u64 start = cpu.scheduler().now();
+    const u32 cycles = cpu.execute(100000);
+    // The rest of the block still runs, but nothing after it
+    CHECK(cpu.reg(Register::R2) == 1);
+    CHECK(cpu.scheduler().now() - start == cycles);
+    CHECK(cpu.scheduler().cycles_until_next_event() == 0);
+
+    cpu.scheduler().run_due_events();
+    CHECK(cpu.program_status().mode() == Mode::IRQ);
+    // The handler returns to the loop with subs pc, lr, #4
+    CHECK(cpu.reg(Register::R14) - 4 == 0x03000002);
+  }
+}
+
+TEST_CASE("mode changes should swap banked registers") {
+  Cpu cpu;
+  for (u32 i = 8; i < 15; ++i) {
+    cpu.set_reg(static_cast<Register>(i), i);
+  }
+
+  cpu.change_mode(Mode::FIQ);
+  for (u32 i = 8; i < 15; ++i) {
+    cpu.set_reg(static_cast<Register>(i), 0x100 + i);
+  }
+  cpu.change_mode(Mode::IRQ);
+  CHECK(cpu.reg(Register::R8) == 8);
+  CHECK(cpu.reg(Register::R12) == 12);
+  cpu.set_reg(Register::R13, 0x213);
+  cpu.set_reg(Register::R14, 0x214);
+
+  cpu.change_mode(Mode::User);
+  for (u32 i = 8; i < 15; ++i) {
+    CHECK(cpu.reg(static_cast<Register>(i)) == i);
+  }
+  cpu.change_mode(Mode::FIQ);
+  for (u32 i = 8; i < 15; ++i) {
+    CHECK(cpu.reg(static_cast<Register>(i)) == 0x100 + i);
+  }
+  cpu.change_mode(Mode::IRQ);
+  CHECK(cpu.reg(Register::R13) == 0x213);
+  CHECK(cpu.reg(Register::R14) == 0x214);
+  cpu.change_mode(Mode::Supervisor);
+  CHECK(cpu.reg(Register::R13) == 0x03007FE0);
+}
+
+// Shifts one bit at a time the way the ARM7TDMI manual describes it
+static ShifterOutput reference_shift(ShiftType type,
+                                     u32 value,
+                                     u32 amount,
+                                     bool carry) {
+  for (u32 i = 0; i < amount; ++i) {
+    switch (type) {
+      case ShiftType::LogicalLeft:
+        carry = test_bit(value, 31);
+        value <<= 1;
+        break;
+      case ShiftType::LogicalRight:
+        carry = test_bit(value, 0);
+        value >>= 1;
+        break;
+      case ShiftType::ArithmeticRight:
+        carry = test_bit(value, 0);
+        value = (value >> 1) | (value & 0x80000000);
+        break;
+      case ShiftType::RotateRight:
+        carry = test_bit(value, 0);
+        value = (value >> 1) | (static_cast<u32>(carry) << 31);
+        break;
+    }
+  }
+  return {value, carry};
+}
+
+TEST_CASE("the shifter should match a bit by bit barrel shifter") {
+  constexpr std::array<u32, 8> values = {
+      0, 1, 0x80000000, 0xffffffff, 0x7fffffff, 0x12345678, 0x80000001,
+      0xa5a5a5a5};
+  for (const u32 type_index : {0, 1, 2, 3}) {
+    const auto type = static_cast<ShiftType>(type_index);
+    for (const u32 value : values) {
+      for (const bool carry : {false, true}) {
+        for (u32 amount = 0; amount < 256; ++amount) {
+          const auto expected = reference_shift(type, value, amount, carry);
+          const auto actual = shift_by_register(type, value, amount, carry);
+          CHECK(actual.value == expected.value);
+          CHECK(actual.carry == expected.carry);
+        }
+
+        for (u32 amount = 0; amount < 32; ++amount) {
+          const auto actual = shift_by_immediate(type, value, amount, carry);
+          const auto expected = [&] {
+            if (amount != 0 || type == ShiftType::LogicalLeft) {
+              return reference_shift(type, value, amount, carry);
+            }
+            if (type == ShiftType::RotateRight) {
+              // RRX
+              return ShifterOutput{(static_cast<u32>(carry) << 31) |
+                                       (value >> 1),
+                                   test_bit(value, 0)};
+            }
+            return reference_shift(type, value, 32, carry);
+          }();
+          CHECK(actual.value == expected.value);
+          CHECK(actual.carry == expected.carry);
+        }
+      }
+    }
+  }
+
+  for (u32 value = 0; value < 0x10000; value += 0x101) {
+    CHECK(static_cast<std::size_t>(popcount(value)) ==
+          std::bitset<32>{value}.count());
+    if (value != 0) {
+      CHECK(test_bit(value, count_trailing_zeros(value)));
+      CHECK((value & ((1U << count_trailing_zeros(value)) - 1)) == 0);
+    }
+  }
+}
+
+TEST_CASE("SBC and RSC should take C and V from the borrow") {
+  constexpr std::array<u32, 6> values = {0,          1,          0x7fffffff,
+                                         0x80000000, 0xfffffffe, 0xffffffff};
+  for (const bool lazy_flags : {false, true}) {
+    for (const u32 lhs : values) {
+      for (const u32 rhs : values) {
+        for (const bool carry : {false, true}) {
+          const u32 result = lhs - rhs - (carry ? 0 : 1);
+          const bool expected_carry =
+              static_cast<u64>(lhs) >= static_cast<u64>(rhs) + (carry ? 0 : 1);
+          const bool expected_overflow =
+              test_bit((lhs ^ rhs) & (lhs ^ result), 31);
+
+          Cpu sbc;
+          Cpu rsc;
+          sbc.set_lazy_flags(lazy_flags);
+          rsc.set_lazy_flags(lazy_flags);
+          sbc.set_carry(carry);
+          rsc.set_carry(carry);
+          common::data_processing<Opcode::Sbc, true>(sbc, Register::R0, lhs,
+                                                     rhs, false);
+          common::data_processing<Opcode::Rsc, true>(rsc, Register::R0, rhs,
+                                                     lhs, false);
+
+          for (Cpu* cpu : {&sbc, &rsc}) {
+            CAPTURE(lhs);
+            CAPTURE(rhs);
+            CAPTURE(carry);
+            CHECK(cpu->reg(Register::R0) == result);
+            // ADC consumes C before anything resolves the flags
+            common::data_processing<Opcode::Adc, false>(*cpu, Register::R1, 0,
+                                                        0, false);
+            CHECK(cpu->reg(Register::R1) == (expected_carry ? 1 : 0));
+            CHECK(cpu->program_status().carry() == expected_carry);
+            CHECK(cpu->program_status().overflow() == expected_overflow);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("flag-setting multiplies should only change N and Z") {
+  constexpr std::array<std::pair<u32, u32>, 5> operands = {{
+      {0, 5},
+      {3, 5},
+      {0x10000, 0x10000},
+      {3, 0x80000000},
+      {0xffffffff, 0xffffffff},
+  }};
+  for (const bool lazy_flags : {false, true}) {
+    for (const auto [lhs, rhs] : operands) {
+      for (const bool carry : {false, true}) {
+        CAPTURE(lhs);
+        CAPTURE(rhs);
+        CAPTURE(carry);
+        const u32 result = lhs * rhs;
+        const u64 long_result = static_cast<u64>(lhs) * rhs;
+
+        Cpu mul;
+        Cpu umull;
+        for (Cpu* cpu : {&mul, &umull}) {
+          cpu->set_lazy_flags(lazy_flags);
+          cpu->set_carry(carry);
+          cpu->set_overflow(true);
+          cpu->set_reg(Register::R2, lhs);
+          cpu->set_reg(Register::R3, rhs);
+        }
+        common::multiply(mul, Register::R0, Register::R2, Register::R3, true);
+        // umulls r0, r1, r2, r3
+        (void)arm::make_multiply_long<false, false, true>(umull, 0xe0910392);
+
+        CHECK(mul.program_status().zero() == (result == 0));
+        CHECK(mul.program_status().negative() == test_bit(result, 31));
+        CHECK(umull.program_status().zero() == (long_result == 0));
+        CHECK(umull.program_status().negative() == test_bit(long_result, 63));
+        for (Cpu* cpu : {&mul, &umull}) {
+          CHECK(cpu->program_status().carry() == carry);
+          CHECK(cpu->program_status().overflow());
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("lazy flags should match eager flags") {
+  for_static<16>([](auto opcode_index) {
+    constexpr auto opcode = static_cast<Opcode>(opcode_index.value);
+    constexpr std::array<u32, 6> values = {
+        0, 1, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff};
+    for (const u32 lhs : values) {
+      for (const u32 rhs : values) {
+        for (const bool carry : {false, true}) {
+          Cpu eager;
+          Cpu lazy;
+          eager.set_lazy_flags(false);
+          for (Cpu* cpu : {&eager, &lazy}) {
+            cpu->set_carry(carry);
+            common::data_processing<opcode, true>(*cpu, Register::R0, lhs, rhs,
+                                                  !carry);
+          }
+          CHECK(eager.program_status().data() == lazy.program_status().data());
+          CHECK(eager.reg(Register::R0) == lazy.reg(Register::R0));
+        }
+      }
+    }
+  });
+}
+
 }  // namespace gb::advance
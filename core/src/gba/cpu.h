@@ -1,9 +1,17 @@
 #pragma once
 #include <doctest/doctest.h>
+#include <algorithm>
 #include <array>
 #include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include <nonstd/span.hpp>
 #include "error_handling.h"
+#include "gba/block_cache.h"
+#include "gba/jit.h"
+#include "gba/scheduler.h"
 #include "interrupts.h"
 #include "mmu.h"
 #include "types.h"
@@ -91,6 +99,30 @@ class ProgramStatus : public Integer<u32> {
   constexpr void set_irq_enabled(bool set) { set_bit(7, !set); }
 };
 
+// The ALU operation whose NZCV flags haven't been written to the CPSR yet
+enum class FlagOp : u8 {
+  None,
+  Logical,
+  Add,
+  Sub,
+  // A 64 bit multiply result, split across op1 (low) and result (high)
+  Long,
+};
+
+struct LazyFlags {
+  FlagOp op = FlagOp::None;
+  bool carry = false;
+  u32 op1 = 0;
+  u32 op2 = 0;
+  u32 result = 0;
+};
+
+struct IdleLoop {
+  u32 pc;
+  bool thumb;
+  u32 instruction_count;
+};
+
 enum class Condition : u32 {
   EQ = 0b0000,  // Z set
   NE = 0b0001,  // Z clear
@@ -109,10 +141,16 @@ enum class Condition : u32 {
   AL = 0b1110,  // ignored
 };
 
+[[nodiscard]] bool should_execute(u32 instruction,
+                                  ProgramStatus program_status);
+
 class Cpu {
  public:
   Cpu() = default;
-  Cpu(Mmu& mmu) : m_mmu{&mmu} {}
+  Cpu(Mmu& mmu) : m_mmu{&mmu} {
+    m_scheduler.set_handler(EventType::Irq,
+                            [this](u32) { handle_interrupts(); });
+  }
 
   [[nodiscard]] constexpr u32 prefetch_offset() const {
     return m_current_program_status.thumb_mode() ? 2 : 4;
@@ -123,7 +161,7 @@ class Cpu {
     assert(index < m_regs.size());
 
     if (reg_selected == Register::R15) {
-      const bool thumb_mode = program_status().thumb_mode();
+      const bool thumb_mode = m_current_program_status.thumb_mode();
       return (m_regs[index] + prefetch_offset()) & ~(thumb_mode ? 0b1 : 0b11);
     }
     return m_regs[index];
@@ -132,82 +170,69 @@ class Cpu {
   constexpr void set_reg(Register reg_selected, u32 value) {
     const u32 index = static_cast<u32>(reg_selected);
     if (reg_selected == Register::R15) {
-      value &= ~(program_status().thumb_mode() ? 0b1 : 0b11);
+      value &= ~(m_current_program_status.thumb_mode() ? 0b1 : 0b11);
     }
     m_regs[index] = value;
   }
 
   [[nodiscard]] constexpr const ProgramStatus& program_status() const {
+    resolve_flags();
     return m_current_program_status;
   }
 
-  constexpr void load_register_range(nonstd::span<const u32> src,
-                                     u32 reg_begin,
-                                     u32 reg_end) {
-    for (u32 i = reg_begin; i <= reg_end; ++i) {
-      const auto dest_reg = static_cast<Register>(i);
-      set_reg(dest_reg, src[i - reg_begin]);
-    }
+  // Checks the condition field, only computing flags when it isn't AL
+  [[nodiscard]] bool condition_passed(u32 instruction) const {
+    return (instruction >> 28) == static_cast<u32>(Condition::AL) ||
+           should_execute(instruction, program_status());
   }
 
-  constexpr void store_register_range(nonstd::span<u32> dest,
-                                      u32 reg_begin,
-                                      u32 reg_end) {
-    for (u32 i = reg_begin; i <= reg_end; ++i) {
-      const auto src_reg = static_cast<Register>(i);
-      dest[i - reg_begin] = reg(src_reg);
-    }
+  // With lazy flags, ALU instructions record their operands and the flags
+  // are only computed when something reads the CPSR.
+  constexpr void set_lazy_flags(bool enabled) {
+    resolve_flags();
+    m_lazy_flags_enabled = enabled;
   }
 
-  void change_mode(Mode next_mode) {
-    const Mode current_mode = m_current_program_status.mode();
-    const auto select_mode_storage = [this](Mode mode_) -> nonstd::span<u32> {
-      switch (mode_) {
-        case Mode::FIQ:
-          return m_saved_registers.fiq;
-        case Mode::Supervisor:
-          return m_saved_registers.supervisor;
-        case Mode::Abort:
-          return m_saved_registers.abort;
-        case Mode::IRQ:
-          return m_saved_registers.irq;
-        case Mode::Undefined:
-          return m_saved_registers.undefined;
-        case Mode::System:
-        case Mode::User:
-          return m_saved_registers.system_and_user;
-        default:
-          throw std::runtime_error("invalid mode");
-      }
-    };
-
-    // Find range of registers to store
-    const auto select_mode_range = [](Mode mode) -> std::pair<u32, u32> {
-      switch (mode) {
-        case Mode::FIQ:
-          return {8, 14};
-        case Mode::Supervisor:
-        case Mode::Abort:
-        case Mode::IRQ:
-        case Mode::Undefined:
-          return {13, 14};
-        default:
-          // User & system have no banked registers.
-          // Determine which registers are stored from the other modes.
-          return {1, 0};
-      }
-    };
-    const auto [reg_begin, reg_end] =
-        (next_mode == Mode::User || next_mode == Mode::System) &&
-                (current_mode != Mode::User && current_mode != Mode::System)
-            ? select_mode_range(current_mode)
-            : select_mode_range(next_mode);
+  [[nodiscard]] constexpr bool lazy_flags() const noexcept {
+    return m_lazy_flags_enabled;
+  }
 
-    auto current_saved_register_storage = select_mode_storage(current_mode);
-    auto next_saved_register_storage = select_mode_storage(next_mode);
+  constexpr void set_logical_flags(u32 result, bool carry) {
+    set_pending_flags({FlagOp::Logical, carry, 0, 0, result});
+  }
 
-    store_register_range(current_saved_register_storage, reg_begin, reg_end);
-    load_register_range(next_saved_register_storage, reg_begin, reg_end);
+  constexpr void set_add_flags(u32 op1, u32 op2, u32 result, bool carry) {
+    set_pending_flags({FlagOp::Add, carry, op1, op2, result});
+  }
+
+  constexpr void set_sub_flags(u32 op1, u32 op2, u32 result, bool carry) {
+    set_pending_flags({FlagOp::Sub, carry, op1, op2, result});
+  }
+
+  // Multiplies set N and Z only. C is unpredictable on ARMv4, so it's kept.
+  constexpr void set_multiply_flags(u32 result) {
+    set_logical_flags(result, carry() != 0);
+  }
+
+  constexpr void set_multiply_long_flags(u64 result) {
+    set_pending_flags({FlagOp::Long, carry() != 0, static_cast<u32>(result),
+                       0, static_cast<u32>(result >> 32)});
+  }
+
+  void change_mode(Mode next_mode) {
+    const u32 current_bank = bank_from_mode(m_current_program_status.mode());
+    const u32 next_bank = bank_from_mode(next_mode);
+    if (current_bank != next_bank) {
+      // R8-R12 are only banked in FIQ mode
+      if (current_bank == FiqBank || next_bank == FiqBank) {
+        std::copy_n(&m_regs[8], 5,
+                    m_banked_r8_r12[current_bank == FiqBank].data());
+        std::copy_n(m_banked_r8_r12[next_bank == FiqBank].data(), 5,
+                    &m_regs[8]);
+      }
+      std::copy_n(&m_regs[13], 2, m_banked_r13_r14[current_bank].data());
+      std::copy_n(m_banked_r13_r14[next_bank].data(), 2, &m_regs[13]);
+    }
 
     get_current_program_status().set_mode(next_mode);
   }
@@ -218,55 +243,59 @@ class Cpu {
     if (current_mode != next_mode) {
       change_mode(next_mode);
     }
+    m_pending_flags.op = FlagOp::None;
     m_current_program_status = status;
   }
 
-  [[nodiscard]] constexpr ProgramStatus saved_program_status() const {
-    const auto mode = m_current_program_status.mode();
-    if (mode == Mode::User || mode == Mode::System) {
-      return m_current_program_status;
+  [[nodiscard]] ProgramStatus saved_program_status() const {
+    const u32 bank = bank_from_mode(m_current_program_status.mode());
+    if (bank == UserBank) {
+      return program_status();
     }
-    return m_saved_program_status[index_from_mode(
-        m_current_program_status.mode())];
+    return m_saved_program_status[bank];
   }
 
-  constexpr void set_saved_program_status(ProgramStatus program_status) {
-    const auto mode = m_current_program_status.mode();
-    if (mode != Mode::User && mode != Mode::System) {
-      m_saved_program_status[index_from_mode(m_current_program_status.mode())] =
-          program_status;
+  void set_saved_program_status(ProgramStatus program_status) {
+    const u32 bank = bank_from_mode(m_current_program_status.mode());
+    if (bank != UserBank) {
+      m_saved_program_status[bank] = program_status;
     }
   }
 
-  constexpr void set_saved_program_status_for_mode(
-      Mode mode,
-      ProgramStatus program_status) {
-    m_saved_program_status[index_from_mode(mode)] = program_status;
+  void set_saved_program_status_for_mode(Mode mode,
+                                         ProgramStatus program_status) {
+    m_saved_program_status[bank_from_mode(mode)] = program_status;
   }
 
-  constexpr void move_spsr_to_cpsr() {
-    const Mode mode = m_current_program_status.mode();
-    if (mode != Mode::User && mode != Mode::System) {
-      ProgramStatus saved_program_status =
-          m_saved_program_status[static_cast<u32>(mode) - 1];
-      set_program_status(saved_program_status);
-    } else {
+  void move_spsr_to_cpsr() {
+    const u32 bank = bank_from_mode(m_current_program_status.mode());
+    if (bank == UserBank) {
       abort();
     }
+    set_program_status(m_saved_program_status[bank]);
   }
 
-  constexpr u32 carry() const { return program_status().carry() ? 1 : 0; }
+  constexpr u32 carry() const {
+    if (m_pending_flags.op != FlagOp::None) {
+      return m_pending_flags.carry ? 1 : 0;
+    }
+    return m_current_program_status.carry() ? 1 : 0;
+  }
 
   constexpr void set_carry(bool set) {
+    resolve_flags();
     get_current_program_status().set_carry(set);
   }
   constexpr void set_overflow(bool set) {
+    resolve_flags();
     get_current_program_status().set_overflow(set);
   }
   constexpr void set_negative(bool set) {
+    resolve_flags();
     get_current_program_status().set_negative(set);
   }
   constexpr void set_zero(bool set) {
+    resolve_flags();
     get_current_program_status().set_zero(set);
   }
   constexpr void set_thumb(bool set) {
@@ -279,9 +308,7 @@ class Cpu {
     for (u32 i = 0; i < 13; ++i) {
       set_reg(static_cast<Register>(i), 0);
     }
-    // R14 = 0
-    m_saved_registers.irq[1] = 0;
-    m_saved_registers.irq[0] = 0x03007fa0;
+    m_banked_r13_r14[IrqBank] = {0x03007fa0, 0};
 
     set_reg(Register::R13, 0x03007f00);
 
@@ -290,8 +317,9 @@ class Cpu {
     const u8 jump_flag = m_mmu->at<u8>(0x03007ffa);
 
     std::fill(iwram.begin() + 0x7e00, iwram.end(), 0);
+    m_block_cache.clear();
 
-    m_saved_program_status[index_from_mode(Mode::IRQ)] = ProgramStatus{0};
+    m_saved_program_status[IrqBank] = ProgramStatus{0};
 
     set_thumb(false);
 
@@ -319,49 +347,235 @@ class Cpu {
     return 0;
   }
 
-  [[nodiscard]] u32 execute();
+  // Runs at least one instruction. Code in BIOS, RAM and ROM is run from the
+  // block cache until the block ends or cycle_budget is used up. The cycles
+  // used are returned and already charged to the scheduler.
+  [[nodiscard]] u32 execute(int cycle_budget = 0);
   void handle_interrupts();
 
+  // Hot blocks are compiled to host code when the JIT is supported
+  void set_jit_enabled(bool enabled) {
+    m_block_cache.clear();
+    m_jit =
+        enabled && Jit::supported() ? std::make_unique<Jit>(m_mmu) : nullptr;
+  }
+
+  [[nodiscard]] bool jit_enabled() const noexcept { return m_jit != nullptr; }
+
+  // Runs every compiled block a second time on the interpreter and throws if
+  // the registers, RAM or cycles differ. IO accessed by those blocks is read
+  // and written twice, so this is only for tracking down JIT bugs.
+  void set_jit_verification(bool enabled) noexcept {
+    m_jit_verification = enabled;
+  }
+
+  // Runs the whole cycle budget inside execute() instead of returning after
+  // every block. Only has an effect when built with GBEMU_THREADED_DISPATCH.
+  void set_threaded_dispatch(bool enabled) noexcept {
+    m_threaded_dispatch = enabled;
+  }
+
+  [[nodiscard]] bool threaded_dispatch() const noexcept {
+    return m_threaded_dispatch;
+  }
+
+  // True if a block entered at the given cache generation has to stop early
+  [[nodiscard]] bool block_interrupted(u32 generation, bool thumb) const {
+    return halted || m_current_program_status.thumb_mode() != thumb ||
+           m_block_cache.generation() != generation;
+  }
+
+  // True right after an idle loop branched back to itself. Nothing changes
+  // until the next event, so the caller can skip ahead to it.
+  [[nodiscard]] bool idle() const noexcept { return m_idle; }
+
+  void set_idle_loop_detection(bool enabled) {
+    m_block_cache.clear();
+    m_idle_loop_detection = enabled;
+  }
+
+  // Every idle loop detected so far
+  [[nodiscard]] const std::vector<IdleLoop>& idle_loops() const noexcept {
+    return m_idle_loops;
+  }
+
+  // Called by the Mmu when a write lands on a page holding cached code.
+  void invalidate_blocks(u32 code_page) {
+    m_block_cache.invalidate_page(code_page);
+  }
+
   [[nodiscard]] nonstd::span<const u8> prefetched_opcode() const noexcept {
     return m_prefetched_opcode;
   }
 
   bool halted = false;
 
+  // Raises an interrupt, which is serviced once the current block ends
+  void request_interrupt(Interrupt interrupt) {
+    interrupts_requested.set_interrupt(interrupt, true);
+    check_interrupts();
+  }
+
+  // Services pending interrupts once the current block ends, since an event
+  // due now ends the CPU's run. Writes to IE and IME, and halting, go
+  // through here since they can unmask one.
+  void check_interrupts() { m_scheduler.schedule(EventType::Irq, 0); }
+
+  void halt() {
+    halted = true;
+    check_interrupts();
+  }
+
+  // The clock of the whole system, which the CPU drives
+  [[nodiscard]] Scheduler& scheduler() noexcept { return m_scheduler; }
+
+  // Cycles the CPU spends locked out of the bus, e.g. by DMA. They are
+  // charged to the timeline before the next instruction runs.
+  void stall(u32 cycles) noexcept { m_stalled_cycles += cycles; }
+  [[nodiscard]] u32 take_stalled_cycles() noexcept {
+    return std::exchange(m_stalled_cycles, 0);
+  }
+
   [[nodiscard]] Mmu* mmu() const noexcept { return m_mmu; }
 
  private:
-  struct SavedRegisters {
-    // R8-R14
-    std::array<u32, 7> system_and_user{{0, 0, 0, 0, 0, 0, 0}};
-    std::array<u32, 7> fiq{{0, 0, 0, 0, 0, 0, 0}};
-    // R13-R14
-    std::array<u32, 2> supervisor{{0x03007FE0, 0}};
-    std::array<u32, 2> abort{{0, 0}};
-    std::array<u32, 2> irq{{0, 0}};
-    std::array<u32, 2> undefined{{0, 0}};
+  // Index of each mode's banked registers. User and System share a bank.
+  enum RegisterBank : u32 {
+    UserBank,
+    FiqBank,
+    IrqBank,
+    SupervisorBank,
+    AbortBank,
+    UndefinedBank,
+    RegisterBankCount,
   };
 
+  static constexpr u32 InvalidBank = RegisterBankCount;
+
+  static constexpr std::array<u32, 16> mode_banks = [] {
+    std::array<u32, 16> banks{};
+    for (u32& bank : banks) {
+      bank = InvalidBank;
+    }
+    banks[static_cast<u32>(Mode::User)] = UserBank;
+    banks[static_cast<u32>(Mode::System)] = UserBank;
+    banks[static_cast<u32>(Mode::FIQ)] = FiqBank;
+    banks[static_cast<u32>(Mode::IRQ)] = IrqBank;
+    banks[static_cast<u32>(Mode::Supervisor)] = SupervisorBank;
+    banks[static_cast<u32>(Mode::Abort)] = AbortBank;
+    banks[static_cast<u32>(Mode::Undefined)] = UndefinedBank;
+    return banks;
+  }();
+
+  [[nodiscard]] static u32 bank_from_mode(Mode mode) {
+    const u32 bank = mode_banks[static_cast<u32>(mode) & 0b1111];
+    if (bank == InvalidBank) {
+      throw std::runtime_error("invalid mode");
+    }
+    return bank;
+  }
+
   constexpr ProgramStatus& get_current_program_status() {
     return m_current_program_status;
   }
 
-  [[nodiscard]] static constexpr u32 index_from_mode(Mode mode) {
-    return static_cast<u32>(mode) - 1;
+  constexpr void set_pending_flags(LazyFlags flags) {
+    m_pending_flags = flags;
+    if (!m_lazy_flags_enabled) {
+      resolve_flags();
+    }
   }
+
+  constexpr void resolve_flags() const {
+    const auto [op, carry, op1, op2, result] = m_pending_flags;
+    switch (op) {
+      case FlagOp::None:
+        return;
+      case FlagOp::Logical:
+        break;
+      case FlagOp::Add:
+        m_current_program_status.set_overflow(!test_bit(op1 ^ op2, 31) &&
+                                              test_bit(op2 ^ result, 31));
+        break;
+      case FlagOp::Sub:
+        m_current_program_status.set_overflow(test_bit(op1 ^ op2, 31) &&
+                                              test_bit(op1 ^ result, 31));
+        break;
+      case FlagOp::Long:
+        break;
+    }
+    m_current_program_status.set_negative(test_bit(result, 31));
+    m_current_program_status.set_zero(
+        result == 0 && (op != FlagOp::Long || op1 == 0));
+    m_current_program_status.set_carry(carry);
+    m_pending_flags.op = FlagOp::None;
+  }
+
+  [[nodiscard]] u32 execute_instruction();
+  ArmBlock& compile_arm_block(u32 pc);
+  ThumbBlock& compile_thumb_block(u32 pc);
+  void mark_code_pages(u32 pc, u32 size_bytes);
+  template <typename BlockType>
+  BlockType& insert_block(u32 pc, BlockType block);
+  template <typename BlockType>
+  u32 run_block(const BlockType& block, u32 pc, int cycle_budget);
+  template <typename BlockType>
+  u32 run_cached_block(BlockType& block, u32 pc, int cycle_budget);
+  template <typename BlockType>
+  u32 run_compiled_or_interpreted(BlockType& block, u32 pc, int cycle_budget);
+  template <typename BlockType>
+  u32 run_verified(const BlockType& block, u32 pc, int cycle_budget);
+
+  // What a block can change, for comparing compiled blocks to run_block
+  struct State {
+    std::array<u32, 16> regs;
+    u32 program_status;
+    std::array<u32, RegisterBankCount> saved_program_status;
+    std::array<std::array<u32, 5>, 2> banked_r8_r12;
+    std::array<std::array<u32, 2>, RegisterBankCount> banked_r13_r14;
+    bool halted;
+    u32 stalled_cycles;
+    std::vector<u8> memory;
+  };
+  [[nodiscard]] State save_state() const;
+  void restore_state(const State& state);
+  u32 run_thumb_block(int cycle_budget);
+  u32 run_arm_block(int cycle_budget);
+  u32 run_next_block(int cycle_budget);
+  u32 run_threaded(int cycle_budget);
+
   std::array<u32, 16> m_regs = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
   Mmu* m_mmu = nullptr;
   Debugger m_debugger;
-  ProgramStatus m_current_program_status{};
-  std::array<ProgramStatus, 5> m_saved_program_status{};
-  SavedRegisters m_saved_registers;
+  mutable ProgramStatus m_current_program_status{};
+  mutable LazyFlags m_pending_flags;
+  bool m_lazy_flags_enabled = true;
+  // Indexed by RegisterBank, the user slot is unused
+  std::array<ProgramStatus, RegisterBankCount> m_saved_program_status{};
+  // R8-R12 for every mode except FIQ, then FIQ's own copy
+  std::array<std::array<u32, 5>, 2> m_banked_r8_r12{};
+  // R13-R14 of each bank while it isn't the current one
+  std::array<std::array<u32, 2>, RegisterBankCount> m_banked_r13_r14{
+      {{0, 0}, {0, 0}, {0, 0}, {0x03007FE0, 0}, {0, 0}, {0, 0}}};
   u32 m_prefetch_offset = 4;
 
   nonstd::span<const u8> m_current_memory;
   u32 m_current_memory_region = 0;
   u32 m_memory_offset = 0;
   std::array<u8, 4> m_prefetched_opcode = {0, 0, 0, 0};
+
+  BlockCache m_block_cache;
+  std::unique_ptr<Jit> m_jit;
+  bool m_jit_verification = false;
+  bool m_threaded_dispatch = true;
+
+  u32 m_stalled_cycles = 0;
+  Scheduler m_scheduler;
+
+  bool m_idle = false;
+  bool m_idle_loop_detection = true;
+  std::vector<IdleLoop> m_idle_loops;
 };
 
 u32 execute_software_interrupt(Cpu& cpu, u32 instruction);
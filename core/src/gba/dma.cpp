@@ -1,6 +1,9 @@
 #include "gba/dma.h"
+#include <doctest/doctest.h>
 #include "gba/cpu.h"
 #include "gba/mmu.h"
+#include "gba/shifter.h"
+#include "gba/sound.h"
 
 namespace gb::advance {
 
@@ -36,6 +39,13 @@ void Dma::run() {
   m_mmu->copy_memory({masked_source, source_op}, {masked_dest, dest_op},
                      final_count, type_size);
 
+  // 2N + 2(n - 1)S + 2I, with the wait states of both buses
+  const AccessWidth width =
+      type_size == 4 ? AccessWidth::Word : AccessWidth::Halfword;
+  const Cycles accesses{final_count - 1, 1, 0};
+  m_cpu->stall(m_mmu->wait_cycles(masked_source, accesses, width) +
+               m_mmu->wait_cycles(masked_dest, accesses, width) + 2);
+
   // fmt::printf("type size %d count %d m_internal_source %08x\n", type_size,
   //            m_internal_count, m_internal_source);
   if (m_control.dest_addr_control() !=
@@ -43,13 +53,124 @@ void Dma::run() {
     m_internal_dest += final_count * (type_size * static_cast<int>(dest_op));
   }
   m_internal_source += final_count * (type_size * static_cast<int>(source_op));
+  finish();
+}
+
+void Dma::run_fifo(SoundFifo& fifo) {
+  constexpr u32 FifoWords = 4;
+  const auto source_op = select_addr_op(m_control.source_addr_control());
+  const u32 step = sizeof(u32) * static_cast<int>(source_op);
 
-  if (!m_control.repeat()) {
+  const u32 masked_source = m_internal_source & m_source_mask & 0x0ffffffc;
+  for (u32 i = 0; i < FifoWords; ++i) {
+    fifo.write_word(m_mmu->at<u32>(masked_source + i * step));
+  }
+
+  const Cycles accesses{FifoWords - 1, 1, 0};
+  m_cpu->stall(
+      m_mmu->wait_cycles(masked_source, accesses, AccessWidth::Word) +
+      m_mmu->wait_cycles(m_internal_dest & m_dest_mask, accesses,
+                         AccessWidth::Word) +
+      2);
+
+  m_internal_source += FifoWords * step;
+  finish();
+}
+
+void Dma::finish() {
+  // Immediate transfers run once whatever the repeat bit says
+  if (!m_control.repeat() ||
+      m_control.start_timing() == Control::StartTiming::Immediately) {
     m_control.set_enabled(false);
+    m_dmas->update_armed(*this);
   }
   if (m_control.interrupt_at_end()) {
-    m_cpu->interrupts_requested.set_interrupt(m_dma_interrupt, true);
+    m_cpu->request_interrupt(m_dma_interrupt);
+  }
+}
+
+void Dma::on_control_write(bool was_enabled) {
+  const bool enabled = m_control.enabled();
+  if (enabled && !was_enabled) {
+    m_internal_dest = dest;
+    m_internal_source = source;
+    m_internal_count = count;
   }
+  m_dmas->update_armed(*this);
+  if (enabled && !was_enabled &&
+      m_control.start_timing() == Control::StartTiming::Immediately) {
+    m_dmas->trigger(Control::StartTiming::Immediately);
+  }
+}
+
+void Dmas::update_armed(const Dma& dma) {
+  const u32 bit = 1U << static_cast<u32>(dma.number());
+  for (u32& armed : m_armed) {
+    armed &= ~bit;
+  }
+  if (dma.control().enabled()) {
+    m_armed[static_cast<u32>(dma.control().start_timing())] |= bit;
+  }
+}
+
+void Dmas::trigger(StartTiming timing) {
+  // Channels disarm themselves as they finish, so walk a copy
+  for (u32 armed = m_armed[static_cast<u32>(timing)]; armed != 0;
+       armed &= armed - 1) {
+    m_dmas[count_trailing_zeros(armed)].run();
+  }
+}
+
+TEST_CASE("Dmas should run armed channels in priority order") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  mmu.hardware.cpu = &cpu;
+  mmu.hardware.dmas = &dmas;
+  mmu.set<u32>(Mmu::EWramBegin, 0x12345678);
+
+  // DMA1 copies what DMA0 copied, so it has to run second
+  mmu.set<u32>(hardware::DMA1SAD, Mmu::IWramBegin);
+  mmu.set<u32>(hardware::DMA1DAD, Mmu::IWramBegin + 4);
+  mmu.set<u32>(hardware::DMA1CNT_L, 0xa400'0001);
+  mmu.set<u32>(hardware::DMA0SAD, Mmu::EWramBegin);
+  mmu.set<u32>(hardware::DMA0DAD, Mmu::IWramBegin);
+  mmu.set<u32>(hardware::DMA0CNT_L, 0xa400'0001);
+  CHECK(dmas.armed(Dmas::StartTiming::HBlank) == 0b11);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin + 4) == 0);
+
+  dmas.trigger(Dmas::StartTiming::VBlank);
+  CHECK(cpu.take_stalled_cycles() == 0);
+
+  dmas.trigger(Dmas::StartTiming::HBlank);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin + 4) == 0x12345678);
+  CHECK(dmas.armed(Dmas::StartTiming::HBlank) == 0);
+  // An EWRAM word read takes 6 cycles
+  CHECK(cpu.take_stalled_cycles() == (6 + 1 + 2) + (1 + 1 + 2));
+}
+
+TEST_CASE("Immediate DMA should run once even with repeat set") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  mmu.hardware.cpu = &cpu;
+  mmu.hardware.dmas = &dmas;
+  mmu.set<u32>(Mmu::EWramBegin, 0x12345678);
+
+  mmu.set<u32>(hardware::DMA0SAD, Mmu::EWramBegin);
+  mmu.set<u32>(hardware::DMA0DAD, Mmu::IWramBegin);
+  mmu.set<u32>(hardware::DMA0CNT_L, 0x8600'0001);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin) == 0x12345678);
+  CHECK_FALSE(dmas.dma(Dma::DmaNumber::Dma0).control().enabled());
+  CHECK(dmas.armed(Dmas::StartTiming::Immediately) == 0);
+
+  // Starting another channel leaves DMA0's transfer alone
+  mmu.set<u32>(Mmu::EWramBegin, 0x9abcdef0);
+  mmu.set<u32>(hardware::DMA3SAD, Mmu::EWramBegin);
+  mmu.set<u32>(hardware::DMA3DAD, Mmu::IWramBegin + 4);
+  mmu.set<u32>(hardware::DMA3CNT_L, 0x8400'0001);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin) == 0x12345678);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin + 4) == 0x9abcdef0);
 }
 
 }  // namespace gb::advance
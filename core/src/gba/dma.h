@@ -7,6 +7,8 @@
 namespace gb::advance {
 class Mmu;
 class Cpu;
+class Dmas;
+class SoundFifo;
 class Dma {
  public:
   enum class DmaNumber : u32 {
@@ -41,17 +43,10 @@ class Dma {
     Control(u16 value, Dma& dma) : Integer::Integer(value), m_dma{&dma} {}
 
     void write_byte(unsigned int byte, u8 value) {
-      const bool reload_internal_regs =
-          byte == 1 && gb::test_bit(value, 7) && !test_bit(15);
+      const bool was_enabled = enabled();
       Integer::write_byte(byte, value);
-      if (reload_internal_regs) {
-        m_dma->m_internal_dest = m_dma->dest;
-        m_dma->m_internal_source = m_dma->source;
-        m_dma->m_internal_count = m_dma->count;
-        if (m_dma->m_control.start_timing() ==
-            Control::StartTiming::Immediately) {
-          m_dma->run();
-        }
+      if (byte == 1) {
+        m_dma->on_control_write(was_enabled);
       }
     }
 
@@ -103,9 +98,10 @@ class Dma {
   u32 dest = 0;
   u16 count = 0;
 
-  Dma(Mmu& mmu, Cpu& cpu, DmaNumber dma_number)
+  Dma(Mmu& mmu, Cpu& cpu, Dmas& dmas, DmaNumber dma_number)
       : m_mmu{&mmu},
         m_cpu{&cpu},
+        m_dmas{&dmas},
         m_dma_number{dma_number},
         m_dma_interrupt{dma_number_to_interrupt(dma_number)},
         m_source_mask{static_cast<u32>(
@@ -119,9 +115,20 @@ class Dma {
   [[nodiscard]] DmaNumber number() const { return m_dma_number; }
   [[nodiscard]] Interrupt interrupt() const { return m_dma_interrupt; }
 
+  // Runs the transfer and stalls the CPU for as long as it takes
   void run();
 
+  // Sound FIFO requests ignore the count, width and destination settings
+  // and always move four words, so they skip the generic copy
+  void run_fifo(SoundFifo& fifo);
+
  private:
+  void on_control_write(bool was_enabled);
+
+  // Disarms the channel unless it repeats on HBlank, VBlank or special
+  // timing, and raises its interrupt
+  void finish();
+
   static Interrupt dma_number_to_interrupt(Dma::DmaNumber dma_number) {
     switch (dma_number) {
       case Dma::DmaNumber::Dma0:
@@ -137,6 +144,7 @@ class Dma {
   }
   Mmu* m_mmu;
   Cpu* m_cpu;
+  Dmas* m_dmas;
   Control m_control{0, *this};
   DmaNumber m_dma_number;
   Interrupt m_dma_interrupt;
@@ -148,13 +156,20 @@ class Dma {
   Control m_internal_control{0, *this};
 };
 
+// Channels register here when they are enabled, so HBlank, VBlank and
+// sound FIFO requests only wake the channels waiting for them.
 class Dmas {
  public:
+  using StartTiming = Dma::Control::StartTiming;
+
   Dmas(Mmu& mmu, Cpu& cpu)
-      : m_dmas{Dma{mmu, cpu, Dma::DmaNumber::Dma0},
-               Dma{mmu, cpu, Dma::DmaNumber::Dma1},
-               Dma{mmu, cpu, Dma::DmaNumber::Dma2},
-               Dma{mmu, cpu, Dma::DmaNumber::Dma3}} {}
+      : m_dmas{Dma{mmu, cpu, *this, Dma::DmaNumber::Dma0},
+               Dma{mmu, cpu, *this, Dma::DmaNumber::Dma1},
+               Dma{mmu, cpu, *this, Dma::DmaNumber::Dma2},
+               Dma{mmu, cpu, *this, Dma::DmaNumber::Dma3}} {}
+
+  Dmas(const Dmas&) = delete;
+  Dmas& operator=(const Dmas&) = delete;
 
   [[nodiscard]] Dma& dma(Dma::DmaNumber dma_number) {
     return m_dmas[static_cast<u32>(dma_number)];
@@ -162,7 +177,19 @@ class Dmas {
 
   [[nodiscard]] nonstd::span<Dma, 4> span() { return m_dmas; }
 
+  // Bit n is set while DMAn is enabled and waiting for timing
+  [[nodiscard]] u32 armed(StartTiming timing) const {
+    return m_armed[static_cast<u32>(timing)];
+  }
+
+  // Runs the channels armed for timing, DMA0 first
+  void trigger(StartTiming timing);
+
  private:
+  friend class Dma;
+  void update_armed(const Dma& dma);
+
   std::array<Dma, 4> m_dmas;
+  std::array<u32, 4> m_armed{};
 };
 }  // namespace gb::advance
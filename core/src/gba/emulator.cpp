@@ -1,34 +1,70 @@
 #include "emulator.h"
+#include <doctest/doctest.h>
 #include "gba/cpu.h"
+#include "gba/dma.h"
 #include "gba/gpu.h"
+#include "gba/input.h"
+#include "gba/lcd.h"
+#include "gba/scheduler.h"
 #include "gba/sound.h"
 #include "gba/timer.h"
 #include "types.h"
 
 namespace gb::advance {
 
-static thread_local int g_next_event_cycles = 1;
-
 bool execute_hardware(const Hardware& hardware) {
-  int next_event = std::numeric_limits<int>::max();
+  Cpu& cpu = *hardware.cpu;
+  Scheduler& scheduler = cpu.scheduler();
 
-  u32 total_cycles = 0;
-  while (g_next_event_cycles > 0) {
-    if (hardware.cpu->halted) {
-      total_cycles = g_next_event_cycles;
-      break;
+  // The CPU charges every block to the clock as soon as it ends, and returns
+  // early when a block schedules an earlier event or stalls it. Timers read
+  // in the middle of a slice see the current time, and events scheduled by
+  // IO writes shorten the slice.
+  for (int budget = scheduler.cycles_until_next_event(); budget > 0;
+       budget = scheduler.cycles_until_next_event()) {
+    // DMA transfers keep the CPU off the bus until they are done
+    if (const u32 stalled = cpu.take_stalled_cycles(); stalled != 0) {
+      scheduler.advance(stalled);
+    } else if (cpu.halted) {
+      scheduler.advance(static_cast<u32>(budget));
+    } else {
+      (void)cpu.execute(budget);
+      // Nothing changes in an idle loop until the next event
+      if (cpu.idle()) {
+        scheduler.advance(
+            static_cast<u32>(scheduler.cycles_until_next_event()));
+      }
     }
-    const u32 cycles = hardware.cpu->execute();
-    total_cycles += cycles;
-    g_next_event_cycles -= cycles;
   }
-  const bool draw_frame = hardware.lcd->update(total_cycles, next_event);
 
-  hardware.timers->update(total_cycles);
-  hardware.sound->update(total_cycles, next_event);
-  hardware.cpu->handle_interrupts();
-  g_next_event_cycles = next_event;
+  scheduler.run_due_events();
+
+  return hardware.lcd->take_frame();
+}
+
+TEST_CASE("execute_hardware should finish a frame every 280896 cycles") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Gpu gpu{mmu};
+  Dmas dmas{mmu, cpu};
+  Lcd lcd{cpu, dmas, gpu};
+  Input input;
+  Sound sound{[](auto) {}, cpu.scheduler(), dmas};
+  Timers timers{cpu, sound};
+  Hardware hardware{&cpu, &lcd, &input, &mmu, &timers, &dmas, &gpu, &sound};
+  mmu.hardware = hardware;
 
-  return draw_frame;
+  // b .
+  mmu.set<u16>(Mmu::IWramBegin, 0xe7fe);
+  cpu.set_thumb(true);
+  cpu.set_reg(Register::R15, Mmu::IWramBegin);
+
+  while (!execute_hardware(hardware)) {
+  }
+  const u64 first_frame = cpu.scheduler().now();
+  while (!execute_hardware(hardware)) {
+  }
+  // The idle loop skips straight to each event, so frames line up exactly
+  CHECK(cpu.scheduler().now() - first_frame == 280896);
 }
 }  // namespace gb::advance
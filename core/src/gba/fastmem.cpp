@@ -0,0 +1,126 @@
+#include "gba/fastmem.h"
+#include <doctest/doctest.h>
+#include <stdexcept>
+
+#if defined(GBEMU_FASTMEM) && defined(__linux__)
+#define GBEMU_FASTMEM_LINUX 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gb::advance {
+
+#ifdef GBEMU_FASTMEM_LINUX
+static constexpr std::size_t AddressSpaceSize = std::size_t{1} << 32;
+
+Fastmem::Fastmem() {
+  void* base = mmap(nullptr, AddressSpaceSize, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    throw std::runtime_error("failed to reserve the fastmem address space");
+  }
+  m_base = static_cast<u8*>(base);
+}
+
+Fastmem::~Fastmem() {
+  munmap(m_base, AddressSpaceSize);
+  for (const int fd : m_storage) {
+    close(fd);
+  }
+}
+
+bool Fastmem::supported() noexcept {
+  return true;
+}
+
+int Fastmem::create_storage(u32 size) {
+  const int fd = memfd_create("gbemu", MFD_CLOEXEC);
+  if (fd == -1) {
+    throw std::runtime_error("failed to create fastmem storage");
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to size fastmem storage");
+  }
+  m_storage.push_back(fd);
+  return static_cast<int>(m_storage.size() - 1);
+}
+
+void Fastmem::write_storage(int storage,
+                            u32 offset,
+                            nonstd::span<const u8> data) {
+  const std::size_t size = data.size();
+  if (pwrite(m_storage[storage], data.data(), size, offset) !=
+      static_cast<ssize_t>(size)) {
+    throw std::runtime_error("failed to write fastmem storage");
+  }
+}
+
+void Fastmem::map(int storage, u32 offset, u32 size, u32 addr, bool writable) {
+  const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  if (mmap(m_base + addr, size, protection, MAP_SHARED | MAP_FIXED,
+           m_storage[storage], offset) == MAP_FAILED) {
+    throw std::runtime_error("failed to map fastmem storage");
+  }
+}
+
+void Fastmem::unmap(u32 addr, u32 size) {
+  // Replacing the pages keeps the range reserved
+  if (mmap(m_base + addr, size, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+           0) == MAP_FAILED) {
+    throw std::runtime_error("failed to unmap fastmem storage");
+  }
+}
+#else
+Fastmem::Fastmem() = default;
+Fastmem::~Fastmem() = default;
+
+bool Fastmem::supported() noexcept {
+  return false;
+}
+
+int Fastmem::create_storage([[maybe_unused]] u32 size) {
+  throw std::runtime_error("fastmem isn't supported");
+}
+
+void Fastmem::write_storage([[maybe_unused]] int storage,
+                            [[maybe_unused]] u32 offset,
+                            [[maybe_unused]] nonstd::span<const u8> data) {
+  throw std::runtime_error("fastmem isn't supported");
+}
+
+void Fastmem::map([[maybe_unused]] int storage,
+                  [[maybe_unused]] u32 offset,
+                  [[maybe_unused]] u32 size,
+                  [[maybe_unused]] u32 addr,
+                  [[maybe_unused]] bool writable) {
+  throw std::runtime_error("fastmem isn't supported");
+}
+
+void Fastmem::unmap([[maybe_unused]] u32 addr, [[maybe_unused]] u32 size) {
+  throw std::runtime_error("fastmem isn't supported");
+}
+#endif
+
+TEST_CASE("fastmem views should share their storage") {
+  if (!Fastmem::supported()) {
+    return;
+  }
+  Fastmem fastmem;
+  const int storage = fastmem.create_storage(Fastmem::HostPageSize * 2);
+  fastmem.map(storage, 0, Fastmem::HostPageSize * 2, 0x02000000, true);
+  fastmem.map(storage, Fastmem::HostPageSize, Fastmem::HostPageSize,
+              0x02100000, false);
+
+  // The compiler can't see that the two addresses alias
+  volatile u8* const base = fastmem.base();
+  base[0x02000000 + Fastmem::HostPageSize + 4] = 0x42;
+  CHECK(base[0x02100004] == 0x42);
+
+  const std::array<u8, 2> data{0x12, 0x34};
+  fastmem.write_storage(storage, Fastmem::HostPageSize, data);
+  CHECK(base[0x02100001] == 0x34);
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include "types.h"
+#include "utils.h"
+
+namespace gb::advance {
+
+// Reserves the whole 32 bit address space on the host, so the GBA address
+// addr lives at base() + addr. Storage is created with memfd and can be
+// mapped at several addresses at once, which is how mirrors share memory.
+// Everything that isn't mapped, like IO and save memory, stays inaccessible.
+class Fastmem {
+ public:
+  static constexpr u32 HostPageSize = 4_kb;
+
+  Fastmem();
+  ~Fastmem();
+  Fastmem(const Fastmem&) = delete;
+  Fastmem& operator=(const Fastmem&) = delete;
+
+  // False unless built with GBEMU_FASTMEM on Linux
+  [[nodiscard]] static bool supported() noexcept;
+
+  // Creates zeroed storage of size bytes, a multiple of HostPageSize
+  [[nodiscard]] int create_storage(u32 size);
+
+  void write_storage(int storage, u32 offset, nonstd::span<const u8> data);
+
+  // Maps [offset, offset + size) of the storage at addr
+  void map(int storage, u32 offset, u32 size, u32 addr, bool writable);
+
+  // Makes [addr, addr + size) inaccessible again
+  void unmap(u32 addr, u32 size);
+
+  [[nodiscard]] u8* base() const noexcept { return m_base; }
+
+ private:
+  u8* m_base = nullptr;
+  std::vector<int> m_storage;
+};
+
+}  // namespace gb::advance
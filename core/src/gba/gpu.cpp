@@ -35,13 +35,6 @@ constexpr bool operator==(const Mat2<T>& lhs, const Mat2<T>& rhs) noexcept {
 
 using Mat2f = Mat2<float>;
 
-static constexpr auto make_blend_func(float first_weight, float second_weight) {
-  return [first_weight, second_weight](float channel1, float channel2) -> u8 {
-    return static_cast<u8>(
-        std::min(255.0F, channel1 * first_weight + channel2 * second_weight));
-  };
-}
-
 void Dispcnt::on_after_write() const {
   m_gpu->sort_backgrounds();
 }
@@ -50,17 +43,9 @@ void Bgcnt::on_after_write() const {
   m_gpu->sort_backgrounds();
 }
 
-static Color draw_color(u16 color) {
-  return {static_cast<u8>(convert_space<32, 256>(color & 0x1f)),
-          static_cast<u8>(convert_space<32, 256>((color >> 5) & 0x1f)),
-          static_cast<u8>(convert_space<32, 256>((color >> 10) & 0x1f)), 255};
-}
-
-static void draw_color(nonstd::span<Color> framebuffer,
-                       unsigned int x,
-                       unsigned int y,
-                       u16 color) {
-  framebuffer[Gpu::ScreenWidth * y + x] = draw_color(color);
+// Both follow the order of the DISPCNT enable bits
+static Compositor::Layer compositor_layer(Dispcnt::BackgroundLayer layer) {
+  return static_cast<Compositor::Layer>(layer);
 }
 
 class TileMapEntry : public Integer<u16> {
@@ -96,79 +81,25 @@ static std::size_t sprite_size_index(ObjAttribute0::Shape shape,
 }
 
 void Gpu::render_scanline(unsigned int scanline) {
-  if (dispcnt.layer_enabled(WindowId::Zero)) {
-    m_active_windows.push_back(window0);
-  }
-  if (dispcnt.layer_enabled(WindowId::One)) {
-    m_active_windows.push_back(window1);
-  }
+  m_compositor.begin_scanline(
+      static_cast<u16>(m_palette_ram[0] | (m_palette_ram[1] << 8)));
 
-  if (!m_active_windows.is_empty()) {
-    for (unsigned x = 0; x < ScreenWidth; ++x) {
+  const bool window0_enabled = dispcnt.layer_enabled(WindowId::Zero);
+  const bool window1_enabled = dispcnt.layer_enabled(WindowId::One);
+  if (window0_enabled || window1_enabled) {
+    for (unsigned int x = 0; x < ScreenWidth; ++x) {
       const Vec2<unsigned int> point{x, scanline};
-
-      const auto* is_inside = algorithm::find_if(
-          m_active_windows.begin(), m_active_windows.end(),
-          [point](const Window& window) { return window.contains(point); });
-      const auto* is_outside =
-          is_inside != m_active_windows.end()
-              ? m_active_windows.end()
-              : algorithm::find_if(
-                    m_active_windows.begin(), m_active_windows.end(),
-                    [point, this](const Window& window) {
-                      return !window.contains(point) &&
-                             !algorithm::any_of(m_active_windows.begin(),
-                                                m_active_windows.end(),
-                                                [point](const Window& window) {
-                                                  return window.contains(point);
-                                                });
-                    });
-
-      if (is_outside != m_active_windows.end()) {
-        m_per_pixel_context.window_layers_enabled[x].set_enabled_layer_bits(
-            window_out.enabled_layer_bits());
-      }
-
-      if (is_inside != m_active_windows.end()) {
-        m_per_pixel_context.window_layers_enabled[x].set_enabled_layer_bits(
-            window_in.enabled_layer_bits(is_inside->id));
+      // Window 0 takes precedence over window 1
+      u8 layer_bits = window_out.enabled_layer_bits();
+      if (window0_enabled && window0.contains(point)) {
+        layer_bits = window_in.enabled_layer_bits(WindowId::Zero);
+      } else if (window1_enabled && window1.contains(point)) {
+        layer_bits = window_in.enabled_layer_bits(WindowId::One);
       }
+      m_compositor.set_window(x, layer_bits);
     }
   }
 
-  ScopeGuard grapics_state_reset{[this] {
-    m_active_windows.clear();
-    for (auto& map : m_per_pixel_context.window_layers_enabled) {
-      map.reset();
-    }
-  }};
-
-  const Color backdrop_color =
-      draw_color(m_palette_ram[0] | (m_palette_ram[1] << 8));
-
-  for (auto& infos : m_per_pixel_context.pixel_priorities) {
-    infos.clear();
-    infos.emplace_back(Dispcnt::BackgroundLayer::Backdrop,
-                       std::numeric_limits<int>::max());
-  }
-  std::fill(m_per_pixel_context.sprite_priorities.begin(),
-            m_per_pixel_context.sprite_priorities.end(), -1);
-  for (auto& bg_scanline : m_scanlines) {
-    std::fill(bg_scanline.begin(), bg_scanline.end(), backdrop_color);
-  }
-  std::fill(m_framebuffer.begin() + ScreenWidth * scanline,
-            m_framebuffer.begin() + ScreenWidth * scanline + ScreenWidth,
-            Color{0, 0, 0, 255});
-  std::fill(m_per_pixel_context.priorities.begin(),
-            m_per_pixel_context.priorities.end(), -1);
-  std::fill(m_per_pixel_context.top_pixels.begin(),
-            m_per_pixel_context.top_pixels.end(), backdrop_color);
-  std::fill(sprite_scanline.begin(), sprite_scanline.end(), Color{0, 0, 0, 0});
-  std::fill(m_per_pixel_context.backdrop_scanline.begin(),
-            m_per_pixel_context.backdrop_scanline.end(), backdrop_color);
-
-  m_per_pixel_context.scanline = scanline;
-
   switch (dispcnt.bg_mode()) {
     case BgMode::Zero:
       for (auto background = m_backgrounds.begin();
@@ -198,110 +129,11 @@ void Gpu::render_scanline(unsigned int scanline) {
   }
   render_sprites(scanline);
 
-  const auto use_top_pixel = [this, scanline](int x) {
-    m_framebuffer[ScreenWidth * scanline + x] =
-        m_per_pixel_context.top_pixels[x];
-  };
-
-  if (bldcnt.mode() != Bldcnt::BlendMode::None) {
-    {
-      int x = 0;
-
-      for (const int priority : m_per_pixel_context.sprite_priorities) {
-        if (priority != -1) {
-          auto& priorities = m_per_pixel_context.pixel_priorities[x];
-          const int insert_index = [&priorities, priority] {
-            for (int i = priorities.size() - 1; i >= 0; --i) {
-              if (priorities[i].priority >= priority) {
-                return i + 1;
-              }
-            }
-            return 0;
-          }();
-          priorities.insert(&priorities[insert_index],
-                            PriorityInfo{Dispcnt::BackgroundLayer::Obj, -1});
-        }
-        ++x;
-      }
-    }
-    const float first_weight = bldalpha.first_target_coefficient();
-    const float second_weight = bldalpha.second_target_coefficient();
-    const float brightness_coefficient = bldy.coefficient();
-
-    for (unsigned int x = 0; x < ScreenWidth; ++x) {
-      auto& pixel_layers = m_per_pixel_context.pixel_priorities[x];
-
-      if (!m_per_pixel_context.window_layers_enabled[x]
-               .enable_special_effects()) {
-        use_top_pixel(x);
-        continue;
-      }
-
-      auto first_target = algorithm::find_if(
-          pixel_layers.rbegin(), pixel_layers.rend(), [this](auto info) {
-            return bldcnt.first_target_enabled(
-                Bldcnt::to_blend_layer(info.layer));
-          });
-      if (bldcnt.mode() == Bldcnt::BlendMode::BrightnessDecrease) {
-        if (first_target != pixel_layers.rend() &&
-            first_target->layer == pixel_layers.back().layer) {
-          const Color color_one =
-              framebuffer_from_layer(first_target->layer)[x];
-
-          m_framebuffer[ScreenWidth * scanline + x] = Color{
-              u8(color_one.r - (color_one.r * brightness_coefficient)),
-              u8(color_one.g - (color_one.g * brightness_coefficient)),
-              u8(color_one.b - (color_one.b * brightness_coefficient)), 255};
-        } else {
-          use_top_pixel(x);
-        }
-        continue;
-      }
-
-      auto second_target =
-
-          algorithm::find_if(first_target == pixel_layers.rend()
-                                 ? pixel_layers.rbegin()
-                                 : first_target + 1,
-                             pixel_layers.rend(), [this](auto info) {
-                               return bldcnt.second_target_enabled(
-                                   Bldcnt::to_blend_layer(info.layer));
-                             });
-
-      if ((first_target != pixel_layers.rend() &&
-           second_target == pixel_layers.rend()) ||
-          (first_target == pixel_layers.rend() &&
-           second_target != pixel_layers.rend())) {
-        m_framebuffer[ScreenWidth * scanline + x] =
-            m_per_pixel_context.top_pixels[x];
-      } else if (first_target != pixel_layers.rend() &&
-                 (first_target + 1) != pixel_layers.rend()) {
-        if (pixel_layers.back().layer == first_target->layer &&
-            (first_target + 1)->layer == second_target->layer) {
-          const auto blend = make_blend_func(first_weight, second_weight);
-          const Color color_one =
-              framebuffer_from_layer(first_target->layer)[x];
-          const Color color_two =
-              framebuffer_from_layer((first_target + 1)->layer)[x];
-
-          if (bldcnt.mode() == Bldcnt::BlendMode::Alpha) {
-            m_framebuffer[ScreenWidth * scanline + x] =
-                Color{blend(color_one.r, color_two.r),
-                      blend(color_one.g, color_two.g),
-                      blend(color_one.b, color_two.b), 255};
-          }
-        } else {
-          use_top_pixel(x);
-        }
-      } else {
-        use_top_pixel(x);
-      }
-    }
-  } else {
-    const auto begin = m_per_pixel_context.top_pixels.cbegin();
-    const auto end = m_per_pixel_context.top_pixels.cend();
-    std::copy(begin, end, &m_framebuffer[ScreenWidth * scanline]);
-  }
+  m_compositor.compose(
+      {bldcnt.data(), bldalpha.first_target_coefficient(),
+       bldalpha.second_target_coefficient(), bldy.coefficient()},
+      nonstd::span<Color>{m_framebuffer}.subspan(ScreenWidth * scanline,
+                                                 ScreenWidth));
 }
 
 void Gpu::sort_backgrounds() {
@@ -320,90 +152,50 @@ void Gpu::sort_backgrounds() {
   m_backgrounds_end = i;
 }
 
-void Gpu::PerPixelContext::put_pixel(unsigned int screen_x,
-                                     Color color,
-                                     Dispcnt::BackgroundLayer layer,
-                                     unsigned int priority) {
-  if (!window_layers_enabled[screen_x].layer_visible(layer)) {
-    return;
-  }
-
-  const auto new_priority = priority;
-  const bool is_higher_priority = priority <= priorities[screen_x];
-
-  if (is_higher_priority) {
-    auto& priorities_for_pixel = pixel_priorities[screen_x];
-    if ((priorities_for_pixel.size() == 0 ||
-         priorities_for_pixel.back().layer != layer)) {
-      priorities_for_pixel.emplace_back(layer, static_cast<int>(priority));
-    }
-    priorities[screen_x] = new_priority;
-    top_pixels[screen_x] = color;
-  }
-}
-
-void Gpu::PerPixelContext::put_sprite_pixel(unsigned int screen_x,
-                                            Color color,
-                                            unsigned int priority) {
-  if (!window_layers_enabled[screen_x].layer_visible(
-          Dispcnt::BackgroundLayer::Obj)) {
+template <bool is_sprite = false>
+static void render_pixel(nonstd::span<const u8> palette,
+                         unsigned int pixel,
+                         Compositor& compositor,
+                         Dispcnt::BackgroundLayer layer,
+                         unsigned int priority,
+                         unsigned int screen_x,
+                         bool semi_transparent = false) {
+  if (pixel == 0 || screen_x >= Gpu::ScreenWidth) {
     return;
   }
 
-  const bool is_higher_priority = priority <= priorities[screen_x];
-
-  sprite_priorities[screen_x] = priority;
+  u16 color;
+  std::memcpy(&color, &palette[pixel * 2], sizeof(u16));
 
-  if (is_higher_priority) {
-    // priorities[screen_x] = new_priority;
-    top_pixels[screen_x] = color;
+  if constexpr (is_sprite) {
+    compositor.put_obj(screen_x, color, priority, semi_transparent);
+  } else {
+    compositor.put(compositor_layer(layer), screen_x, color, priority);
   }
 }
 
+// Renders a row of palette indices from TileCache starting at screen_x
 template <bool is_sprite = false>
-static void render_tile_pixel_4bpp(nonstd::span<Color> framebuffer,
-                                   nonstd::span<const u8> palette_bank,
-                                   nonstd::span<const u8> tile_pixels,
-                                   Gpu::PerPixelContext& per_pixel_context,
-                                   Dispcnt::BackgroundLayer layer,
-                                   unsigned int priority,
-                                   unsigned int screen_x,
-                                   unsigned int tile_x
-
-) {
-  if (screen_x < Gpu::ScreenWidth) {
-    if (!per_pixel_context.window_layers_enabled[screen_x].layer_visible(
-            layer)) {
-      return;
-    }
-    const auto tile_offset = 32 * (tile_x / TileSize);
-    const u8 pixel = (tile_pixels[tile_offset + ((tile_x % TileSize) / 2)] >>
-                      (4 * (tile_x & 1))) &
-                     0xf;
-
-    // const u16 color =
-    //    palette_bank[pixel * 2] | (palette_bank[pixel * 2 + 1] << 8);
-
-    u16 color;
-    std::memcpy(&color, &palette_bank[pixel * 2], sizeof(u16));
-
-    if (pixel != 0) {
-      const Color rendered_color = draw_color(color);
-      framebuffer[screen_x] = rendered_color;
-      if constexpr (is_sprite) {
-        per_pixel_context.put_sprite_pixel(screen_x, rendered_color, priority);
-      } else {
-        per_pixel_context.put_pixel(screen_x, rendered_color, layer, priority);
-      }
-    }
+static void render_tile_row(nonstd::span<const u8> palette,
+                            u64 row,
+                            Compositor& compositor,
+                            Dispcnt::BackgroundLayer layer,
+                            unsigned int priority,
+                            unsigned int screen_x,
+                            bool semi_transparent = false) {
+  // Stops at the last opaque pixel, so transparent rows cost nothing
+  for (unsigned int x = 0; row != 0; ++x, row >>= 8) {
+    render_pixel<is_sprite>(palette, row & 0xff, compositor, layer, priority,
+                            screen_x + x, semi_transparent);
   }
 }
 
 void Gpu::render_mode3(unsigned int scanline) {
   for (unsigned int x = 0; x < ScreenWidth; ++x) {
     const auto color_index = (ScreenWidth * scanline + x) * 2;
-    const auto color = (m_vram[color_index] | (m_vram[color_index + 1] << 8));
-    draw_color(m_per_pixel_context.top_pixels, x, 0, color);
+    const auto color =
+        static_cast<u16>(m_vram[color_index] | (m_vram[color_index + 1] << 8));
+    m_compositor.put(Compositor::Layer::Bg2, x, color, bg2.control.priority());
   }
 }
 
@@ -414,7 +206,7 @@ void Gpu::render_mode4(unsigned int scanline) {
     const auto palette_index = vram[color_index] * 2;
     const u16 color =
         m_palette_ram[palette_index] | (m_palette_ram[palette_index + 1] << 8);
-    draw_color(m_per_pixel_context.top_pixels, x, 0, color);
+    m_compositor.put(Compositor::Layer::Bg2, x, color, bg2.control.priority());
   }
 }
 
@@ -429,12 +221,8 @@ void Gpu::render_background(const Background background,
   const auto base_block_offset = control.tilemap_base_block();
   const nonstd::span<const u8> vram = m_vram.subspan(base_block_offset);
 
-  const nonstd::span<const u8> pixels =
-      m_vram.subspan(control.character_base_block());
-
   const u32 bits_per_pixel = control.bits_per_pixel();
   const u32 tile_length = bits_per_pixel * 8;
-  const u32 tile_row_length = bits_per_pixel;
 
   const nonstd::span<const u8> palette = m_palette_ram;
 
@@ -486,40 +274,20 @@ void Gpu::render_background(const Background background,
     }();
 
     const auto tile_offset =
-        (tile_length * entry.tile_id()) + (scanline_offset * tile_row_length);
-    const auto tile_pixels = pixels.subspan(tile_offset, tile_row_length);
+        control.character_base_block() + tile_length * entry.tile_id();
+    const u64 row = bits_per_pixel == 4
+                        ? m_tile_cache.row_4bpp(tile_offset, scanline_offset,
+                                                entry.horizontal_flip())
+                        : m_tile_cache.row_8bpp(tile_offset, scanline_offset,
+                                                entry.horizontal_flip());
 
     const auto palette_bank_number =
         bits_per_pixel == 4 ? entry.palette_bank() : 0;
     const auto palette_bank = palette.subspan(2 * 16 * (palette_bank_number));
 
-    const auto base_index = index * TileSize;
-    if (bits_per_pixel == 4) {
-      for (unsigned int x = 0; x < TileSize; ++x) {
-        const auto reversed_x = entry.horizontal_flip() ? TileSize - x - 1 : x;
-        render_tile_pixel_4bpp(
-            background.scanline, palette_bank, tile_pixels, m_per_pixel_context,
-            background.layer, background.control.priority(),
-            base_index - (background.scroll.x % TileSize) + x, reversed_x);
-      }
-    } else {
-      for (unsigned int pixel_x = 0; pixel_x < tile_pixels.size(); ++pixel_x) {
-        const int tile_group = tile_pixels[pixel_x];
-        const u16 color = (m_palette_ram[tile_group * 2]) |
-                          (m_palette_ram[tile_group * 2 + 1] << 8);
-
-        const auto x = entry.horizontal_flip()
-                           ? (TileSize - 1) + base_index - pixel_x
-                           : base_index + pixel_x;
-
-        if (x < Gpu::ScreenWidth && tile_group != 0) {
-          const Color rendered_color = draw_color(color);
-          background.scanline[x] = rendered_color;
-          m_per_pixel_context.put_pixel(x, rendered_color, background.layer,
-                                        background.control.priority());
-        }
-      }
-    }
+    render_tile_row(palette_bank, row, m_compositor, background.layer,
+                    background.control.priority(),
+                    index * TileSize - (background.scroll.x % TileSize));
   }
 }
 
@@ -571,11 +339,8 @@ void Gpu::render_mode2(Background& background) {
       const auto color_index = pixel_index * 2;
       const u16 color =
           m_palette_ram[color_index] | (m_palette_ram[color_index + 1] << 8);
-      const Color converted_color = draw_color(color);
-      background.scanline[x] = converted_color;
-      m_per_pixel_context.put_pixel(x, converted_color, background.layer,
-                                    background.control.priority());
-      // draw_color(m_per_pixel_context.top_pixels, x, 0, color);
+      m_compositor.put(compositor_layer(background.layer), x, color,
+                       background.control.priority());
     }
   }
 
@@ -586,13 +351,8 @@ void Gpu::render_mode2(Background& background) {
 
 void Gpu::render_sprites(unsigned int scanline) {
   const auto sprite_palette_ram = m_palette_ram.subspan(0x200);
-  const auto sprite_tile_data = m_vram.subspan(0x010000);
 
-  const float first_weight = bldalpha.first_target_coefficient();
-  const float second_weight = bldalpha.second_target_coefficient();
-  const auto blend = make_blend_func(first_weight, second_weight);
   // Render sprites backwards to express the priority
-  std::array<Color, 128> old_tile;
   for (auto i = m_oam_ram.ssize() - 8; i >= 0; i -= 8) {
     const Sprite sprite(m_oam_ram[i + 0] | (m_oam_ram[i + 1] << 8),
                         m_oam_ram[i + 2] | (m_oam_ram[i + 3] << 8),
@@ -605,7 +365,6 @@ void Gpu::render_sprites(unsigned int scanline) {
 
     const auto bits_per_pixel = sprite.attrib0.bits_per_pixel();
     const auto tile_length = bits_per_pixel * 8;
-    const auto tile_row_length = bits_per_pixel;
 
     const auto sprite_rect_index =
         sprite_size_index(sprite.attrib0.shape(), sprite.attrib1.obj_size());
@@ -619,17 +378,63 @@ void Gpu::render_sprites(unsigned int scanline) {
       return rect;
     }();
 
-    const auto palette_bank_number = sprite.attrib2.palette_bank();
-    const auto palette_ram =
-        sprite_palette_ram.subspan(palette_bank_number * 2 * 16);
+    const int coord_divisor =
+        static_cast<int>(mode == ObjAttribute0::Mode::AffineDoubleRendering);
+
+    const Rect<unsigned int> half_rect{sprite_rect.width >> coord_divisor,
+                                       sprite_rect.height >> coord_divisor};
+
+    // 8bpp sprites index all of the sprite palette
+    const auto palette =
+        bits_per_pixel == 8
+            ? sprite_palette_ram
+            : sprite_palette_ram.subspan(sprite.attrib2.palette_bank() * 2 *
+                                         16);
+    const bool semi_transparent =
+        sprite.attrib0.gfx_mode() == ObjAttribute0::GfxMode::AlphaBlending;
+
+    // The row of 8 pixels at x, y in the sprite. Tile numbers count 32 bytes
+    // whatever the depth, and wrap around the 32KB of sprite VRAM.
+    const auto tile_row = [&](unsigned int x, unsigned int y,
+                              bool horizontal_flip) {
+      const auto sprite_2d_offset =
+          dispcnt.obj_vram_mapping() == Dispcnt::ObjVramMapping::TwoDimensional
+              ? ((y / TileSize) * 32 * Mmu::VramBlockSize)
+              : ((y / TileSize) * (half_rect.width / TileSize) * tile_length);
+      const u32 offset =
+          0x10000 + ((sprite.attrib2.tile_id() * Mmu::VramBlockSize +
+                      sprite_2d_offset + (x / TileSize) * tile_length) &
+                     0x7fff);
+      return bits_per_pixel == 8
+                 ? m_tile_cache.row_8bpp(offset, y % TileSize, horizontal_flip)
+                 : m_tile_cache.row_4bpp(offset, y % TileSize,
+                                         horizontal_flip);
+    };
+
+    if (mode == ObjAttribute0::Mode::Normal) {
+      const auto sprite_y = scanline - sprite.attrib0.y();
+      if (sprite_y >= sprite_rect.height) {
+        continue;
+      }
+      const auto y = sprite.attrib1.vertical_flip()
+                         ? sprite_rect.height - sprite_y - 1
+                         : sprite_y;
+      const bool horizontal_flip = sprite.attrib1.horizontal_flip();
+      for (unsigned int x = 0; x < sprite_rect.width; x += TileSize) {
+        const auto tile_x =
+            horizontal_flip ? sprite_rect.width - x - TileSize : x;
+        render_tile_row<true>(palette, tile_row(tile_x, y, horizontal_flip),
+                              m_compositor, Dispcnt::BackgroundLayer::Obj,
+                              sprite.attrib2.priority(),
+                              sprite.attrib1.x() + x, semi_transparent);
+      }
+      continue;
+    }
 
     static constexpr Mat2f identity{1, 0, 0, 1};
     static constexpr Mat2f scale_half{2, 0, 0, 2};
 
     const Mat2f matrix = [&]() -> Mat2f {
-      if (mode == ObjAttribute0::Mode::Normal) {
-        return identity;
-      }
       const auto offset = 0x20 * sprite.attrib1.affine_parameter_group();
 
       s16 pa;
@@ -651,19 +456,10 @@ void Gpu::render_sprites(unsigned int scanline) {
                                                                  : identity);
     }();
 
-    const int coord_divisor =
-        static_cast<int>(mode == ObjAttribute0::Mode::AffineDoubleRendering);
-
-    const Rect<unsigned int> half_rect{sprite_rect.width >> coord_divisor,
-                                       sprite_rect.height >> coord_divisor};
-
     for (unsigned int x = 0; x < sprite_rect.width; ++x) {
       // The transform occurs at the center of the sprite
       const auto [transformed_scanline, transformed_x] =
           [&]() -> std::tuple<unsigned int, unsigned int> {
-        if (mode == ObjAttribute0::Mode::Normal) {
-          return {scanline, x};
-        }
         const Vec2<float> vec =
             matrix * Vec2<float>{2.0F * float(x) / sprite_rect.width - 1,
                                  2.0F * float(scanline - sprite.attrib0.y()) /
@@ -680,7 +476,6 @@ void Gpu::render_sprites(unsigned int scanline) {
         return {new_scanline, new_x};
       }();
 
-      const auto tile_base_offset = (sprite.attrib2.tile_id() * tile_length);
       const auto sprite_y = static_cast<unsigned int>(sprite.attrib0.y());
 
       // The scanline in sprite y coordinates
@@ -689,11 +484,6 @@ void Gpu::render_sprites(unsigned int scanline) {
               ? sprite_rect.height - (transformed_scanline - sprite_y) - 1
               : (transformed_scanline - sprite_y);
 
-      const auto sprite_height_scanline =
-          scanline_relative_to_sprite / TileSize;
-
-      const auto tile_scanline = (scanline_relative_to_sprite % TileSize);
-
       if (transformed_scanline < sprite_y) {
         continue;
       }
@@ -701,17 +491,6 @@ void Gpu::render_sprites(unsigned int scanline) {
         continue;
       }
 
-      const auto sprite_2d_offset =
-          dispcnt.obj_vram_mapping() == Dispcnt::ObjVramMapping::TwoDimensional
-              ? (sprite_height_scanline * 32 * tile_length)
-              : (sprite_height_scanline * half_rect.width * tile_row_length);
-
-      const auto sprite_pixels =
-          sprite_tile_data.subspan(tile_base_offset + sprite_2d_offset +
-                                   (tile_row_length * tile_scanline)
-
-          );
-
       const auto base_x = sprite.attrib1.x() + (x);
       const auto reversed_x = sprite.attrib1.horizontal_flip()
                                   ? half_rect.width - transformed_x - 1
@@ -721,27 +500,12 @@ void Gpu::render_sprites(unsigned int scanline) {
         continue;
       }
 
-      if (base_x < ScreenWidth) {
-        old_tile[x] = m_per_pixel_context.top_pixels[base_x];
-      }
       assert(reversed_x < sprite_rect.width);
 
-      render_tile_pixel_4bpp<true>(
-          sprite_scanline, palette_ram, sprite_pixels, m_per_pixel_context,
-          Dispcnt::BackgroundLayer::Obj, sprite.attrib2.priority(), base_x,
-          reversed_x);
-
-      if (sprite.attrib0.gfx_mode() == ObjAttribute0::GfxMode::AlphaBlending &&
-          base_x < ScreenWidth) {
-        // Disable any other alpha blending for this pixel
-        // and write the blended sprite
-        m_per_pixel_context.pixel_priorities[x].clear();
-        const Color color_one = m_per_pixel_context.top_pixels[base_x];
-        const Color color_two = old_tile[x];
-        m_per_pixel_context.top_pixels[base_x] = Color{
-            blend(color_one.r, color_two.r), blend(color_one.g, color_two.g),
-            blend(color_one.b, color_two.b), 255};
-      }
+      const u64 row = tile_row(reversed_x, scanline_relative_to_sprite, false);
+      render_pixel<true>(palette, (row >> (8 * (reversed_x % TileSize))) & 0xff,
+                         m_compositor, Dispcnt::BackgroundLayer::Obj,
+                         sprite.attrib2.priority(), base_x, semi_transparent);
     }
   }
 }  // namespace gb::advance
@@ -1,12 +1,12 @@
 #pragma once
 #include "color.h"
 #include "error_handling.h"
+#include "gba/compositor.h"
 #include "gba/mmu.h"
-#include "static_vector.h"
+#include "gba/tile_cache.h"
 #include "utils.h"
 
 namespace gb::advance {
-constexpr u32 TileSize = 8;
 enum class BgMode : u32 { Zero = 0, One, Two, Three, Four, Five };
 
 class Gpu;
@@ -128,11 +128,6 @@ class Bgcnt : public Integer<u16> {
   Gpu* m_gpu;
 };
 
-struct PriorityInfo {
-  Dispcnt::BackgroundLayer layer;
-  int priority;
-};
-
 class Bldcnt : public Integer<u16> {
  public:
   using Integer::Integer;
@@ -197,18 +192,18 @@ class Bldalpha : public Integer<u16> {
  public:
   using Integer::Integer;
 
-  [[nodiscard]] float first_target_coefficient() const {
+  // EVA and EVB in sixteenths
+  [[nodiscard]] u32 first_target_coefficient() const {
     return calculate_coefficient(m_value & 0b11111);
   }
 
-  [[nodiscard]] float second_target_coefficient() const {
+  [[nodiscard]] u32 second_target_coefficient() const {
     return calculate_coefficient((m_value >> 8) & 0b11111);
   }
 
  private:
-  static float calculate_coefficient(u16 value) {
-    return value >= 16 ? 1.0F : (static_cast<float>(value) / 16.0F);
-  }
+  // Anything past 16 acts as 16
+  static u32 calculate_coefficient(u32 value) { return std::min(value, 16U); }
 };
 
 class ObjAttribute0 : public Integer<u16> {
@@ -292,8 +287,9 @@ class Bldy : public Integer<u16> {
  public:
   using Integer::Integer;
 
-  [[nodiscard]] float coefficient() const {
-    return std::clamp(m_value & 0b11111, 0, 16) / 16.0F;
+  // EVY in sixteenths
+  [[nodiscard]] u32 coefficient() const {
+    return std::min<u32>(m_value & 0b11111, 16);
   }
 
   [[nodiscard]] bool is_one() const { return m_value >= 0x10; }
@@ -403,44 +399,6 @@ class Gpu {
   static constexpr u32 ScreenWidth = 240;
   static constexpr u32 ScreenHeight = 160;
 
-  struct PerPixelContext {
-    class EnabledLayerMap {
-     public:
-      [[nodiscard]] bool layer_visible(Dispcnt::BackgroundLayer layer) const {
-        return test_bit(m_enabled_layer_bits, static_cast<u32>(layer));
-      }
-
-      [[nodiscard]] bool enable_special_effects() const {
-        return test_bit(m_enabled_layer_bits, 5);
-      }
-
-      void set_enabled_layer_bits(u8 enabled_layer_bits) {
-        m_enabled_layer_bits = enabled_layer_bits;
-      }
-
-      void reset() { m_enabled_layer_bits = 0xff; }
-
-     private:
-      u8 m_enabled_layer_bits = 0xff;
-    };
-
-    Gpu* gpu;
-    std::array<unsigned int, ScreenWidth> priorities{};
-    std::array<Color, ScreenWidth> top_pixels{};
-    std::array<int, ScreenWidth> sprite_priorities{};
-    std::array<StaticVector<PriorityInfo, 6>, ScreenWidth> pixel_priorities{};
-    std::array<Color, ScreenWidth> backdrop_scanline{};
-    std::array<EnabledLayerMap, ScreenWidth> window_layers_enabled{};
-    unsigned int scanline = 0;
-
-    void put_pixel(unsigned int x,
-                   Color color,
-                   Dispcnt::BackgroundLayer layer,
-                   unsigned int priority);
-
-    void put_sprite_pixel(unsigned int x, Color color, unsigned int priority);
-  };
-
   class AffineScrollProxy {
    public:
     // Internal affine scroll registers should be updated when the real register
@@ -473,7 +431,6 @@ class Gpu {
     Vec2<int> internal_affine_scroll{0, 0};
 
     Vec2<u16> scroll{0, 0};
-    nonstd::span<Color> scanline;
 
     std::array<s16, 4> affine_matrix{1 << 8, 0, 0, 1 << 8};
 
@@ -486,28 +443,22 @@ class Gpu {
       return (static_cast<int>(layer) >> 8) + control.priority();
     }
 
-    Background(Gpu& gpu,
-               Dispcnt::BackgroundLayer l,
-               nonstd::span<Color> scanline_buffer)
-        : control{gpu}, layer{l}, scanline{scanline_buffer} {}
+    Background(Gpu& gpu, Dispcnt::BackgroundLayer l) : control{gpu}, layer{l} {}
   };
 
   Gpu(Mmu& mmu)
       : m_vram{mmu.vram()},
         m_palette_ram{mmu.palette_ram()},
         m_oam_ram{mmu.oam_ram()},
+        m_tile_cache{mmu.vram(), mmu.vram_writes()},
         m_framebuffer(ScreenWidth * ScreenHeight) {}
 
   Dispcnt dispcnt{*this};
 
- private:
-  std::array<std::array<Color, ScreenWidth>, 4> m_scanlines;
-
- public:
-  Background bg0{*this, Dispcnt::BackgroundLayer::Zero, m_scanlines[0]};
-  Background bg1{*this, Dispcnt::BackgroundLayer::One, m_scanlines[1]};
-  Background bg2{*this, Dispcnt::BackgroundLayer::Two, m_scanlines[2]};
-  Background bg3{*this, Dispcnt::BackgroundLayer::Three, m_scanlines[3]};
+  Background bg0{*this, Dispcnt::BackgroundLayer::Zero};
+  Background bg1{*this, Dispcnt::BackgroundLayer::One};
+  Background bg2{*this, Dispcnt::BackgroundLayer::Two};
+  Background bg3{*this, Dispcnt::BackgroundLayer::Three};
 
   Bldcnt bldcnt{0};
   Bldalpha bldalpha{0};
@@ -531,49 +482,18 @@ class Gpu {
   void render_mode3(unsigned int scanline);
   void render_mode4(unsigned int scanline);
 
-  void render_tile_row_4bpp(nonstd::span<Color> framebuffer,
-                            nonstd::span<const u8> palette_bank,
-                            Vec2<unsigned int> position,
-                            unsigned int priority,
-                            Gpu::PerPixelContext& per_pixel_context,
-                            nonstd::span<const u8> tile_pixels,
-                            Dispcnt::BackgroundLayer layer,
-                            PriorityInfo priority_info,
-                            bool horizontal_flip = false);
   void render_background(Background background, unsigned int scanline);
   void render_sprites(unsigned int scanline);
 
-  nonstd::span<const Color> framebuffer_from_layer(
-      Dispcnt::BackgroundLayer layer) const {
-    switch (layer) {
-      case Dispcnt::BackgroundLayer::Zero:
-        return bg0.scanline;
-      case Dispcnt::BackgroundLayer::One:
-        return bg1.scanline;
-      case Dispcnt::BackgroundLayer::Two:
-        return bg2.scanline;
-      case Dispcnt::BackgroundLayer::Three:
-        return bg3.scanline;
-      case Dispcnt::BackgroundLayer::Obj:
-        return sprite_scanline;
-      case Dispcnt::BackgroundLayer::Backdrop:
-        return m_per_pixel_context.backdrop_scanline;
-      default:
-        throw std::runtime_error("invalid layer");
-    }
-  }
-  StaticVector<Window, 3> m_active_windows;
-
   std::array<Background*, 4> m_backgrounds{&bg0, &bg1, &bg2, &bg3};
   decltype(m_backgrounds)::iterator m_backgrounds_end = m_backgrounds.begin();
 
-  std::array<Color, ScreenWidth> sprite_scanline;
-
   nonstd::span<u8> m_vram;
   nonstd::span<u8> m_palette_ram;
   nonstd::span<u8> m_oam_ram;
 
-  PerPixelContext m_per_pixel_context{this};
+  TileCache m_tile_cache;
+  Compositor m_compositor;
   std::vector<Color> m_framebuffer;
 };
 }  // namespace gb::advance
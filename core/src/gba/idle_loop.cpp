@@ -0,0 +1,343 @@
+#include "gba/idle_loop.h"
+#include <optional>
+#include "gba/cpu.h"
+#include "gba/dma.h"
+#include "gba/sound.h"
+#include "gba/timer.h"
+#include "utils.h"
+
+namespace gb::advance {
+
+namespace {
+struct RegisterEffects {
+  u32 reads = 0;
+  u32 writes = 0;
+};
+
+constexpr u32 reg_bit(u32 instruction, u32 shift) {
+  return 1U << ((instruction >> shift) & 0xf);
+}
+
+constexpr u32 low_reg_bit(u32 instruction, u32 shift) {
+  return 1U << ((instruction >> shift) & 0b111);
+}
+
+// Registers used by an instruction that is allowed in an idle loop, or
+// nullopt for stores, writeback, carry reads and anything that writes R15.
+std::optional<RegisterEffects> register_effects(u32 instruction) {
+  if ((instruction >> 28) != static_cast<u32>(Condition::AL)) {
+    return std::nullopt;
+  }
+
+  const u32 dest = reg_bit(instruction, 12);
+  if (dest == 1U << 15) {
+    return std::nullopt;
+  }
+  const bool load = test_bit(instruction, 20);
+  const bool preindex = test_bit(instruction, 24);
+  const bool write_back = test_bit(instruction, 21);
+  const bool is_rrx = ((instruction >> 5) & 0b11) == 0b11 &&
+                      ((instruction >> 7) & 0b11111) == 0 &&
+                      !test_bit(instruction, 4);
+
+  // Single data transfer
+  if ((instruction & 0x0c000000) == 0x04000000) {
+    const bool register_offset = test_bit(instruction, 25);
+    if (!load || !preindex || write_back || (register_offset && is_rrx) ||
+        (register_offset && test_bit(instruction, 4))) {
+      return std::nullopt;
+    }
+    const u32 offset = register_offset ? reg_bit(instruction, 0) : 0;
+    return RegisterEffects{reg_bit(instruction, 16) | offset, dest};
+  }
+
+  if ((instruction & 0x0c000000) != 0) {
+    return std::nullopt;
+  }
+
+  const bool immediate_operand = test_bit(instruction, 25);
+  if (!immediate_operand && (instruction & 0x90) == 0x90) {
+    // Multiply and swap
+    if ((instruction & 0x60) == 0) {
+      return std::nullopt;
+    }
+    // Halfword and signed data transfer
+    if (!load || !preindex || write_back) {
+      return std::nullopt;
+    }
+    const bool immediate_offset = test_bit(instruction, 22);
+    const u32 offset = immediate_offset ? 0 : reg_bit(instruction, 0);
+    return RegisterEffects{reg_bit(instruction, 16) | offset, dest};
+  }
+
+  const auto opcode = static_cast<Opcode>((instruction >> 21) & 0xf);
+  const bool is_test = opcode == Opcode::Tst || opcode == Opcode::Teq ||
+                       opcode == Opcode::Cmp || opcode == Opcode::Cmn;
+  // MRS, MSR and BX live in the test opcodes without the S bit
+  if (is_test && !load) {
+    return std::nullopt;
+  }
+  if (opcode == Opcode::Adc || opcode == Opcode::Sbc || opcode == Opcode::Rsc) {
+    return std::nullopt;
+  }
+
+  RegisterEffects effects;
+  if (opcode != Opcode::Mov && opcode != Opcode::Mvn) {
+    effects.reads |= reg_bit(instruction, 16);
+  }
+  if (!immediate_operand) {
+    if (is_rrx) {
+      return std::nullopt;
+    }
+    effects.reads |= reg_bit(instruction, 0);
+    if (test_bit(instruction, 4)) {
+      effects.reads |= reg_bit(instruction, 8);
+    }
+  }
+  if (!is_test) {
+    effects.writes = dest;
+  }
+  return effects;
+}
+
+std::optional<RegisterEffects> register_effects(u16 instruction) {
+  const u32 rd = low_reg_bit(instruction, 0);
+  const u32 rs = low_reg_bit(instruction, 3);
+  const u32 rn = low_reg_bit(instruction, 6);
+  const u32 rd_high = low_reg_bit(instruction, 8);
+  const bool load = test_bit(instruction, 11);
+
+  switch (instruction >> 13) {
+    case 0b000:
+      if ((instruction & 0x1800) == 0x1800) {
+        // Add/subtract
+        return RegisterEffects{rs | (test_bit(instruction, 10) ? 0 : rn), rd};
+      }
+      // Move shifted register
+      return RegisterEffects{rs, rd};
+    case 0b001:
+      // Move/compare/add/subtract immediate
+      switch ((instruction >> 11) & 0b11) {
+        case 0b00:
+          return RegisterEffects{0, rd_high};
+        case 0b01:
+          return RegisterEffects{rd_high, 0};
+        default:
+          return RegisterEffects{rd_high, rd_high};
+      }
+    case 0b010:
+      if ((instruction & 0xfc00) == 0x4000) {
+        // ALU operations
+        switch ((instruction >> 6) & 0xf) {
+          case 0b0101:  // ADC
+          case 0b0110:  // SBC
+          case 0b0111:  // ROR uses the carry when the amount is 0
+            return std::nullopt;
+          case 0b1000:  // TST
+          case 0b1010:  // CMP
+          case 0b1011:  // CMN
+            return RegisterEffects{rd | rs, 0};
+          case 0b1001:  // NEG
+          case 0b1111:  // MVN
+            return RegisterEffects{rs, rd};
+          default:
+            return RegisterEffects{rd | rs, rd};
+        }
+      }
+      if ((instruction & 0xfc00) == 0x4400) {
+        // Hi register operations
+        const u32 hi_rd = 1U << ((instruction & 0b111) |
+                                 ((instruction >> 4) & 0b1000));
+        const u32 hi_rs = 1U << ((instruction >> 3) & 0b1111);
+        if (hi_rd == 1U << 15 || hi_rs == 1U << 15) {
+          return std::nullopt;
+        }
+        switch ((instruction >> 8) & 0b11) {
+          case 0b00:
+            return RegisterEffects{hi_rd | hi_rs, hi_rd};
+          case 0b01:
+            return RegisterEffects{hi_rd | hi_rs, 0};
+          case 0b10:
+            return RegisterEffects{hi_rs, hi_rd};
+          default:
+            return std::nullopt;
+        }
+      }
+      if ((instruction & 0xf800) == 0x4800) {
+        // PC relative load
+        return RegisterEffects{0, rd_high};
+      }
+      // Load/store with register offset, only STR, STRB and STRH store
+      if (test_bit(instruction, 9) ? (instruction & 0x0c00) == 0 : !load) {
+        return std::nullopt;
+      }
+      return RegisterEffects{rs | rn, rd};
+    case 0b011:
+      // Load/store with immediate offset
+      if (!load) {
+        return std::nullopt;
+      }
+      return RegisterEffects{rs, rd};
+    case 0b100:
+      if (!load) {
+        return std::nullopt;
+      }
+      if ((instruction & 0xf000) == 0x8000) {
+        // Load halfword
+        return RegisterEffects{rs, rd};
+      }
+      // SP relative load
+      return RegisterEffects{1U << 13, rd_high};
+    case 0b101:
+      if ((instruction & 0xf000) == 0xa000) {
+        // Load address
+        return RegisterEffects{load ? 1U << 13 : 0, rd_high};
+      }
+      return std::nullopt;
+    default:
+      return std::nullopt;
+  }
+}
+
+// Where the final instruction branches to, if it is a plain branch
+std::optional<u32> branch_target(u32 instruction, u32 addr) {
+  if ((instruction & 0x0f000000) != 0x0a000000 || (instruction >> 28) == 0xf) {
+    return std::nullopt;
+  }
+  const auto offset = static_cast<s32>(instruction << 8) >> 6;
+  return addr + 8 + offset;
+}
+
+std::optional<u32> branch_target(u16 instruction, u32 addr) {
+  if ((instruction & 0xf000) == 0xd000 &&
+      ((instruction >> 8) & 0xf) < 0xe) {
+    const auto offset = static_cast<s32>(static_cast<s8>(instruction & 0xff));
+    return addr + 4 + offset * 2;
+  }
+  if ((instruction & 0xf800) == 0xe000) {
+    const auto offset =
+        static_cast<s32>(static_cast<u32>(instruction) << 21) >> 20;
+    return addr + 4 + offset;
+  }
+  return std::nullopt;
+}
+
+template <typename BlockType>
+bool is_idle_loop_impl(const BlockType& block, u32 pc) {
+  using OpcodeType = typename BlockType::OpcodeType;
+  const auto& instructions = block.instructions;
+  if (instructions.empty()) {
+    return false;
+  }
+
+  const u32 branch_addr = pc + (instructions.size() - 1) * sizeof(OpcodeType);
+  if (branch_target(instructions.back().opcode, branch_addr) != pc) {
+    return false;
+  }
+
+  u32 loop_writes = 0;
+  for (std::size_t i = 0; i + 1 < instructions.size(); ++i) {
+    const auto effects = register_effects(instructions[i].opcode);
+    if (!effects) {
+      return false;
+    }
+    loop_writes |= effects->writes;
+  }
+
+  // A register that is read before it is written carries state between
+  // iterations, e.g. a counter
+  u32 written = 0;
+  for (std::size_t i = 0; i + 1 < instructions.size(); ++i) {
+    const auto effects = *register_effects(instructions[i].opcode);
+    if ((effects.reads & ~written & loop_writes) != 0) {
+      return false;
+    }
+    written |= effects.writes;
+  }
+  return true;
+}
+}  // namespace
+
+bool is_idle_loop(const ArmBlock& block, u32 pc) {
+  return is_idle_loop_impl(block, pc);
+}
+
+bool is_idle_loop(const ThumbBlock& block, u32 pc) {
+  return is_idle_loop_impl(block, pc);
+}
+
+TEST_CASE("is_idle_loop should only accept loops without side effects") {
+  const auto thumb_block = [](std::initializer_list<u16> opcodes) {
+    ThumbBlock block;
+    for (const u16 opcode : opcodes) {
+      block.instructions.push_back({nullptr, opcode});
+    }
+    return block;
+  };
+
+  // ldr r0, [r1]; cmp r0, #0; beq start
+  CHECK(is_idle_loop(thumb_block({0x6808, 0x2800, 0xd0fc}), 0x03000000));
+  // b .
+  CHECK(is_idle_loop(thumb_block({0xe7fe}), 0x03000000));
+  // add r0, #1; b start
+  CHECK_FALSE(is_idle_loop(thumb_block({0x3001, 0xe7fd}), 0x03000000));
+  // str r0, [r1]; b start
+  CHECK_FALSE(is_idle_loop(thumb_block({0x6008, 0xe7fd}), 0x03000000));
+  // ldr r0, [r0]; cmp r0, #0; beq start
+  CHECK_FALSE(is_idle_loop(thumb_block({0x6800, 0x2800, 0xd0fc}), 0x03000000));
+
+  ArmBlock arm_block;
+  // ldrh r0, [r1, #6]; cmp r0, #160; bne start
+  for (const u32 opcode : {0xe1d100b6U, 0xe35000a0U, 0x1afffffcU}) {
+    arm_block.instructions.push_back({nullptr, opcode});
+  }
+  CHECK(is_idle_loop(arm_block, 0x08000000));
+}
+
+TEST_CASE("Cpu should report idle loops") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  cpu.set_thumb(true);
+
+  // ldr r0, [r1]; cmp r0, #0; beq start
+  mmu.set<u16>(0x03000000, 0x6808);
+  mmu.set<u16>(0x03000002, 0x2800);
+  mmu.set<u16>(0x03000004, 0xd0fc);
+  cpu.set_reg(Register::R1, 0x03000100);
+  cpu.set_reg(Register::R15, 0x03000000);
+
+  (void)cpu.execute(1000);
+  CHECK(cpu.idle());
+  REQUIRE(cpu.idle_loops().size() == 1);
+  CHECK(cpu.idle_loops()[0].pc == 0x03000000);
+
+  // The flag is set, so the loop exits
+  mmu.set<u32>(0x03000100, 1);
+  (void)cpu.execute(1000);
+  CHECK_FALSE(cpu.idle());
+}
+
+TEST_CASE("Cpu should not idle in loops polling a timer counter") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  Sound sound{[](auto) {}, cpu.scheduler(), dmas};
+  Timers timers{cpu, sound};
+  mmu.hardware.cpu = &cpu;
+  mmu.hardware.timers = &timers;
+  cpu.set_thumb(true);
+
+  // ldrh r0, [r1]; cmp r0, #0; beq start
+  mmu.set<u16>(0x03000000, 0x8808);
+  mmu.set<u16>(0x03000002, 0x2800);
+  mmu.set<u16>(0x03000004, 0xd0fc);
+  cpu.set_reg(Register::R1, hardware::TM0COUNTER);
+  cpu.set_reg(Register::R15, 0x03000000);
+
+  (void)cpu.execute(1000);
+  CHECK(cpu.idle_loops().size() == 1);
+  CHECK_FALSE(cpu.idle());
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,16 @@
+#pragma once
+#include "gba/block_cache.h"
+#include "types.h"
+
+namespace gb::advance {
+
+// A block is an idle loop when it branches back to its own start and every
+// iteration only depends on memory: it loads, compares and branches, but
+// never stores or carries register state from one iteration to the next.
+// Such a loop can't exit until memory changes, which only happens on an
+// interrupt or another scheduled event. The exception is a loop reading a
+// timer counter, which Cpu checks each time the loop runs.
+[[nodiscard]] bool is_idle_loop(const ArmBlock& block, u32 pc);
+[[nodiscard]] bool is_idle_loop(const ThumbBlock& block, u32 pc);
+
+}  // namespace gb::advance
@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <utility>
 #include "types.h"
 
 namespace gb::advance {
@@ -208,6 +210,34 @@ constexpr u32 POSTFLG = 0x4000300;
 // Undocumented - Power Down Control
 constexpr u32 HALTCNT = 0x4000301;
 constexpr u32 WAVERAM = 0x4000090;
+
+// Every register from 0x04000000 to 0x04000400 and its size in bytes
+inline constexpr std::array<std::pair<u32, u32>, 99> io_register_list = {
+    {{DISPCNT, 2},     {GREENSWAP, 2},   {DISPSTAT, 2},    {VCOUNT, 2},
+     {BG0CNT, 2},      {BG1CNT, 2},      {BG2CNT, 2},      {BG3CNT, 2},
+     {BG0HOFS, 2},     {BG0VOFS, 2},     {BG1HOFS, 2},     {BG1VOFS, 2},
+     {BG2HOFS, 2},     {BG2VOFS, 2},     {BG3HOFS, 2},     {BG3VOFS, 2},
+     {BG2PA, 2},       {BG2PB, 2},       {BG2PC, 2},       {BG2PD, 2},
+     {BG2X, 4},        {BG2Y, 4},        {BG3PA, 2},       {BG3PB, 2},
+     {BG3PC, 2},       {BG3PD, 2},       {BG3X, 4},        {BG3Y, 4},
+     {WIN0H, 2},       {WIN1H, 2},       {WIN0V, 2},       {WIN1V, 2},
+     {WININ, 2},       {WINOUT, 2},      {MOSAIC, 2},      {BLDCNT, 2},
+     {BLDALPHA, 2},    {BLDY, 2},        {SOUND1CNT_L, 2}, {SOUND1CNT_H, 2},
+     {SOUND1CNT_X, 2}, {SOUND2CNT_L, 2}, {SOUND2CNT_H, 2}, {SOUND3CNT_L, 2},
+     {SOUND3CNT_H, 2}, {SOUND3CNT_X, 2}, {SOUND4CNT_L, 2}, {SOUND4CNT_H, 2},
+     {SOUNDCNT_L, 2},  {SOUNDCNT_H, 2},  {SOUNDCNT_X, 2},  {SOUNDBIAS, 2},
+     {FIFO_A, 4},      {FIFO_B, 4},      {DMA0SAD, 4},     {DMA0DAD, 4},
+     {DMA0CNT_L, 2},   {DMA0CNT_H, 2},   {DMA1SAD, 4},     {DMA1DAD, 4},
+     {DMA1CNT_L, 2},   {DMA1CNT_H, 2},   {DMA2SAD, 4},     {DMA2DAD, 4},
+     {DMA2CNT_L, 2},   {DMA2CNT_H, 2},   {DMA3SAD, 4},     {DMA3DAD, 4},
+     {DMA3CNT_L, 2},   {DMA3CNT_H, 2},   {TM0COUNTER, 2},  {TM0CONTROL, 2},
+     {TM1COUNTER, 2},  {TM1CONTROL, 2},  {TM2COUNTER, 2},  {TM2CONTROL, 2},
+     {TM3COUNTER, 2},  {TM3CONTROL, 2},  {SIODATA32, 4},   {SIOMULTI0, 2},
+     {SIOMULTI1, 2},   {SIOMULTI2, 2},   {SIOMULTI3, 2},   {SIOCNT, 2},
+     {SIOMLT_SEND, 2}, {SIODATA8, 2},    {KEYINPUT, 2},    {KEYCNT, 2},
+     {RCNT, 2},        {JOYCNT, 2},      {JOY_RECV, 4},    {JOY_TRANS, 4},
+     {JOYSTAT, 2},     {IE, 2},          {IF, 2},          {WAITCNT, 2},
+     {IME, 2},         {POSTFLG, 1},     {HALTCNT, 1}}};
 }  // namespace hardware
 
 struct IoRegisterResult {
@@ -0,0 +1,878 @@
+#include "gba/jit.h"
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include "gba/cpu.h"
+#include "gba/mmu.h"
+#include "gba/shifter.h"
+
+#if defined(GBEMU_ENABLE_JIT) && defined(__x86_64__) && defined(__unix__)
+#define GBEMU_JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gb::advance {
+
+#ifdef GBEMU_JIT_X86_64
+static constexpr std::size_t CodeBufferSize = 8192_kb;
+#endif
+
+static u32 run_conditional(Cpu& cpu, u32 instruction, InstFunc handler) {
+  if (cpu.condition_passed(instruction)) {
+    return handler(cpu, instruction);
+  }
+  return 0;
+}
+
+static bool block_interrupted(Cpu& cpu, u32 generation, bool thumb) {
+  return cpu.block_interrupted(generation, thumb);
+}
+
+namespace {
+// Register assignment inside compiled blocks (System V):
+//   rbx = Cpu*, r12 = register file, r13d = cycles used, r14d = cycle budget,
+//   r15d = cache generation at entry
+class Emitter {
+ public:
+  void prologue() {
+    // push rbx; push r12; push r13; push r14; push r15
+    bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    // mov rbx, rdi; mov r12, rsi
+    bytes({0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4});
+    // mov r14d, edx; mov r15d, ecx; xor r13d, r13d
+    bytes({0x41, 0x89, 0xd6, 0x41, 0x89, 0xcf, 0x45, 0x31, 0xed});
+  }
+
+  void epilogue() {
+    for (const std::size_t patch : m_exit_patches) {
+      const auto rel = static_cast<s32>(m_code.size() - (patch + 4));
+      std::memcpy(&m_code[patch], &rel, sizeof(rel));
+    }
+    // mov eax, r13d
+    bytes({0x44, 0x89, 0xe8});
+    // pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+    bytes({0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+  }
+
+  // mov dword [r12 + reg * 4], value
+  void store_reg_imm(u32 reg, u32 value) {
+    bytes({0x41, 0xc7, 0x44, 0x24, reg_disp(reg)});
+    imm32(value);
+  }
+
+  // mov eax, [r12 + reg * 4]
+  void load_eax(u32 reg) { bytes({0x41, 0x8b, 0x44, 0x24, reg_disp(reg)}); }
+
+  // mov [r12 + reg * 4], eax
+  void store_eax(u32 reg) { bytes({0x41, 0x89, 0x44, 0x24, reg_disp(reg)}); }
+
+  // add eax, [r12 + reg * 4]
+  void add_eax_reg(u32 reg) { bytes({0x41, 0x03, 0x44, 0x24, reg_disp(reg)}); }
+
+  // add eax, value
+  void add_eax_imm(u32 value) {
+    byte(0x05);
+    imm32(value);
+  }
+
+  // add r13d, cycles
+  void add_cycles(u32 cycles) {
+    bytes({0x41, 0x83, 0xc5, static_cast<u8>(cycles)});
+  }
+
+  // Calls func(cpu, arg1, arg2) and adds the result to the cycle count
+  void call_handler(const void* func, u32 arg1, const void* arg2 = nullptr) {
+    // mov rdi, rbx
+    bytes({0x48, 0x89, 0xdf});
+    // mov esi, arg1
+    byte(0xbe);
+    imm32(arg1);
+    if (arg2 != nullptr) {
+      // mov rdx, arg2
+      bytes({0x48, 0xba});
+      imm64(reinterpret_cast<u64>(arg2));
+    }
+    call(func);
+    // add r13d, eax
+    bytes({0x41, 0x01, 0xc5});
+  }
+
+  // Leaves the block if R15 no longer holds the expected value
+  void exit_if_branched(u32 next_pc) {
+    // cmp dword [r12 + 60], next_pc
+    bytes({0x41, 0x81, 0x7c, 0x24, reg_disp(15)});
+    imm32(next_pc);
+    // jne exit
+    jump_to_exit(0x85);
+  }
+
+  void exit_if_interrupted(bool thumb) {
+    // mov rdi, rbx; mov esi, r15d; mov edx, thumb
+    bytes({0x48, 0x89, 0xdf, 0x44, 0x89, 0xfe, 0xba});
+    imm32(thumb ? 1 : 0);
+    call(reinterpret_cast<const void*>(block_interrupted));
+    // test al, al; jnz exit
+    bytes({0x84, 0xc0});
+    jump_to_exit(0x85);
+  }
+
+  void exit_if_out_of_cycles() {
+    // cmp r13d, r14d; jge exit
+    bytes({0x45, 0x39, 0xf5});
+    jump_to_exit(0x8d);
+  }
+
+  // Offsets of jumps to a position that isn't known yet
+  using Label = std::vector<std::size_t>;
+
+  // jmp label, or jcc label for a condition like 0x85 (jne)
+  void jump(Label& label, u8 condition = 0) {
+    if (condition == 0) {
+      byte(0xe9);
+    } else {
+      bytes({0x0f, condition});
+    }
+    label.push_back(m_code.size());
+    imm32(0);
+  }
+
+  // Points every jump to label at the next instruction
+  void bind(const Label& label) {
+    for (const std::size_t patch : label) {
+      const auto rel = static_cast<s32>(m_code.size() - (patch + 4));
+      std::memcpy(&m_code[patch], &rel, sizeof(rel));
+    }
+  }
+
+  // mov eax, value
+  void mov_eax_imm(u32 value) {
+    byte(0xb8);
+    imm32(value);
+  }
+
+  // test eax, mask
+  void test_eax_imm(u32 mask) {
+    byte(0xa9);
+    imm32(mask);
+  }
+
+  // mov r9d, eax; add r9d, offset
+  void r9d_from_eax(u32 offset) {
+    bytes({0x41, 0x89, 0xc1});
+    if (offset != 0) {
+      bytes({0x41, 0x81, 0xc1});
+      imm32(offset);
+    }
+  }
+
+  // mov [r12 + reg * 4], r9d
+  void store_r9d(u32 reg) { bytes({0x45, 0x89, 0x4c, 0x24, reg_disp(reg)}); }
+
+  // Jumps to label unless bit (eax >> 24) of regions is set
+  void jump_unless_region(u32 regions, Label& label) {
+    // mov ecx, eax; shr ecx, 24; mov edx, regions; bt edx, ecx; jnc label
+    bytes({0x89, 0xc1, 0xc1, 0xe9, 0x18, 0xba});
+    imm32(regions);
+    bytes({0x0f, 0xa3, 0xca});
+    jump(label, 0x83);
+  }
+
+  // rsi = base; ecx = eax
+  void use_host_base(const u8* base) {
+    bytes({0x48, 0xbe});
+    imm64(reinterpret_cast<u64>(base));
+    bytes({0x89, 0xc1});
+  }
+
+  // rdx = &pages[eax >> page_shift]
+  void lookup_page(const void* pages, u32 page_shift, u32 page_size) {
+    // mov ecx, eax; shr ecx, page_shift
+    bytes({0x89, 0xc1, 0xc1, 0xe9, static_cast<u8>(page_shift)});
+    // imul rcx, rcx, page_size
+    bytes({0x48, 0x69, 0xc9});
+    imm32(page_size);
+    // mov rdx, pages; add rdx, rcx
+    bytes({0x48, 0xba});
+    imm64(reinterpret_cast<u64>(pages));
+    bytes({0x48, 0x01, 0xca});
+  }
+
+  // rsi = [rdx + pointer]; ecx = eax & [rdx + mask], or jumps to unmapped
+  // if the pointer is null
+  void resolve_page(u8 pointer, u8 mask, Label& unmapped) {
+    // mov rsi, [rdx + pointer]; test rsi, rsi; jz unmapped
+    bytes({0x48, 0x8b, 0x72, pointer, 0x48, 0x85, 0xf6});
+    jump(unmapped, 0x84);
+    // mov ecx, eax; and ecx, [rdx + mask]
+    bytes({0x89, 0xc1, 0x23, 0x4a, mask});
+  }
+
+  // Jumps to label if the byte at [rdx + flag] is set
+  void jump_if_page_flag(u8 flag, Label& label) {
+    // cmp byte [rdx + flag], 0; jne label
+    bytes({0x80, 0x7a, flag, 0x00});
+    jump(label, 0x85);
+  }
+
+  // Jumps to label if the code page holding [rsi + rcx] has blocks in it.
+  // The page's first code page is at [rdx + first_code_page].
+  void jump_if_code_page(u8 first_code_page,
+                         const bool* code_pages,
+                         u32 code_page_shift,
+                         Label& label) {
+    Label no_code;
+    // mov r8d, [rdx + first_code_page]; cmp r8d, -1; je no_code
+    bytes({0x44, 0x8b, 0x42, first_code_page, 0x41, 0x83, 0xf8, 0xff});
+    jump(no_code, 0x84);
+    // mov edi, ecx; shr edi, code_page_shift; add edi, r8d
+    bytes({0x89, 0xcf, 0xc1, 0xef, static_cast<u8>(code_page_shift), 0x44,
+           0x01, 0xc7});
+    // mov r8, code_pages; cmp byte [r8 + rdi], 0; jne label
+    bytes({0x49, 0xb8});
+    imm64(reinterpret_cast<u64>(code_pages));
+    bytes({0x41, 0x80, 0x3c, 0x38, 0x00});
+    jump(label, 0x85);
+    bind(no_code);
+  }
+
+  // Adds the u32 entries at table + (eax >> 24) * row_size + offset for each
+  // offset to the cycle count
+  void add_cycles_from_table(const void* table,
+                             u32 row_size,
+                             std::initializer_list<u8> offsets) {
+    // mov edi, eax; shr edi, 24; imul edi, edi, row_size
+    bytes({0x89, 0xc7, 0xc1, 0xef, 0x18, 0x6b, 0xff,
+           static_cast<u8>(row_size)});
+    // mov r8, table
+    bytes({0x49, 0xb8});
+    imm64(reinterpret_cast<u64>(table));
+    for (const u8 offset : offsets) {
+      // add r13d, [r8 + rdi + offset]
+      bytes({0x45, 0x03, 0x6c, 0x38, offset});
+    }
+  }
+
+  // mov/movzx/movsx eax, [rsi + rcx]
+  void load_host(u32 size, bool sign_extend) {
+    switch (size) {
+      case 1:
+        bytes({0x0f, static_cast<u8>(sign_extend ? 0xbe : 0xb6), 0x04, 0x0e});
+        break;
+      case 2:
+        bytes({0x0f, static_cast<u8>(sign_extend ? 0xbf : 0xb7), 0x04, 0x0e});
+        break;
+      default:
+        bytes({0x8b, 0x04, 0x0e});
+        break;
+    }
+  }
+
+  // Stores the low size bytes of the register at [rsi + rcx]
+  void store_host(u32 size, u32 reg) {
+    // mov edx, [r12 + reg * 4]
+    bytes({0x41, 0x8b, 0x54, 0x24, reg_disp(reg)});
+    switch (size) {
+      case 1:
+        // mov [rsi + rcx], dl
+        bytes({0x88, 0x14, 0x0e});
+        break;
+      case 2:
+        // mov [rsi + rcx], dx
+        bytes({0x66, 0x89, 0x14, 0x0e});
+        break;
+      default:
+        // mov [rsi + rcx], edx
+        bytes({0x89, 0x14, 0x0e});
+        break;
+    }
+  }
+
+  [[nodiscard]] const std::vector<u8>& code() const noexcept { return m_code; }
+
+ private:
+  [[nodiscard]] static constexpr u8 reg_disp(u32 reg) {
+    return static_cast<u8>(reg * sizeof(u32));
+  }
+
+  void call(const void* func) {
+    // mov rax, func; call rax
+    bytes({0x48, 0xb8});
+    imm64(reinterpret_cast<u64>(func));
+    bytes({0xff, 0xd0});
+  }
+
+  void jump_to_exit(u8 condition) {
+    bytes({0x0f, condition});
+    m_exit_patches.push_back(m_code.size());
+    imm32(0);
+  }
+
+  void byte(u8 value) { m_code.push_back(value); }
+
+  void bytes(std::initializer_list<u8> values) {
+    m_code.insert(m_code.end(), values);
+  }
+
+  void imm32(u32 value) {
+    for (u32 i = 0; i < 4; ++i) {
+      byte(static_cast<u8>(value >> (i * 8)));
+    }
+  }
+
+  void imm64(u64 value) {
+    imm32(static_cast<u32>(value));
+    imm32(static_cast<u32>(value >> 32));
+  }
+
+  std::vector<u8> m_code;
+  std::vector<std::size_t> m_exit_patches;
+};
+
+// A load or store of a general register that can run inline
+struct MemoryAccess {
+  static constexpr u32 NoRegister = 16;
+
+  u32 size = 4;
+  bool load = true;
+  bool sign_extend = false;
+  u32 data_reg = 0;
+  // The address is base_reg + offset_reg or base_reg + offset. Without a
+  // base register it is offset alone.
+  u32 base_reg = NoRegister;
+  u32 offset_reg = NoRegister;
+  u32 offset = 0;
+  // ARM only. Post-indexed accesses use the base and always write back.
+  bool post_index = false;
+  bool write_back = false;
+};
+
+std::optional<MemoryAccess> decode_memory_access(u16 instruction,
+                                                 u32 next_pc) {
+  constexpr u32 SP = 13;
+  const u32 low_reg = instruction & 0b111;
+  const u32 base_reg = (instruction >> 3) & 0b111;
+  const u32 imm5 = (instruction >> 6) & 0b11111;
+  const bool load = test_bit(instruction, 11);
+
+  // PC-relative load, R15 reads as the address of the next instruction + 2
+  if ((instruction & 0xf800) == 0x4800) {
+    MemoryAccess access;
+    access.data_reg = (instruction >> 8) & 0b111;
+    access.offset = ((next_pc + 2) & ~0b10) + ((instruction & 0xff) << 2);
+    return access;
+  }
+
+  // Register offset, with sign extension if bit 9 is set
+  if ((instruction & 0xf000) == 0x5000) {
+    MemoryAccess access;
+    access.data_reg = low_reg;
+    access.base_reg = base_reg;
+    access.offset_reg = (instruction >> 6) & 0b111;
+    if (test_bit(instruction, 9)) {
+      // STRH, LDRH, LDSB, LDSH
+      const bool sign_extend = test_bit(instruction, 10);
+      access.size = sign_extend && !load ? 1 : 2;
+      access.load = sign_extend || load;
+      access.sign_extend = sign_extend;
+    } else {
+      access.size = test_bit(instruction, 10) ? 1 : 4;
+      access.load = load;
+    }
+    return access;
+  }
+
+  // Immediate offset, words and bytes
+  if ((instruction & 0xe000) == 0x6000) {
+    const bool byte_transfer = test_bit(instruction, 12);
+    MemoryAccess access;
+    access.size = byte_transfer ? 1 : 4;
+    access.load = load;
+    access.data_reg = low_reg;
+    access.base_reg = base_reg;
+    access.offset = byte_transfer ? imm5 : imm5 << 2;
+    return access;
+  }
+
+  // Immediate offset, halfwords
+  if ((instruction & 0xf000) == 0x8000) {
+    MemoryAccess access;
+    access.size = 2;
+    access.load = load;
+    access.data_reg = low_reg;
+    access.base_reg = base_reg;
+    access.offset = imm5 << 1;
+    return access;
+  }
+
+  // SP-relative
+  if ((instruction & 0xf000) == 0x9000) {
+    MemoryAccess access;
+    access.load = load;
+    access.data_reg = (instruction >> 8) & 0b111;
+    access.base_reg = SP;
+    access.offset = (instruction & 0xff) << 2;
+    return access;
+  }
+
+  return std::nullopt;
+}
+
+std::optional<MemoryAccess> decode_memory_access(u32 instruction,
+                                                 u32 next_pc) {
+  // Unconditional LDR, STR, LDRB and STRB with an immediate offset
+  if ((instruction & 0xfe000000) != 0xe4000000) {
+    return std::nullopt;
+  }
+  const bool preindex = test_bit(instruction, 24);
+  const bool add_offset = test_bit(instruction, 23);
+  const u32 base_reg = (instruction >> 16) & 0xf;
+  const u32 data_reg = (instruction >> 12) & 0xf;
+  const u32 offset = add_offset ? instruction & 0xfff : -(instruction & 0xfff);
+
+  MemoryAccess access;
+  access.size = test_bit(instruction, 22) ? 1 : 4;
+  access.load = test_bit(instruction, 20);
+  access.data_reg = data_reg;
+  access.post_index = !preindex;
+  access.write_back = !preindex || test_bit(instruction, 21);
+  access.base_reg = base_reg;
+  access.offset = offset;
+
+  if (data_reg == 15) {
+    return std::nullopt;
+  }
+  if (base_reg == 15) {
+    // Writing back to R15 is a branch
+    if (access.write_back) {
+      return std::nullopt;
+    }
+    // R15 reads as the address of the next instruction + 4
+    access.base_reg = MemoryAccess::NoRegister;
+    access.offset = next_pc + 4 + offset;
+  }
+  return access;
+}
+
+// Emits the access for pages that map host memory, charging the same cycles
+// as the handler. Anything else jumps to slow before changing any state.
+void emit_memory_access(Emitter& emitter,
+                        const MemoryAccess& access,
+                        const Mmu& mmu,
+                        Emitter::Label& slow) {
+  using MemoryPage = Mmu::MemoryPage;
+  static_assert(sizeof(WaitStates) == 2 * sizeof(u32));
+  static_assert(offsetof(WaitStates, nonsequential) == 0);
+  static_assert(offsetof(WaitStates, sequential) == sizeof(u32));
+  static_assert(BlockCache::CodePageSize == 1 << 8);
+  static_assert(BlockCache::NoCodePage == 0xffffffff);
+
+  if (access.base_reg == MemoryAccess::NoRegister) {
+    emitter.mov_eax_imm(access.offset);
+  } else {
+    emitter.load_eax(access.base_reg);
+    if (access.offset_reg != MemoryAccess::NoRegister) {
+      emitter.add_eax_reg(access.offset_reg);
+    } else if (!access.post_index && access.offset != 0) {
+      emitter.add_eax_imm(access.offset);
+    }
+  }
+  if (access.write_back) {
+    emitter.r9d_from_eax(access.post_index ? access.offset : 0);
+  }
+
+  // Misaligned accesses rotate, and nothing past 0x0fffffff has pages
+  emitter.test_eax_imm(0xf0000000 | (access.size - 1));
+  emitter.jump(slow, 0x85);
+
+  // Loads from RAM that fastmem maps in full skip the page table. Stores
+  // still need it for VRAM and code pages.
+  Emitter::Label mapped;
+  if (access.load && mmu.fastmem_base() != nullptr) {
+    Emitter::Label not_fastmem;
+    emitter.jump_unless_region(Mmu::FastmemRegions, not_fastmem);
+    emitter.use_host_base(mmu.fastmem_base());
+    emitter.jump(mapped);
+    emitter.bind(not_fastmem);
+  }
+
+  emitter.lookup_page(mmu.pages(), Mmu::PageShift, sizeof(MemoryPage));
+  if (access.load) {
+    emitter.resolve_page(offsetof(MemoryPage, read), offsetof(MemoryPage, mask),
+                         slow);
+  } else {
+    emitter.resolve_page(offsetof(MemoryPage, write),
+                         offsetof(MemoryPage, mask), slow);
+    emitter.jump_if_page_flag(offsetof(MemoryPage, vram), slow);
+    emitter.jump_if_code_page(offsetof(MemoryPage, first_code_page),
+                              mmu.code_pages(), 8, slow);
+  }
+
+  emitter.bind(mapped);
+
+  // 1S + 1N + 1I for loads and 2N for stores, as in load_store_cycles
+  const AccessWidth width = access.size == 1   ? AccessWidth::Byte
+                            : access.size == 2 ? AccessWidth::Halfword
+                                               : AccessWidth::Word;
+  const WaitStates* wait_states =
+      mmu.waitcnt.wait_state_table() + static_cast<u32>(width);
+  if (access.load) {
+    emitter.add_cycles_from_table(wait_states, 3 * sizeof(WaitStates),
+                                  {offsetof(WaitStates, nonsequential),
+                                   offsetof(WaitStates, sequential)});
+    emitter.add_cycles(3);
+  } else {
+    emitter.add_cycles_from_table(wait_states, 3 * sizeof(WaitStates),
+                                  {offsetof(WaitStates, nonsequential)});
+    emitter.add_cycles(2);
+  }
+
+  // Stores write the register's value from before the write back, and a
+  // loaded register wins over the write back
+  if (access.load) {
+    emitter.load_host(access.size, access.sign_extend);
+  } else {
+    emitter.store_host(access.size, access.data_reg);
+  }
+  if (access.write_back) {
+    emitter.store_r9d(access.base_reg);
+  }
+  if (access.load) {
+    emitter.store_eax(access.data_reg);
+  }
+}
+
+// Emits a native translation of the instruction. Returns false if it has to
+// go through the interpreter handler.
+bool emit_native(Emitter& emitter, u16 instruction, u32 next_pc) {
+  // The interpreter reads R15 as the address of the next instruction + 2
+  const u32 r15 = next_pc + 2;
+
+  // Load address
+  if ((instruction & 0xf000) == 0xa000) {
+    const u32 dest_reg = (instruction >> 8) & 0b111;
+    const u32 offset = (instruction & 0xff) << 2;
+    if (test_bit(instruction, 11)) {
+      emitter.load_eax(13);
+      emitter.add_eax_imm(offset);
+      emitter.store_eax(dest_reg);
+    } else {
+      emitter.store_reg_imm(dest_reg, (r15 & ~0b10) + offset);
+    }
+    emitter.add_cycles(1);
+    return true;
+  }
+
+  // Add offset to stack pointer
+  if ((instruction & 0xff00) == 0xb000) {
+    const u32 offset = (instruction & 0b111111) << 2;
+    emitter.load_eax(13);
+    emitter.add_eax_imm(test_bit(instruction, 7) ? -offset : offset);
+    emitter.store_eax(13);
+    emitter.add_cycles(1);
+    return true;
+  }
+
+  // Hi register ADD and MOV, which don't set flags
+  if ((instruction & 0xfc00) == 0x4400) {
+    const u32 op = (instruction >> 8) & 0b11;
+    const u32 src_reg = (instruction >> 3) & 0b1111;
+    const u32 dest_reg = (instruction & 0b111) | ((instruction >> 4) & 0b1000);
+    if ((op != 0b00 && op != 0b10) || dest_reg == 15) {
+      return false;
+    }
+    if (src_reg == 15) {
+      if (op == 0b00) {
+        emitter.load_eax(dest_reg);
+        emitter.add_eax_imm(r15);
+        emitter.store_eax(dest_reg);
+      } else {
+        emitter.store_reg_imm(dest_reg, r15);
+      }
+    } else {
+      emitter.load_eax(src_reg);
+      if (op == 0b00) {
+        emitter.add_eax_reg(dest_reg);
+      }
+      emitter.store_eax(dest_reg);
+    }
+    emitter.add_cycles(2);
+    return true;
+  }
+
+  return false;
+}
+
+bool emit_native(Emitter& emitter, u32 instruction, u32 /*next_pc*/) {
+  // Unconditional MOV, ADD and SUB with an immediate operand and no S bit
+  if ((instruction & 0xfe100000) != 0xe2000000) {
+    return false;
+  }
+  const u32 opcode = (instruction >> 21) & 0xf;
+  const u32 src_reg = (instruction >> 16) & 0xf;
+  const u32 dest_reg = (instruction >> 12) & 0xf;
+  const u32 value = rotr(instruction & 0xff, ((instruction >> 8) & 0xf) * 2);
+
+  if (dest_reg == 15 || src_reg == 15) {
+    return false;
+  }
+  switch (static_cast<Opcode>(opcode)) {
+    case Opcode::Mov:
+      emitter.store_reg_imm(dest_reg, value);
+      break;
+    case Opcode::Add:
+      emitter.load_eax(src_reg);
+      emitter.add_eax_imm(value);
+      emitter.store_eax(dest_reg);
+      break;
+    case Opcode::Sub:
+      emitter.load_eax(src_reg);
+      emitter.add_eax_imm(-value);
+      emitter.store_eax(dest_reg);
+      break;
+    default:
+      return false;
+  }
+  emitter.add_cycles(1);
+  return true;
+}
+
+template <typename BlockType>
+Emitter emit_block(const BlockType& block, u32 pc, const Mmu* mmu) {
+  constexpr bool thumb = std::is_same_v<BlockType, ThumbBlock>;
+  Emitter emitter;
+  emitter.prologue();
+
+  const auto last = block.instructions.size() - 1;
+  for (std::size_t i = 0; i <= last; ++i) {
+    const auto [handler, opcode] = block.instructions[i];
+    pc += sizeof(opcode);
+    emitter.store_reg_imm(15, pc);
+
+    if (emit_native(emitter, opcode, pc)) {
+      if (i != last) {
+        emitter.exit_if_out_of_cycles();
+      }
+      continue;
+    }
+
+    // Memory accesses fall back to the handler
+    Emitter::Label done;
+    const auto access = decode_memory_access(opcode, pc);
+    if (access && mmu != nullptr) {
+      Emitter::Label slow;
+      emit_memory_access(emitter, *access, *mmu, slow);
+      emitter.jump(done);
+      emitter.bind(slow);
+    }
+
+    if constexpr (thumb) {
+      emitter.call_handler(reinterpret_cast<const void*>(handler), opcode);
+    } else if ((opcode >> 28) == static_cast<u32>(Condition::AL)) {
+      emitter.call_handler(reinterpret_cast<const void*>(handler), opcode);
+    } else {
+      emitter.call_handler(reinterpret_cast<const void*>(run_conditional),
+                           opcode, reinterpret_cast<const void*>(handler));
+    }
+    if (i != last) {
+      emitter.exit_if_branched(pc);
+      emitter.exit_if_interrupted(thumb);
+    }
+    emitter.bind(done);
+    if (i != last) {
+      emitter.exit_if_out_of_cycles();
+    }
+  }
+
+  emitter.epilogue();
+  return emitter;
+}
+}  // namespace
+
+#ifdef GBEMU_JIT_X86_64
+// The buffer is never writable and executable at once. finish() makes the
+// pages it copies into writable and flips them back to executable.
+Jit::Jit(const Mmu* mmu) : m_mmu{mmu} {
+  void* code = mmap(nullptr, CodeBufferSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    throw std::runtime_error("failed to map jit code buffer");
+  }
+  m_code = static_cast<u8*>(code);
+}
+
+Jit::~Jit() {
+  munmap(m_code, CodeBufferSize);
+}
+
+bool Jit::supported() noexcept {
+  return true;
+}
+
+CompiledBlock Jit::finish(const std::vector<u8>& code) {
+  if (m_used + code.size() > CodeBufferSize) {
+    return nullptr;
+  }
+  u8* const begin = m_code + m_used;
+
+  const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  const std::size_t first_page = m_used & ~(page_size - 1);
+  const std::size_t end_page =
+      (m_used + code.size() + page_size - 1) & ~(page_size - 1);
+  u8* const pages = m_code + first_page;
+  const std::size_t pages_size = end_page - first_page;
+
+  if (mprotect(pages, pages_size, PROT_READ | PROT_WRITE) != 0) {
+    throw std::runtime_error("failed to make jit code writable");
+  }
+  std::memcpy(begin, code.data(), code.size());
+  if (mprotect(pages, pages_size, PROT_READ | PROT_EXEC) != 0) {
+    throw std::runtime_error("failed to make jit code executable");
+  }
+  // Keep blocks 16 byte aligned
+  m_used = (m_used + code.size() + 15) & ~std::size_t{15};
+  return reinterpret_cast<CompiledBlock>(begin);
+}
+#else
+Jit::Jit(const Mmu* mmu) : m_mmu{mmu} {}
+Jit::~Jit() = default;
+
+bool Jit::supported() noexcept {
+  return false;
+}
+
+CompiledBlock Jit::finish(const std::vector<u8>& /*code*/) {
+  return nullptr;
+}
+#endif
+
+CompiledBlock Jit::compile(const ArmBlock& block, u32 pc) {
+  return finish(emit_block(block, pc, m_mmu).code());
+}
+
+CompiledBlock Jit::compile(const ThumbBlock& block, u32 pc) {
+  return finish(emit_block(block, pc, m_mmu).code());
+}
+
+#ifdef GBEMU_JIT_X86_64
+// Runs the same program on an interpreter and a JIT core in lockstep and
+// compares the register state after every step and RAM at the end.
+static void check_against_interpreter(nonstd::span<const u32> program,
+                                      u32 addr,
+                                      bool thumb,
+                                      int cycle_budget,
+                                      bool verify = false) {
+  Mmu interpreter_mmu;
+  Mmu jit_mmu;
+  Cpu interpreter{interpreter_mmu};
+  Cpu jit{jit_mmu};
+  interpreter_mmu.hardware.cpu = &interpreter;
+  jit_mmu.hardware.cpu = &jit;
+  jit.set_jit_enabled(true);
+  REQUIRE(jit.jit_enabled());
+  jit.set_jit_verification(verify);
+
+  for (auto [mmu, cpu] : {std::pair{&interpreter_mmu, &interpreter},
+                          std::pair{&jit_mmu, &jit}}) {
+    for (s32 i = 0; i < program.ssize(); ++i) {
+      mmu->set<u32>(addr + i * sizeof(u32), program[i]);
+    }
+    cpu->set_thumb(thumb);
+    cpu->set_reg(Register::R13, 0x03007f00);
+    cpu->set_reg(Register::R15, addr);
+  }
+
+  for (int step = 0; step < 1000; ++step) {
+    const u32 interpreter_cycles = interpreter.execute(cycle_budget);
+    const u32 jit_cycles = jit.execute(cycle_budget);
+    REQUIRE(interpreter_cycles == jit_cycles);
+    for (u32 reg = 0; reg < 16; ++reg) {
+      REQUIRE(interpreter.reg(static_cast<Register>(reg)) ==
+              jit.reg(static_cast<Register>(reg)));
+    }
+    REQUIRE(interpreter.program_status().data() ==
+            jit.program_status().data());
+  }
+  CHECK(std::equal(interpreter_mmu.ewram().begin(),
+                   interpreter_mmu.ewram().end(), jit_mmu.ewram().begin()));
+  CHECK(std::equal(interpreter_mmu.iwram().begin(),
+                   interpreter_mmu.iwram().end(), jit_mmu.iwram().begin()));
+}
+
+TEST_CASE("compiled thumb blocks should match the interpreter") {
+  // add r1, sp, #8; sub sp, #8; add sp, #8; mov r2, r8; add r2, pc;
+  // add r0, #1; mov r3, pc; b start
+  static constexpr std::array<u32, 4> program = {
+      0xb082a902, 0x4642b002, 0x3001447a, 0xe7f7467b};
+  check_against_interpreter(program, 0x03000000, true, 0);
+  check_against_interpreter(program, 0x03000000, true, 3);
+  check_against_interpreter(program, 0x03000000, true, 1000);
+}
+
+TEST_CASE("compiled arm blocks should match the interpreter") {
+  static constexpr std::array<u32, 6> program = {
+      0xe3a03c3f,  // mov r3, #0x3f00
+      0xe2834001,  // add r4, r3, #1
+      0xe2445002,  // sub r5, r4, #2
+      0xe2966001,  // adds r6, r6, #1
+      0x12877001,  // addne r7, r7, #1
+      0xeafffff9,  // b start
+  };
+  check_against_interpreter(program, 0x02000000, false, 0);
+  check_against_interpreter(program, 0x02000000, false, 4);
+  check_against_interpreter(program, 0x02000000, false, 1000);
+}
+
+TEST_CASE("compiled thumb loads and stores should match the interpreter") {
+  static constexpr std::array<u32, 10> program = {
+      0x68014807,  // ldr r0, [pc, #28]; ldr r1, [r0]
+      0x60413103,  // add r1, #3; str r1, [r0, #4]
+      0x56c28041,  // strh r1, [r0, #2]; ldsb r2, [r0, r3]
+      0x91015ec4,  // ldsh r4, [r0, r3]; str r1, [sp, #4]
+      0x54c59d01,  // ldr r5, [sp, #4]; strb r5, [r0, r3]
+      0x5ac77946,  // ldrb r6, [r0, #5]; ldrh r7, [r0, r3]
+      0x4a023301,  // add r3, #1; ldr r2, [pc, #8]
+      0xe7ef8812,  // ldrh r2, [r2]; b start
+      0x02000100,
+      0x04000132,  // KEYCNT
+  };
+  check_against_interpreter(program, 0x03000000, true, 0);
+  check_against_interpreter(program, 0x03000000, true, 5);
+  check_against_interpreter(program, 0x03000000, true, 1000);
+  check_against_interpreter(program, 0x03000000, true, 1000, true);
+}
+
+TEST_CASE("compiled arm loads and stores should match the interpreter") {
+  static constexpr std::array<u32, 13> program = {
+      0xe59f0028,  // ldr r0, [pc, #40]
+      0xe5b01004,  // ldr r1, [r0, #4]!
+      0xe2811001,  // add r1, r1, #1
+      0xe4001004,  // str r1, [r0], #-4
+      0xe5c01001,  // strb r1, [r0, #1]
+      0xe5d02001,  // ldrb r2, [r0, #1]
+      0xe5303001,  // ldr r3, [r0, #-1]!
+      0xe5a00008,  // str r0, [r0, #8]!
+      0xe2400008,  // sub r0, r0, #8
+      0xe4904004,  // ldr r4, [r0], #4
+      0xe2400004,  // sub r0, r0, #4
+      0xeafffff3,  // b start
+      0x03001000,
+  };
+  check_against_interpreter(program, 0x02000000, false, 0);
+  check_against_interpreter(program, 0x02000000, false, 6);
+  check_against_interpreter(program, 0x02000000, false, 1000);
+  check_against_interpreter(program, 0x02000000, false, 1000, true);
+}
+
+TEST_CASE("compiled stores should invalidate code they reach") {
+  // ldr r0, [pc, #8]; ldr r1, [pc, #12]; str r1, [r0, r2]; add r2, #4;
+  // add r5, #1; b start. After the block is compiled the store replaces
+  // add r5, #1 with add r6, #1.
+  static constexpr std::array<u32, 5> program = {
+      0x49034802, 0x32045081, 0xe7f93501, 0x03000008 - 400, 0xe7f93601};
+  check_against_interpreter(program, 0x03000000, true, 0);
+  check_against_interpreter(program, 0x03000000, true, 1000);
+}
+#endif
+
+}  // namespace gb::advance
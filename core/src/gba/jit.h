@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "gba/block_cache.h"
+#include "types.h"
+
+namespace gb::advance {
+
+class Mmu;
+
+// Translates hot cached blocks into x86-64. Instructions without a native
+// translation are emitted as calls to their interpreter handler, so every
+// block can be compiled. Loads and stores go through the Mmu page table
+// inline and fall back to their handler for IO, VRAM and code pages.
+class Jit {
+ public:
+  // Number of times a block is interpreted before it gets compiled
+  static constexpr u32 HotThreshold = 64;
+
+  // Without an Mmu every load and store calls its handler
+  explicit Jit(const Mmu* mmu = nullptr);
+  ~Jit();
+  Jit(const Jit&) = delete;
+  Jit& operator=(const Jit&) = delete;
+
+  // False unless built with GBEMU_ENABLE_JIT on an x86-64 unix host
+  [[nodiscard]] static bool supported() noexcept;
+
+  // Returns nullptr once the code buffer is full. Every compiled block must
+  // be dropped before calling reset() to reuse it.
+  [[nodiscard]] CompiledBlock compile(const ArmBlock& block, u32 pc);
+  [[nodiscard]] CompiledBlock compile(const ThumbBlock& block, u32 pc);
+
+  void reset() noexcept { m_used = 0; }
+
+ private:
+  CompiledBlock finish(const std::vector<u8>& code);
+
+  const Mmu* m_mmu = nullptr;
+  u8* m_code = nullptr;
+  std::size_t m_used = 0;
+};
+
+}  // namespace gb::advance
@@ -1,4 +1,5 @@
 #include "gba/lcd.h"
+#include <algorithm>
 #include "gba/cpu.h"
 #include "gba/dma.h"
 #include "gba/gpu.h"
@@ -12,91 +13,76 @@ void Lcd::increment_vcount() {
     dispstat.set_vcount_equals_lyc(true);
 
     if (dispstat.enable_lyc_interrupt()) {
-      m_cpu->interrupts_requested.set_interrupt(Interrupt::VCountMatch, true);
+      m_cpu->request_interrupt(Interrupt::VCountMatch);
     }
   } else {
     dispstat.set_vcount_equals_lyc(false);
   }
 }
 
-bool Lcd::update(u32 cycles, int& next_event_cycles) {
-  bool draw_frame = false;
-  m_cycles += cycles;
+Lcd::Lcd(Cpu& cpu, Dmas& dmas, Gpu& gpu)
+    : m_cpu{&cpu}, m_dmas{&dmas}, m_gpu{&gpu} {
+  Scheduler& scheduler = m_cpu->scheduler();
+  scheduler.set_handler(EventType::Lcd,
+                        [this](u32 late) { on_mode_change(late); });
+  scheduler.schedule(EventType::Lcd, 960);
+}
+
+void Lcd::on_mode_change(u32 late) {
+  u32 next_event_cycles = 0;
 
   switch (m_mode) {
     case Mode::Draw:
-      if (m_cycles >= 960) {
-        m_mode = Mode::HBlank;
-        m_cycles -= 960;
-        // m_next_event_cycles = 272 - m_cycles;
-        m_next_event_cycles = 272;
-
-        if (dispstat.enable_hblank_interrupt()) {
-          m_cpu->interrupts_requested.set_interrupt(Interrupt::HBlank, true);
-        }
-        dispstat.set_hblank(true);
+      m_mode = Mode::HBlank;
+      next_event_cycles = 272;
 
-        for (Dma& dma : m_dmas->span()) {
-          if (dma.control().start_timing() ==
-              Dma::Control::StartTiming::HBlank) {
-            dma.run();
-          }
-        }
+      if (dispstat.enable_hblank_interrupt()) {
+        m_cpu->request_interrupt(Interrupt::HBlank);
       }
+      dispstat.set_hblank(true);
+
+      m_dmas->trigger(Dma::Control::StartTiming::HBlank);
       break;
     case Mode::HBlank:
-      if (m_cycles >= 272) {
-        m_cycles -= 272;
-        if (vcount <= 159) {
-          m_gpu->render_scanline(vcount);
-        }
+      if (vcount <= 159) {
+        m_gpu->render_scanline(vcount);
+      }
 
-        dispstat.set_hblank(false);
-        if (vcount > 159) {
-          for (Dma& dma : m_dmas->span()) {
-            if (dma.control().start_timing() ==
-                Dma::Control::StartTiming::VBlank) {
-              dma.run();
-            }
-          }
-          m_mode = Mode::VBlank;
-          dispstat.set_vblank(true);
-          if (dispstat.enable_vblank_interrupt()) {
-            m_cpu->interrupts_requested.set_interrupt(Interrupt::VBlank, true);
-          }
-          draw_frame = true;
-          // m_next_event_cycles = 1232 - m_cycles;
-          m_next_event_cycles = 1232;
-        } else {
-          m_mode = Mode::Draw;
-          m_next_event_cycles = 960;
-          // m_next_event_cycles = 960 - m_cycles;
+      dispstat.set_hblank(false);
+      if (vcount > 159) {
+        m_dmas->trigger(Dma::Control::StartTiming::VBlank);
+        m_mode = Mode::VBlank;
+        dispstat.set_vblank(true);
+        if (dispstat.enable_vblank_interrupt()) {
+          m_cpu->request_interrupt(Interrupt::VBlank);
         }
-        increment_vcount();
+        m_frame_ready = true;
+        next_event_cycles = 1232;
+      } else {
+        m_mode = Mode::Draw;
+        next_event_cycles = 960;
       }
+      increment_vcount();
       break;
     case Mode::VBlank:
-      if (m_cycles >= 1232) {
-        m_cycles -= 1232;
-        increment_vcount();
+      increment_vcount();
 
-        if (vcount > 227) {
-          m_gpu->bg2.internal_affine_scroll = m_gpu->bg2.affine_scroll;
-          m_gpu->bg3.internal_affine_scroll = m_gpu->bg3.affine_scroll;
-          dispstat.set_hblank(false);
-          dispstat.set_vblank(false);
-          m_mode = Mode::Draw;
-          m_next_event_cycles = 960;
-          // m_next_event_cycles = 960 - m_cycles;
-          vcount = 0;
-        } else {
-          m_next_event_cycles = 1232;
-          // m_next_event_cycles = 1232 - m_cycles;
-        }
+      if (vcount > 227) {
+        m_gpu->bg2.internal_affine_scroll = m_gpu->bg2.affine_scroll;
+        m_gpu->bg3.internal_affine_scroll = m_gpu->bg3.affine_scroll;
+        dispstat.set_hblank(false);
+        dispstat.set_vblank(false);
+        m_mode = Mode::Draw;
+        next_event_cycles = 960;
+        vcount = 0;
+      } else {
+        next_event_cycles = 1232;
       }
       break;
   }
-  next_event_cycles = std::min(next_event_cycles, m_next_event_cycles);
-  return draw_frame;
+
+  // A late event shortens the next period, so lines stay 1232 cycles long
+  const u32 elapsed = std::min(late, next_event_cycles);
+  m_cpu->scheduler().schedule(EventType::Lcd, next_event_cycles - elapsed);
 }
 }  // namespace gb::advance
@@ -1,4 +1,5 @@
 #pragma once
+#include <utility>
 #include "utils.h"
 
 namespace gb::advance {
@@ -37,20 +38,24 @@ class Lcd {
  public:
   enum class Mode { Draw, HBlank, VBlank };
 
-  Lcd(Cpu& cpu, Dmas& dmas, Gpu& gpu)
-      : m_cpu{&cpu}, m_dmas{&dmas}, m_gpu{&gpu} {}
+  Lcd(Cpu& cpu, Dmas& dmas, Gpu& gpu);
 
   DispStat dispstat{0};
   u32 vcount = 0;
 
-  bool update(u32 cycles, int& next_event_cycles);
+  // True once per frame, after entering VBlank
+  [[nodiscard]] bool take_frame() {
+    return std::exchange(m_frame_ready, false);
+  }
 
  private:
   void increment_vcount();
 
-  int m_cycles = 0;
-  int m_next_event_cycles = 960;
+  // Runs the mode change that was due late cycles ago
+  void on_mode_change(u32 late);
+
   Mode m_mode = Mode::Draw;
+  bool m_frame_ready = false;
   Cpu* m_cpu;
   Dmas* m_dmas;
   Gpu* m_gpu;
@@ -0,0 +1,535 @@
+#include "gba/m4a.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include "gba/cpu.h"
+#include "gba/mmu.h"
+#include "utils.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace gb::advance::hle::m4a {
+namespace {
+constexpr int Any = -1;
+
+// SoundMain's lock check and prologue:
+//   ldr r0, =SOUND_INFO_PTR; ldr r0, [r0]; ldr r2, =ID_NUMBER
+//   ldr r3, [r0]; cmp r2, r3; beq 1f; bx lr
+//   1: adds r3, 1; str r3, [r0]; push {r4-r7, lr}
+//   mov r1, r8; mov r2, r9; mov r3, r10; mov r4, r11
+//   push {r0-r4}; sub sp, 0x18
+constexpr std::array<int, 32> SoundMainSignature = {
+    Any,  0x48, 0x00, 0x68, Any,  0x4a, 0x03, 0x68, 0x9a, 0x42, 0x00,
+    0xd0, 0x70, 0x47, 0x01, 0x33, 0x03, 0x60, 0xf0, 0xb5, 0x41, 0x46,
+    0x4a, 0x46, 0x53, 0x46, 0x5c, 0x46, 0x1f, 0xb4, 0x86, 0xb0};
+
+// ldrb r3, [r0, 5]; cmp r3, 0; beq no_reverb; adr r1, reverb; bx r1
+constexpr std::array<int, 10> SoundMainRamSignature = {
+    0x43, 0x79, 0x00, 0x2b, Any, 0xd0, Any, 0xa1, 0x08, 0x47};
+
+// SoundMainRAM comes right after SoundMain and its literal pool
+constexpr u32 SoundMainRamSearchRange = 0x400;
+
+constexpr u32 IdNumber = 0x68736d53;
+
+// SoundInfo
+constexpr u32 PcmDmaCounter = 0x04;
+constexpr u32 Reverb = 0x05;
+constexpr u32 MaxChannels = 0x06;
+constexpr u32 MasterVolume = 0x07;
+constexpr u32 PcmDmaPeriod = 0x0b;
+constexpr u32 PcmSamplesPerVBlank = 0x10;
+constexpr u32 DivFreq = 0x18;
+constexpr u32 Channels = 0x50;
+constexpr u32 PcmBuffer = 0x350;
+constexpr u32 ChannelCount = 12;
+// Per side, right then left
+constexpr u32 PcmBufferSize = 0x630;
+constexpr u32 SoundInfoSize = PcmBuffer + PcmBufferSize * 2;
+
+// WaveData
+constexpr u32 WaveStatus = 0x02;
+constexpr u32 WaveLoopStart = 0x08;
+constexpr u32 WaveSize = 0x0c;
+constexpr u32 WaveSamples = 0x10;
+
+struct SoundChannel {
+  u8 status;
+  u8 type;
+  u8 right_volume;
+  u8 left_volume;
+  u8 attack;
+  u8 decay;
+  u8 sustain;
+  u8 release;
+  u8 key;
+  u8 envelope_volume;
+  u8 envelope_volume_right;
+  u8 envelope_volume_left;
+  u8 echo_volume;
+  u8 echo_length;
+  std::array<u8, 10> unused0;
+  // Samples left in the wave, or where to start it until the channel starts
+  s32 count;
+  // Fraction of a sample, in 23 bits
+  u32 fw;
+  u32 frequency;
+  u32 wave;
+  u32 current;
+  std::array<u8, 20> unused1;
+};
+static_assert(sizeof(SoundChannel) == 0x40);
+
+// SoundChannel status
+constexpr u8 Start = 0x80;
+constexpr u8 Stop = 0x40;
+constexpr u8 Loop = 0x10;
+constexpr u8 Echo = 0x04;
+constexpr u8 EnvelopeMask = 0x03;
+constexpr u8 Attack = 0x03;
+constexpr u8 Decay = 0x02;
+constexpr u8 On = Start | Stop | Echo | EnvelopeMask;
+
+// SoundChannel type, the wave plays one sample per output sample
+constexpr u8 FixedFrequency = 0x08;
+// Wave types of newer drivers that mix_channel doesn't decode
+constexpr u8 Reverse = 0x10;
+constexpr u8 Compressed = 0x20;
+
+template <std::size_t Size>
+std::optional<u32> find_signature(nonstd::span<const u8> rom,
+                                  const std::array<int, Size>& signature,
+                                  u32 begin,
+                                  u32 end) {
+  const auto matches = [](u8 byte, int pattern) {
+    return pattern == Any || byte == pattern;
+  };
+  end = std::min(end, static_cast<u32>(rom.size()));
+  for (auto it = rom.begin() + begin; it != rom.begin() + end; ++it) {
+    it = std::search(it, rom.begin() + end, signature.begin(),
+                     signature.end(), matches);
+    if (it == rom.begin() + end) {
+      break;
+    }
+    // Thumb code is halfword aligned
+    if (const auto offset = static_cast<u32>(it - rom.begin());
+        offset % 2 == 0) {
+      return offset;
+    }
+  }
+  return std::nullopt;
+}
+
+// Steps the ADSR envelope, starting the channel first if it was just keyed.
+// Returns false once the channel stops.
+bool update_envelope(Mmu& mmu, SoundChannel& channel, u32 master_volume) {
+  u32 volume = channel.envelope_volume;
+  bool attack = false;
+
+  if ((channel.status & Start) != 0) {
+    if ((channel.status & Stop) != 0) {
+      channel.status = 0;
+      return false;
+    }
+    const u32 samples = channel.wave + WaveSamples;
+    const bool looped = (mmu.at<u16>(channel.wave + WaveStatus) & 0xc000) != 0;
+    channel.status = Attack | (looped ? Loop : 0);
+    channel.current = samples + static_cast<u32>(channel.count);
+    channel.count = static_cast<s32>(mmu.at<u32>(channel.wave + WaveSize)) -
+                    channel.count;
+    channel.fw = 0;
+    volume = 0;
+    attack = true;
+  } else if ((channel.status & Echo) != 0) {
+    if (--channel.echo_length == 0) {
+      channel.status = 0;
+      return false;
+    }
+  } else if ((channel.status & Stop) != 0) {
+    volume = volume * channel.release >> 8;
+    if (volume <= channel.echo_volume) {
+      // Fades out at the echo volume for echo_length frames
+      volume = channel.echo_volume;
+      if (volume == 0) {
+        channel.status = 0;
+        return false;
+      }
+      channel.status |= Echo;
+    }
+  } else if ((channel.status & EnvelopeMask) == Decay) {
+    volume = volume * channel.decay >> 8;
+    if (volume <= channel.sustain) {
+      volume = channel.sustain;
+      if (volume == 0) {
+        channel.status = 0;
+        return false;
+      }
+      --channel.status;
+    }
+  } else if ((channel.status & EnvelopeMask) == Attack) {
+    attack = true;
+  }
+
+  if (attack) {
+    volume += channel.attack;
+    if (volume >= 0xff) {
+      volume = 0xff;
+      --channel.status;
+    }
+  }
+
+  channel.envelope_volume = static_cast<u8>(volume);
+  const u32 scaled = volume * (master_volume + 1) >> 4;
+  channel.envelope_volume_right =
+      static_cast<u8>(channel.right_volume * scaled >> 8);
+  channel.envelope_volume_left =
+      static_cast<u8>(channel.left_volume * scaled >> 8);
+  return true;
+}
+
+// Adds samples scaled by each side's volume to the mix, 8 at a time where
+// SSE2 is available. Everything fits in 16 bits: samples are 8 bit and the
+// volumes are at most 255.
+void accumulate(const s16* samples,
+                u32 count,
+                s16 right_volume,
+                s16 left_volume,
+                s16* right,
+                s16* left) {
+  u32 i = 0;
+#ifdef __SSE2__
+  const __m128i right_scale = _mm_set1_epi16(right_volume);
+  const __m128i left_scale = _mm_set1_epi16(left_volume);
+  for (; i + 8 <= count; i += 8) {
+    const __m128i sample =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    auto* const right_out = reinterpret_cast<__m128i*>(right + i);
+    auto* const left_out = reinterpret_cast<__m128i*>(left + i);
+    _mm_storeu_si128(
+        right_out,
+        _mm_add_epi16(_mm_loadu_si128(right_out),
+                      _mm_srai_epi16(_mm_mullo_epi16(sample, right_scale), 8)));
+    _mm_storeu_si128(
+        left_out,
+        _mm_add_epi16(_mm_loadu_si128(left_out),
+                      _mm_srai_epi16(_mm_mullo_epi16(sample, left_scale), 8)));
+  }
+#endif
+  for (; i < count; ++i) {
+    right[i] = static_cast<s16>(right[i] + (samples[i] * right_volume >> 8));
+    left[i] = static_cast<s16>(left[i] + (samples[i] * left_volume >> 8));
+  }
+}
+
+// Resamples the channel's wave with linear interpolation and mixes it in
+void mix_channel(Mmu& mmu,
+                 SoundChannel& channel,
+                 u32 div_freq,
+                 u32 sample_count,
+                 s16* right,
+                 s16* left) {
+  const u32 samples_addr = channel.wave + WaveSamples;
+  const u32 size = mmu.at<u32>(channel.wave + WaveSize);
+  const u32 loop_start = mmu.at<u32>(channel.wave + WaveLoopStart);
+  const auto [storage, offset] = mmu.select_storage(samples_addr);
+  const u8* const samples = storage.data() + offset;
+  const u32 available = static_cast<u32>(storage.size()) - offset;
+  const auto sample_at = [samples, available](u32 index) -> s32 {
+    return index < available ? static_cast<s8>(samples[index]) : 0;
+  };
+
+  const u32 step = (channel.type & FixedFrequency) != 0
+                       ? 1 << 23
+                       : channel.frequency * div_freq;
+  u32 position = channel.current - samples_addr;
+  s32 count = channel.count;
+  u32 fw = channel.fw;
+
+  std::array<s16, PcmBufferSize> resampled;
+  u32 produced = 0;
+  while (produced < sample_count) {
+    const s32 current = sample_at(position);
+    const s32 next = sample_at(position + 1);
+    resampled[produced++] =
+        static_cast<s16>(current + ((next - current) * static_cast<s32>(fw) >>
+                                    23));
+
+    fw += step;
+    const u32 advance = fw >> 23;
+    fw &= 0x7fffff;
+    position += advance;
+    count -= static_cast<s32>(advance);
+    if (count > 0) {
+      continue;
+    }
+    if ((channel.status & Loop) == 0 || size <= loop_start) {
+      channel.status = 0;
+      break;
+    }
+    while (count <= 0) {
+      count += static_cast<s32>(size - loop_start);
+    }
+    position = size - static_cast<u32>(count);
+  }
+
+  channel.count = count;
+  channel.fw = fw;
+  channel.current = samples_addr + position;
+  accumulate(resampled.data(), produced, channel.envelope_volume_right,
+             channel.envelope_volume_left, right, left);
+}
+}  // namespace
+
+std::optional<Engine> find_engine(nonstd::span<const u8> rom) {
+  const auto sound_main = find_signature(
+      rom, SoundMainSignature, 0, static_cast<u32>(rom.size()));
+  if (!sound_main) {
+    return std::nullopt;
+  }
+  const u32 after = *sound_main + SoundMainSignature.size();
+  const auto sound_main_ram =
+      find_signature(rom, SoundMainRamSignature, after,
+                     after + SoundMainRamSearchRange);
+  if (!sound_main_ram) {
+    return std::nullopt;
+  }
+  return Engine{*sound_main, *sound_main_ram};
+}
+
+bool install(nonstd::span<u8> rom) {
+  const auto engine = find_engine(rom);
+  if (!engine) {
+    return false;
+  }
+  rom[engine->sound_main_ram] = SoundMainRamSwi;
+  rom[engine->sound_main_ram + 1] = 0xdf;
+  return true;
+}
+
+bool mix(Mmu& mmu, u32 sound_info) {
+  const auto [storage, offset] = mmu.select_storage(sound_info);
+  if (offset + SoundInfoSize > storage.size()) {
+    return false;
+  }
+  u8* const info = storage.data() + offset;
+
+  const u32 channel_count = std::min<u32>(info[MaxChannels], ChannelCount);
+  for (u32 i = 0; i < channel_count; ++i) {
+    const u8* const channel_data = info + Channels + i * sizeof(SoundChannel);
+    if ((channel_data[offsetof(SoundChannel, status)] & On) != 0 &&
+        (channel_data[offsetof(SoundChannel, type)] & (Reverse | Compressed)) !=
+            0) {
+      return false;
+    }
+  }
+
+  u32 samples_per_vblank;
+  u32 div_freq;
+  std::memcpy(&samples_per_vblank, info + PcmSamplesPerVBlank, sizeof(u32));
+  std::memcpy(&div_freq, info + DivFreq, sizeof(u32));
+
+  // The DMA plays the buffer a segment per frame, so this frame fills the
+  // segment after the one playing
+  const u32 counter = info[PcmDmaCounter];
+  const u32 period = info[PcmDmaPeriod];
+  const u32 segment =
+      counter > 1 ? (period - counter + 1) * samples_per_vblank : 0;
+  if (samples_per_vblank == 0 ||
+      segment + samples_per_vblank > PcmBufferSize) {
+    return true;
+  }
+  u8* const right = info + PcmBuffer + segment;
+  u8* const left = right + PcmBufferSize;
+
+  std::array<s16, PcmBufferSize> right_mix{};
+  std::array<s16, PcmBufferSize> left_mix{};
+
+  // Reverb feeds back both sides of the segment that played a whole buffer
+  // ago, which is the one after this
+  if (const u32 reverb = info[Reverb]; reverb != 0) {
+    const u32 echo_segment = counter == 2 ? 0 : segment + samples_per_vblank;
+    if (echo_segment + samples_per_vblank <= PcmBufferSize) {
+      const u8* const echo_right = info + PcmBuffer + echo_segment;
+      const u8* const echo_left = echo_right + PcmBufferSize;
+      for (u32 i = 0; i < samples_per_vblank; ++i) {
+        const s32 sum = static_cast<s8>(right[i]) + static_cast<s8>(left[i]) +
+                        static_cast<s8>(echo_right[i]) +
+                        static_cast<s8>(echo_left[i]);
+        s32 value = sum * static_cast<s32>(reverb) >> 9;
+        if ((value & 0x80) != 0) {
+          ++value;
+        }
+        right_mix[i] = static_cast<s16>(value);
+        left_mix[i] = static_cast<s16>(value);
+      }
+    }
+  }
+
+  for (u32 i = 0; i < channel_count; ++i) {
+    u8* const channel_data = info + Channels + i * sizeof(SoundChannel);
+    SoundChannel channel;
+    std::memcpy(&channel, channel_data, sizeof(channel));
+    if ((channel.status & On) == 0) {
+      continue;
+    }
+    if (update_envelope(mmu, channel, info[MasterVolume])) {
+      mix_channel(mmu, channel, div_freq, samples_per_vblank,
+                  right_mix.data(), left_mix.data());
+    }
+    std::memcpy(channel_data, &channel, sizeof(channel));
+  }
+
+  // The driver adds into the bytes, so the mix wraps rather than clipping
+  for (u32 i = 0; i < samples_per_vblank; ++i) {
+    right[i] = static_cast<u8>(right_mix[i]);
+    left[i] = static_cast<u8>(left_mix[i]);
+  }
+  // The channels and the PCM buffer were written behind the Mmu's back
+  mmu.notify_write(sound_info, SoundInfoSize);
+  return true;
+}
+
+void sound_main_ram(Cpu& cpu) {
+  Mmu& mmu = *cpu.mmu();
+  const u32 sp = cpu.reg(Register::R13);
+
+  // SoundMain saved the SoundInfo pointer above its locals
+  const u32 sound_info = mmu.at<u32>(sp + 0x18);
+  if (!mix(mmu, sound_info)) {
+    // Run the instruction the trap replaced, ldrb r3, [r0, 5], and carry on
+    // into the driver's mixer
+    cpu.set_reg(Register::R3, mmu.at<u8>(cpu.reg(Register::R0) + Reverb));
+    return;
+  }
+  mmu.set<u32>(sound_info, IdNumber);
+
+  // SoundMain's epilogue: add sp, 0x1c; pop {r0-r3} into r8-r11;
+  // pop {r4-r7}; pop {r3}; bx r3
+  for (u32 i = 0; i < 4; ++i) {
+    cpu.set_reg(static_cast<Register>(8 + i), mmu.at<u32>(sp + 0x1c + i * 4));
+    cpu.set_reg(static_cast<Register>(4 + i), mmu.at<u32>(sp + 0x2c + i * 4));
+  }
+  const u32 return_addr = mmu.at<u32>(sp + 0x3c);
+  cpu.set_reg(Register::R3, return_addr);
+  cpu.set_reg(Register::R13, sp + 0x40);
+  cpu.set_thumb(gb::test_bit(return_addr, 0));
+  cpu.set_reg(Register::R15, return_addr);
+}
+
+TEST_CASE("m4a mix should play a PCM channel until its wave ends") {
+  Mmu mmu;
+  constexpr u32 info = Mmu::IWramBegin + 0x1000;
+  constexpr u32 wave = Mmu::EWramBegin;
+  mmu.set<u8>(info + MaxChannels, 1);
+  mmu.set<u8>(info + MasterVolume, 15);
+  mmu.set<u32>(info + PcmSamplesPerVBlank, 32);
+
+  // 16 samples of 100 that don't loop
+  mmu.set<u32>(wave + WaveSize, 16);
+  for (u32 i = 0; i < 16; ++i) {
+    mmu.set<u8>(wave + WaveSamples + i, 100);
+  }
+
+  constexpr u32 channel = info + Channels;
+  mmu.set<u8>(channel + 0x00, Start);
+  mmu.set<u8>(channel + 0x01, FixedFrequency);
+  mmu.set<u8>(channel + 0x02, 128);
+  mmu.set<u8>(channel + 0x03, 64);
+  mmu.set<u8>(channel + 0x04, 0xff);
+  mmu.set<u32>(channel + 0x24, wave);
+  const u32 buffer_page = BlockCache::code_page(info + PcmBuffer);
+  mmu.mark_code_page(buffer_page);
+
+  CHECK(mix(mmu, info));
+  CHECK_FALSE(mmu.code_pages()[buffer_page]);
+
+  // The attack reaches full volume straight away
+  const std::array<s8, 2> expected = {100 * (128 * 255 >> 8) >> 8,
+                                      100 * (64 * 255 >> 8) >> 8};
+  for (u32 i = 0; i < 32; ++i) {
+    const bool playing = i < 16;
+    CHECK(mmu.at<s8>(info + PcmBuffer + i) == (playing ? expected[0] : 0));
+    CHECK(mmu.at<s8>(info + PcmBuffer + PcmBufferSize + i) ==
+          (playing ? expected[1] : 0));
+  }
+  CHECK(mmu.at<u8>(channel) == 0);
+}
+
+TEST_CASE("m4a should leave reversed and compressed waves to the driver") {
+  for (const u8 type : {Reverse, Compressed, u8{Reverse | Compressed}}) {
+    Mmu mmu;
+    Cpu cpu{mmu};
+    constexpr u32 sp = Mmu::IWramBegin + 0x7e00;
+    constexpr u32 info = Mmu::IWramBegin + 0x1000;
+    constexpr u32 channel = info + Channels;
+    mmu.set<u8>(info + Reverb, 7);
+    mmu.set<u8>(info + MaxChannels, 1);
+    mmu.set<u32>(info + PcmSamplesPerVBlank, 32);
+    mmu.set<u8>(channel + 0x00, Start);
+    mmu.set<u8>(channel + 0x01, type);
+    mmu.set<u32>(channel + 0x24, Mmu::EWramBegin);
+
+    CHECK_FALSE(mix(mmu, info));
+    CHECK(mmu.at<u8>(channel) == Start);
+
+    // The trap runs ldrb r3, [r0, 5] and falls through into SoundMainRAM
+    mmu.set<u32>(sp + 0x18, info);
+    cpu.set_reg(Register::R0, info);
+    cpu.set_reg(Register::R13, sp);
+    const u32 pc = cpu.reg(Register::R15);
+    sound_main_ram(cpu);
+    CHECK(cpu.reg(Register::R3) == 7);
+    CHECK(cpu.reg(Register::R13) == sp);
+    CHECK(cpu.reg(Register::R15) == pc);
+    CHECK(mmu.at<u32>(info) != IdNumber);
+  }
+}
+
+TEST_CASE("m4a should leave a SoundInfo it can't reach to the driver") {
+  Mmu mmu;
+  // Runs past the end of IWRAM into its mirror
+  CHECK_FALSE(mix(mmu, Mmu::IWramBegin + 0x8000 - 0x100));
+}
+
+TEST_CASE("m4a install should trap SoundMainRAM and return from SoundMain") {
+  std::vector<u8> rom(0x200);
+  std::transform(SoundMainSignature.begin(), SoundMainSignature.end(),
+                 rom.begin() + 0x40,
+                 [](int byte) { return static_cast<u8>(byte); });
+  std::transform(SoundMainRamSignature.begin(), SoundMainRamSignature.end(),
+                 rom.begin() + 0x100,
+                 [](int byte) { return static_cast<u8>(byte); });
+
+  REQUIRE(install(rom));
+  CHECK(rom[0x100] == SoundMainRamSwi);
+  CHECK(rom[0x101] == 0xdf);
+
+  Mmu mmu;
+  Cpu cpu{mmu};
+  constexpr u32 sp = Mmu::IWramBegin + 0x7e00;
+  constexpr u32 info = Mmu::IWramBegin + 0x1000;
+  mmu.set<u32>(sp + 0x18, info);
+  for (u32 i = 0; i < 8; ++i) {
+    // r8-r11, then r4-r7
+    mmu.set<u32>(sp + 0x1c + i * 4, 100 + i);
+  }
+  mmu.set<u32>(sp + 0x3c, 0x08000201);
+  cpu.set_reg(Register::R13, sp);
+
+  sound_main_ram(cpu);
+
+  CHECK(mmu.at<u32>(info) == IdNumber);
+  CHECK(cpu.reg(Register::R8) == 100);
+  CHECK(cpu.reg(Register::R11) == 103);
+  CHECK(cpu.reg(Register::R4) == 104);
+  CHECK(cpu.reg(Register::R7) == 107);
+  CHECK(cpu.reg(Register::R13) == sp + 0x40);
+  CHECK(cpu.program_status().thumb_mode());
+  CHECK(cpu.reg(Register::R15) - cpu.prefetch_offset() == 0x08000200);
+}
+
+}  // namespace gb::advance::hle::m4a
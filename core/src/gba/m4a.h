@@ -0,0 +1,41 @@
+#pragma once
+#include <optional>
+#include <nonstd/span.hpp>
+#include "types.h"
+
+namespace gb::advance {
+class Cpu;
+class Mmu;
+
+// High level emulation of Nintendo's MusicPlayer2000 (m4a/Sappy) sound
+// driver. SoundMain runs the sequencer on the guest and then jumps to
+// SoundMainRAM, a copy in IWRAM that mixes every PCM channel into the buffer
+// the FIFO DMAs play from. That mixing is most of the driver's CPU time, so
+// it's trapped and done natively instead.
+namespace hle::m4a {
+// Thumb swi that replaces the first instruction of SoundMainRAM
+constexpr u32 SoundMainRamSwi = 0xfd;
+
+// Offsets into the ROM
+struct Engine {
+  u32 sound_main;
+  u32 sound_main_ram;
+};
+
+[[nodiscard]] std::optional<Engine> find_engine(nonstd::span<const u8> rom);
+
+// Patches SoundMainRAM in the ROM before it's loaded, so the copy the game
+// makes into IWRAM traps. Returns false when the driver isn't found.
+bool install(nonstd::span<u8> rom);
+
+// Mixes one frame into the PCM buffer of the SoundInfo at sound_info, as
+// SoundMainRAM does. Returns false without changing anything when a playing
+// channel has a reversed or compressed wave, which only the driver mixes, or
+// when the SoundInfo doesn't fit in one memory region.
+bool mix(Mmu& mmu, u32 sound_info);
+
+// Handles the trap: mixes, then returns from SoundMain to its caller. Frames
+// mix() can't handle run the driver's SoundMainRAM instead.
+void sound_main_ram(Cpu& cpu);
+}  // namespace hle::m4a
+}  // namespace gb::advance
@@ -2,7 +2,10 @@
 #include <fmt/printf.h>
 #include <chrono>
 #include <numeric>
+#include <type_traits>
+#include <utility>
 #include "gba/cpu.h"
+#include "gba/dma.h"
 #include "gba/gpu.h"
 #include "gba/sound.h"
 #include "timer.h"
@@ -16,34 +19,6 @@
 
 namespace gb::advance {
 
-u32 Mmu::wait_cycles(u32 addr, Cycles cycles) {
-  const auto [wait_nonsequential,
-              wait_sequential] = [&]() -> std::pair<u32, u32> {
-    if (addr >= EWramBegin && addr <= EWramEnd) {
-      return {2, 2};
-    }
-
-    if (addr >= RomRegion0Begin && addr <= RomRegion0End) {
-      return {waitcnt.wait_zero_nonsequential(),
-              waitcnt.wait_zero_sequential()};
-    }
-
-    if (addr >= RomRegion1Begin && addr <= RomRegion1End) {
-      return {waitcnt.wait_one_nonsequential(), waitcnt.wait_one_sequential()};
-    }
-
-    if (addr >= RomRegion2Begin) {
-      return {waitcnt.wait_two_nonsequential(), waitcnt.wait_two_sequential()};
-    }
-
-    return {0, 0};
-  }();
-  return cycles.internal +
-         (cycles.nonsequential +
-          (cycles.nonsequential != 0 ? wait_nonsequential : 0)) +
-         (cycles.sequential + (cycles.sequential != 0 ? wait_sequential : 0));
-}
-
 static void unpack_bits(nonstd::span<u8> dest, const u64 value) {
   u16 bit_value = 0;
   fmt::printf("%016x\n", value);
@@ -141,6 +116,7 @@ void Mmu::copy_memory(AddrParam source,
     if (!m_eeprom_enabled) {
       m_memory_region_table[0xd] = m_eeprom;
       m_eeprom_enabled = true;
+      map_pages();
     }
 
     if (memory_region(dest_addr) == 0x0d000000) {
@@ -154,32 +130,273 @@ void Mmu::copy_memory(AddrParam source,
     return;
   }
 
+  if (count == 0) {
+    return;
+  }
+
+  const auto lowest_addr = [count, type_size](u32 addr, AddrOp op) {
+    return op == AddrOp::Decrement ? addr - (count - 1) * type_size : addr;
+  };
+  const auto extent = [count, type_size](AddrOp op) {
+    return op == AddrOp::Fixed ? type_size : count * type_size;
+  };
+  const u32 source_extent = extent(source_op);
+  const u32 dest_extent = extent(dest_op);
+  const u32 dest_low = lowest_addr(dest_addr, dest_op);
+  const u8* const source_data =
+      storage_range(lowest_addr(source_addr, source_op), source_extent, false);
+  u8* const dest_data = storage_range(dest_low, dest_extent, true);
+
+  if (source_data == nullptr || dest_data == nullptr) {
+    // IO, mirror boundaries and open bus go through at and set
+    if (type_size == sizeof(u32)) {
+      copy_elements<u32>(source, dest, count);
+    } else {
+      copy_elements<u16>(source, dest, count);
+    }
+    return;
+  }
+
+  notify_write(dest_low, dest_extent);
+
+  const bool overlaps_ahead =
+      dest_data > source_data && dest_data < source_data + source_extent;
+  if (source_op == AddrOp::Increment && dest_op == AddrOp::Increment &&
+      !overlaps_ahead) {
+    std::memmove(dest_data, source_data, count * type_size);
+    return;
+  }
+
+  if (source_op == AddrOp::Fixed && dest_op == AddrOp::Increment) {
+    if (type_size == sizeof(u32)) {
+      fill_elements<u32>(dest_data, source_data, count);
+    } else {
+      fill_elements<u16>(dest_data, source_data, count);
+    }
+    return;
+  }
+
+  const auto first_element = [type_size](auto* data, AddrOp op, u32 size) {
+    return op == AddrOp::Decrement ? data + size - type_size : data;
+  };
   const int source_stride =
       static_cast<int>(source_op) * static_cast<int>(type_size);
   const int dest_stride =
       static_cast<int>(dest_op) * static_cast<int>(type_size);
-  if (is_hardware_addr(source_addr) || is_hardware_addr(dest_addr)) {
-    u32 resolved_source_addr = source_addr;
-    u32 resolved_dest_addr = dest_addr;
-    for (u32 i = 0; i < count; ++i) {
-      for (u32 j = 0; j < type_size; ++j) {
-        set<u8>(resolved_dest_addr + (dest_stride == 0 ? 0 : j),
-                at<u8>(resolved_source_addr + j));
+  if (type_size == sizeof(u32)) {
+    copy_strided<u32>(first_element(source_data, source_op, source_extent),
+                      source_stride,
+                      first_element(dest_data, dest_op, dest_extent),
+                      dest_stride, count);
+  } else {
+    copy_strided<u16>(first_element(source_data, source_op, source_extent),
+                      source_stride,
+                      first_element(dest_data, dest_op, dest_extent),
+                      dest_stride, count);
+  }
+}
+
+u8* Mmu::storage_range(u32 addr, u32 size, bool write) {
+  const u32 region = addr >> 24;
+  const bool ram =
+      region == 0x02 || region == 0x03 || (region >= 0x05 && region <= 0x07);
+  const bool rom = region >= 0x08 && region <= 0x0d &&
+                   !(region == 0x0d && m_eeprom_enabled);
+  if (!(ram || (rom && !write)) || ((addr + size - 1) >> 24) != region) {
+    return nullptr;
+  }
+
+  // The range can't wrap around a mirror or run past the end of the storage
+  const auto storage = m_memory_region_table[region];
+  const u32 first = mirror_offset(region, addr & 0x00ffffff);
+  const u32 last = mirror_offset(region, (addr + size - 1) & 0x00ffffff);
+  if (last != first + size - 1 || last >= storage.size()) {
+    return nullptr;
+  }
+  return storage.data() + first;
+}
+
+template <typename T>
+void Mmu::copy_elements(AddrParam source, AddrParam dest, u32 count) {
+  constexpr int size = sizeof(T);
+  u32 source_addr = source.addr;
+  u32 dest_addr = dest.addr;
+  for (u32 i = 0; i < count; ++i) {
+    set<T>(dest_addr, at<T>(source_addr));
+    source_addr += static_cast<int>(source.op) * size;
+    dest_addr += static_cast<int>(dest.op) * size;
+  }
+}
+
+template <typename T>
+void Mmu::fill_elements(u8* dest, const u8* source, u32 count) {
+  T value;
+  std::memcpy(&value, source, sizeof(T));
+  if (value == 0 || value == static_cast<T>(~T{0})) {
+    std::memset(dest, value & 0xff, count * sizeof(T));
+    return;
+  }
+  for (u32 i = 0; i < count; ++i) {
+    std::memcpy(dest + i * sizeof(T), &value, sizeof(T));
+  }
+}
+
+template <typename T>
+void Mmu::copy_strided(const u8* source,
+                       int source_stride,
+                       u8* dest,
+                       int dest_stride,
+                       u32 count) {
+  for (u32 i = 0; i < count; ++i) {
+    T value;
+    std::memcpy(&value, source, sizeof(T));
+    std::memcpy(dest, &value, sizeof(T));
+    source += source_stride;
+    dest += dest_stride;
+  }
+}
+
+void Mmu::notify_code_write(u32 addr, u32 size) {
+  // Each page is folded on its own, since the range can cross the end of a
+  // mirror or run from one region into the next
+  for (u32 done = 0; done < size;) {
+    const u32 current = addr + done;
+    if (const u32 page = BlockCache::code_page(current);
+        page != BlockCache::NoCodePage && m_code_pages[page]) {
+      m_code_pages[page] = false;
+      if (hardware.cpu != nullptr) {
+        hardware.cpu->invalidate_blocks(page);
       }
-      resolved_source_addr += source_stride;
-      resolved_dest_addr += dest_stride;
     }
+    done += BlockCache::CodePageSize - current % BlockCache::CodePageSize;
+  }
+}
+
+void Mmu::notify_vram_write(u32 addr, u32 size) {
+  if (memory_region(addr) != 0x06000000 || size == 0) {
+    return;
+  }
+  const u32 first = mirror_offset(0x06, addr & 0x00ffffff) / VramBlockSize;
+  const u32 last =
+      mirror_offset(0x06, (addr + size - 1) & 0x00ffffff) / VramBlockSize;
+  if (last < first) {
+    // Wrapped around a mirror
+    m_vram_writes.fill(~u64{0});
+    return;
+  }
+  for (u32 block = first; block <= last; ++block) {
+    m_vram_writes[block / 64] |= u64{1} << (block % 64);
+  }
+}
+
+void Mmu::allocate_ram() {
+  constexpr u32 EWramSize = 256_kb;
+  constexpr u32 IWramSize = 32_kb;
+  constexpr u32 VramSize = 96_kb;
+
+  if (!Fastmem::supported()) {
+    m_ram.assign(EWramSize + IWramSize + VramSize, 0);
+    m_ewram = nonstd::span<u8>{m_ram}.subspan(0, EWramSize);
+    m_iwram = nonstd::span<u8>{m_ram}.subspan(EWramSize, IWramSize);
+    m_vram = nonstd::span<u8>{m_ram}.subspan(EWramSize + IWramSize, VramSize);
   } else {
-    auto [source_storage, resolved_source_addr] = select_storage(source_addr);
-    auto [dest_storage, resolved_dest_addr] = select_storage(dest_addr);
+    m_fastmem = std::make_unique<Fastmem>();
+    u8* const base = m_fastmem->base();
 
-    for (u32 i = 0; i < count; ++i) {
-      for (u32 j = 0; j < type_size; ++j) {
-        dest_storage[resolved_dest_addr + (dest_stride == 0 ? 0 : j)] =
-            source_storage[resolved_source_addr + j];
+    // Every mirror is another view of the same storage
+    const int ewram = m_fastmem->create_storage(EWramSize);
+    for (u32 addr = EWramBegin; addr < IWramBegin; addr += EWramSize) {
+      m_fastmem->map(ewram, 0, EWramSize, addr, true);
+    }
+    const int iwram = m_fastmem->create_storage(IWramSize);
+    for (u32 addr = IWramBegin; addr < IoRegistersBegin; addr += IWramSize) {
+      m_fastmem->map(iwram, 0, IWramSize, addr, true);
+    }
+    // VRAM repeats every 128KB, and the last 32KB of that mirror OBJ VRAM
+    const int vram = m_fastmem->create_storage(VramSize);
+    for (u32 addr = VramBegin; addr < OamBegin; addr += 128_kb) {
+      m_fastmem->map(vram, 0, VramSize, addr, true);
+      m_fastmem->map(vram, 64_kb, 32_kb, addr + VramSize, true);
+    }
+
+    m_ewram = {base + EWramBegin, EWramSize};
+    m_iwram = {base + IWramBegin, IWramSize};
+    m_vram = {base + VramBegin, VramSize};
+  }
+
+  m_memory_region_table[0x02] = m_ewram;
+  m_memory_region_table[0x03] = m_iwram;
+  m_memory_region_table[0x06] = m_vram;
+}
+
+void Mmu::map_fastmem_rom() {
+  constexpr u32 RegionSize = 0x01000000;
+  const auto rom_size = static_cast<u32>(m_rom.size());
+  const u32 storage_size =
+      (rom_size + Fastmem::HostPageSize - 1) & ~(Fastmem::HostPageSize - 1);
+
+  m_fastmem->unmap(RomRegion0Begin, SramBegin - RomRegion0Begin);
+  if (storage_size == 0) {
+    return;
+  }
+  const int rom = m_fastmem->create_storage(storage_size);
+  m_fastmem->write_storage(rom, 0, m_rom);
+
+  // Same layout as m_memory_region_table
+  for (u32 region = 0x08; region < 0x0e; ++region) {
+    const u32 offset =
+        rom_size > RegionSize && (region % 2) != 0 ? RegionSize : 0;
+    const u32 size = std::min(storage_size - offset, RegionSize);
+    m_fastmem->map(rom, offset, size, region << 24, false);
+  }
+}
+
+void Mmu::map_pages() {
+  for (u32 page = 0; page < PageCount; ++page) {
+    const u32 addr = page << PageShift;
+    const u32 region = addr >> 24;
+    const u32 offset = mirror_offset(region, addr & 0x00ffffff);
+    MemoryPage& memory_page = m_pages[page];
+    memory_page = MemoryPage{};
+
+    switch (region) {
+      case 0x02:
+      case 0x03:
+      case 0x05:
+      case 0x06:
+      case 0x07: {
+        // Palette and OAM mirror several times within a page
+        const auto storage = m_memory_region_table[region];
+        u32 mask = std::min(static_cast<u32>(storage.size()), PageSize) - 1;
+        u8* data = storage.data() + offset;
+        if (m_fastmem && mask == PageSize - 1) {
+          // Fastmem already folds the mirrors
+          data = m_fastmem->base() + addr;
+        }
+        memory_page = {data, data, mask,
+                       BlockCache::code_page(memory_region(addr) | offset),
+                       region == 0x06};
+        break;
+      }
+      case 0x08:
+      case 0x09:
+      case 0x0a:
+      case 0x0b:
+      case 0x0c:
+      case 0x0d: {
+        if (region == 0x0d && m_eeprom_enabled) {
+          break;
+        }
+        const auto storage = m_memory_region_table[region];
+        if (offset + PageSize <= storage.size()) {
+          memory_page.read = m_fastmem ? m_fastmem->base() + addr
+                                       : storage.data() + offset;
+          memory_page.mask = PageSize - 1;
+        }
+        break;
       }
-      resolved_source_addr += source_stride;
-      resolved_dest_addr += dest_stride;
+      default:
+        break;
     }
   }
 }
@@ -197,36 +414,12 @@ void Mmu::set_bytes(u32 addr, nonstd::span<const u8> bytes) {
   for (std::size_t i = 0; i < copy_size; ++i) {
     subspan[i] = bytes[i];
   }
+  notify_write(addr, static_cast<u32>(copy_size));
   if (m_write_handler) {
     // m_write_handler(addr, 0);
   }
 }
 
-void Mmu::set_hardware_bytes(u32 addr, nonstd::span<const u8> bytes) {
-  const auto [io_addr, resolved_addr] = select_io_register(addr);
-  auto selected_hardware = select_hardware(io_addr, DataOperation::Write);
-
-  const auto bytes_size = static_cast<std::size_t>(bytes.size() & 7);
-
-  const bool is_overrunning = bytes_size > selected_hardware.size_bytes();
-  const long difference =
-      bytes_size - (selected_hardware.size_bytes() - resolved_addr);
-
-  assert(io_addr + resolved_addr == addr);
-  selected_hardware.write_byte(
-      resolved_addr, difference > 0 ? bytes.subspan(0, difference) : bytes);
-
-  if (is_overrunning) {
-    set_hardware_bytes(addr + difference, bytes.subspan(difference));
-  }
-
-#if 0
-  if (m_write_handler) {
-    m_write_handler(addr, 0);
-  }
-#endif
-}
-
 void Mmu::print_bios_warning() const {
 #if 1
   fmt::printf(
@@ -246,7 +439,8 @@ class MgbaDebugPrint : public Integer<u16> {
 
 static MgbaDebugPrint mgba_debug_print;
 
-IntegerRef Mmu::select_hardware(u32 addr, DataOperation op) {
+IntegerRef Mmu::select_hardware(u32 addr,
+                                [[maybe_unused]] DataOperation op) {
   switch (addr) {
     case hardware::mgba::DEBUG_ENABLE:
       STUB_ADDR(mgba_debug_enable);
@@ -254,208 +448,503 @@ IntegerRef Mmu::select_hardware(u32 addr, DataOperation op) {
       STUB_ADDR(mgba_debug_flags);
     case hardware::mgba::DEBUG_STRING:
       return mgba_debug_print;
-    case hardware::GREENSWAP: {
-      static u16 green_swap = 0;
-      return green_swap;
-    }
-    case hardware::DISPCNT:
-      return hardware.gpu->dispcnt;
-    case hardware::DISPSTAT:
-      return hardware.lcd->dispstat;
-    case hardware::WAITCNT:
-      return waitcnt;
-    case hardware::KEYINPUT:
-      return *hardware.input;
-    case hardware::IME:
-      return hardware.cpu->ime;
-    case hardware::TM0COUNTER:
-      return hardware.timers->timer0.select_counter_register(op);
-    case hardware::TM0CONTROL:
-      return hardware.timers->timer0.control;
-    case hardware::TM1COUNTER:
-      return hardware.timers->timer1.select_counter_register(op);
-    case hardware::TM1CONTROL:
-      return hardware.timers->timer1.control;
-    case hardware::TM2COUNTER:
-      return hardware.timers->timer2.select_counter_register(op);
-    case hardware::TM2CONTROL:
-      return hardware.timers->timer2.control;
-    case hardware::TM3COUNTER:
-      return hardware.timers->timer3.select_counter_register(op);
-    case hardware::TM3CONTROL:
-      return hardware.timers->timer3.control;
-    case hardware::VCOUNT:
-      return hardware.lcd->vcount;
-    case hardware::BG0CNT:
-      return hardware.gpu->bg0.control;
-    case hardware::BG1CNT:
-      return hardware.gpu->bg1.control;
-    case hardware::BG2CNT:
-      return hardware.gpu->bg2.control;
-    case hardware::BG3CNT:
-      return hardware.gpu->bg3.control;
-    case hardware::BG0HOFS:
-      return hardware.gpu->bg0.scroll.x;
-    case hardware::BG0VOFS:
-      return hardware.gpu->bg0.scroll.y;
-    case hardware::BG1HOFS:
-      return hardware.gpu->bg1.scroll.x;
-    case hardware::BG1VOFS:
-      return hardware.gpu->bg1.scroll.y;
-    case hardware::BG2HOFS:
-      return hardware.gpu->bg2.scroll.x;
-    case hardware::BG2VOFS:
-      return hardware.gpu->bg2.scroll.y;
-    case hardware::BG3HOFS:
-      return hardware.gpu->bg3.scroll.x;
-    case hardware::BG3VOFS:
-      return hardware.gpu->bg3.scroll.y;
-    case hardware::BG2PA:
-      return hardware.gpu->bg2.affine_matrix[0];
-    case hardware::BG2PB:
-      return hardware.gpu->bg2.affine_matrix[1];
-    case hardware::BG2PC:
-      return hardware.gpu->bg2.affine_matrix[2];
-    case hardware::BG2PD:
-      return hardware.gpu->bg2.affine_matrix[3];
-    case hardware::BG2X:
-      return hardware.gpu->bg2.affine_scroll_x_proxy;
-    case hardware::BG2Y:
-      return hardware.gpu->bg2.affine_scroll_y_proxy;
-    case hardware::BG3PA:
-      return hardware.gpu->bg3.affine_matrix[0];
-    case hardware::BG3PB:
-      return hardware.gpu->bg3.affine_matrix[1];
-    case hardware::BG3PC:
-      return hardware.gpu->bg3.affine_matrix[2];
-    case hardware::BG3PD:
-      return hardware.gpu->bg3.affine_matrix[3];
-    case hardware::BG3X:
-      return hardware.gpu->bg3.affine_scroll_x_proxy;
-    case hardware::BG3Y:
-      return hardware.gpu->bg3.affine_scroll_y_proxy;
-    case hardware::WIN0H:
-      return hardware.gpu->window0.x_bounds;
-    case hardware::WIN1H:
-      return hardware.gpu->window1.x_bounds;
-    case hardware::WIN0V:
-      return hardware.gpu->window0.y_bounds;
-    case hardware::WIN1V:
-      return hardware.gpu->window1.y_bounds;
-    case hardware::WININ:
-      return hardware.gpu->window_in;
-    case hardware::WINOUT:
-      return hardware.gpu->window_out;
-    case hardware::MOSAIC:
-      STUB_ADDR(mosaic);
-    case hardware::BLDCNT:
-      return hardware.gpu->bldcnt;
-    case hardware::BLDALPHA:
-      return hardware.gpu->bldalpha;
-    case hardware::BLDY:
-      return hardware.gpu->bldy;
-    case hardware::SOUND1CNT_L:
-      STUB_ADDR(sound1cnt_l);
-    case hardware::SOUND1CNT_H:
-      STUB_ADDR(sound1cnt_h);
-    case hardware::SOUND1CNT_X:
-      STUB_ADDR(sound1cnt_x);
-    case hardware::SOUND2CNT_L:
-      STUB_ADDR(sound2cnt_l);
-    case hardware::SOUND2CNT_H:
-      STUB_ADDR(sound2cnt_h);
-    case hardware::SOUND3CNT_L:
-      STUB_ADDR(sound3cnt_l);
-    case hardware::SOUND3CNT_H:
-      STUB_ADDR(sound3cnt_h);
-    case hardware::SOUND3CNT_X:
-      STUB_ADDR(sound3cnt_x);
-    case hardware::SOUND4CNT_L:
-      STUB_ADDR(sound4cnt_l);
-    case hardware::SOUND4CNT_H:
-      STUB_ADDR(sound4cnt_h);
-    case hardware::SOUNDCNT_L:
-      STUB_ADDR(soundcnt_l);
-    case hardware::SOUNDCNT_H:
-      return hardware.sound->soundcnt_high;
-    case hardware::SOUNDCNT_X:
-      STUB_ADDR(soundcnt_x);
-    case hardware::SOUNDBIAS:
-      return hardware.sound->soundbias;
-    case hardware::FIFO_A:
-      return hardware.sound->fifo_a;
-    case hardware::FIFO_B:
-      return hardware.sound->fifo_b;
-    case hardware::SIOMULTI0:
-      STUB_ADDR(siomulti0);
-    case hardware::SIOMULTI1:
-      STUB_ADDR(siomulti1);
-    case hardware::SIOMULTI2:
-      STUB_ADDR(siomulti2);
-    case hardware::SIOMULTI3:
-      STUB_ADDR(siomulti3);
-    case hardware::SIOCNT:
-      STUB_ADDR(siocnt);
-    case hardware::SIODATA8:
-      STUB_ADDR(siodata8);
-    case hardware::KEYCNT: {
-      static u16 keycnt = 0;
-      return keycnt;
-    }
-    case hardware::RCNT:
-      STUB_ADDR(rcnt);
-    case hardware::JOYCNT:
-      STUB_ADDR(joycnt);
-    case hardware::JOY_RECV:
-      STUB_ADDR(joy_recv);
-    case hardware::JOY_TRANS:
-      STUB_ADDR(joy_trans);
-    case hardware::JOYSTAT:
-      STUB_ADDR(joystat);
-    case hardware::IE:
-      return hardware.cpu->interrupts_enabled;
-    case hardware::IF:
-      return hardware.cpu->interrupts_requested;
-    case hardware::POSTFLG:
-      STUB_ADDR(postflg);
-    case hardware::DMA0SAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma0).source;
-    case hardware::DMA1SAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma1).source;
-    case hardware::DMA2SAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma2).source;
-    case hardware::DMA3SAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma3).source;
-    case hardware::DMA0DAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma0).dest;
-    case hardware::DMA1DAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma1).dest;
-    case hardware::DMA2DAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma2).dest;
-    case hardware::DMA3DAD:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma3).dest;
-    case hardware::DMA0CNT_L:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma0).count;
-    case hardware::DMA1CNT_L:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma1).count;
-    case hardware::DMA2CNT_L:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma2).count;
-    case hardware::DMA3CNT_L:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma3).count;
-    case hardware::DMA0CNT_H:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma0).control();
-    case hardware::DMA1CNT_H:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma1).control();
-    case hardware::DMA2CNT_H:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma2).control();
-    case hardware::DMA3CNT_H:
-      return hardware.dmas->dma(Dma::DmaNumber::Dma3).control();
     case hardware::WAVERAM:
-      STUB_ADDR(waveram);
+      return hardware.sound->psg.wave_ram;
   }
 
   fmt::printf("unimplemented io register %08x\n", addr);
   throw std::runtime_error("unimplemented io register switch");
 }
 
+namespace {
+template <u32 Addr>
+u32& stub_register() {
+  static u32 value = 0;
+  return value;
+}
+
+// The storage behind the register at Addr. Timer counters read the counter
+// and write the reload value.
+template <u32 Addr>
+auto& io_register(Mmu& mmu, Mmu::DataOperation op) {
+  const Hardware& hardware = mmu.hardware;
+  if constexpr (Addr == hardware::DISPCNT) {
+    return hardware.gpu->dispcnt;
+  } else if constexpr (Addr == hardware::DISPSTAT) {
+    return hardware.lcd->dispstat;
+  } else if constexpr (Addr == hardware::VCOUNT) {
+    return hardware.lcd->vcount;
+  } else if constexpr (Addr == hardware::WAITCNT) {
+    return mmu.waitcnt;
+  } else if constexpr (Addr == hardware::KEYINPUT) {
+    return *hardware.input;
+  } else if constexpr (Addr == hardware::IME) {
+    return hardware.cpu->ime;
+  } else if constexpr (Addr == hardware::IE) {
+    return hardware.cpu->interrupts_enabled;
+  } else if constexpr (Addr == hardware::IF) {
+    return hardware.cpu->interrupts_requested;
+  } else if constexpr (Addr == hardware::TM0COUNTER) {
+    return hardware.timers->timer0.select_counter_register(op);
+  } else if constexpr (Addr == hardware::TM0CONTROL) {
+    return hardware.timers->timer0.control;
+  } else if constexpr (Addr == hardware::TM1COUNTER) {
+    return hardware.timers->timer1.select_counter_register(op);
+  } else if constexpr (Addr == hardware::TM1CONTROL) {
+    return hardware.timers->timer1.control;
+  } else if constexpr (Addr == hardware::TM2COUNTER) {
+    return hardware.timers->timer2.select_counter_register(op);
+  } else if constexpr (Addr == hardware::TM2CONTROL) {
+    return hardware.timers->timer2.control;
+  } else if constexpr (Addr == hardware::TM3COUNTER) {
+    return hardware.timers->timer3.select_counter_register(op);
+  } else if constexpr (Addr == hardware::TM3CONTROL) {
+    return hardware.timers->timer3.control;
+  } else if constexpr (Addr == hardware::BG0CNT) {
+    return hardware.gpu->bg0.control;
+  } else if constexpr (Addr == hardware::BG1CNT) {
+    return hardware.gpu->bg1.control;
+  } else if constexpr (Addr == hardware::BG2CNT) {
+    return hardware.gpu->bg2.control;
+  } else if constexpr (Addr == hardware::BG3CNT) {
+    return hardware.gpu->bg3.control;
+  } else if constexpr (Addr == hardware::BG0HOFS) {
+    return hardware.gpu->bg0.scroll.x;
+  } else if constexpr (Addr == hardware::BG0VOFS) {
+    return hardware.gpu->bg0.scroll.y;
+  } else if constexpr (Addr == hardware::BG1HOFS) {
+    return hardware.gpu->bg1.scroll.x;
+  } else if constexpr (Addr == hardware::BG1VOFS) {
+    return hardware.gpu->bg1.scroll.y;
+  } else if constexpr (Addr == hardware::BG2HOFS) {
+    return hardware.gpu->bg2.scroll.x;
+  } else if constexpr (Addr == hardware::BG2VOFS) {
+    return hardware.gpu->bg2.scroll.y;
+  } else if constexpr (Addr == hardware::BG3HOFS) {
+    return hardware.gpu->bg3.scroll.x;
+  } else if constexpr (Addr == hardware::BG3VOFS) {
+    return hardware.gpu->bg3.scroll.y;
+  } else if constexpr (Addr >= hardware::BG2PA && Addr <= hardware::BG2PD) {
+    return hardware.gpu->bg2.affine_matrix[(Addr - hardware::BG2PA) / 2];
+  } else if constexpr (Addr == hardware::BG2X) {
+    return hardware.gpu->bg2.affine_scroll_x_proxy;
+  } else if constexpr (Addr == hardware::BG2Y) {
+    return hardware.gpu->bg2.affine_scroll_y_proxy;
+  } else if constexpr (Addr >= hardware::BG3PA && Addr <= hardware::BG3PD) {
+    return hardware.gpu->bg3.affine_matrix[(Addr - hardware::BG3PA) / 2];
+  } else if constexpr (Addr == hardware::BG3X) {
+    return hardware.gpu->bg3.affine_scroll_x_proxy;
+  } else if constexpr (Addr == hardware::BG3Y) {
+    return hardware.gpu->bg3.affine_scroll_y_proxy;
+  } else if constexpr (Addr == hardware::WIN0H) {
+    return hardware.gpu->window0.x_bounds;
+  } else if constexpr (Addr == hardware::WIN1H) {
+    return hardware.gpu->window1.x_bounds;
+  } else if constexpr (Addr == hardware::WIN0V) {
+    return hardware.gpu->window0.y_bounds;
+  } else if constexpr (Addr == hardware::WIN1V) {
+    return hardware.gpu->window1.y_bounds;
+  } else if constexpr (Addr == hardware::WININ) {
+    return hardware.gpu->window_in;
+  } else if constexpr (Addr == hardware::WINOUT) {
+    return hardware.gpu->window_out;
+  } else if constexpr (Addr == hardware::BLDCNT) {
+    return hardware.gpu->bldcnt;
+  } else if constexpr (Addr == hardware::BLDALPHA) {
+    return hardware.gpu->bldalpha;
+  } else if constexpr (Addr == hardware::BLDY) {
+    return hardware.gpu->bldy;
+  } else if constexpr (Addr == hardware::SOUND1CNT_L) {
+    return hardware.sound->psg.sound1cnt_l;
+  } else if constexpr (Addr == hardware::SOUND1CNT_H) {
+    return hardware.sound->psg.sound1cnt_h;
+  } else if constexpr (Addr == hardware::SOUND1CNT_X) {
+    return hardware.sound->psg.sound1cnt_x;
+  } else if constexpr (Addr == hardware::SOUND2CNT_L) {
+    return hardware.sound->psg.sound2cnt_l;
+  } else if constexpr (Addr == hardware::SOUND2CNT_H) {
+    return hardware.sound->psg.sound2cnt_h;
+  } else if constexpr (Addr == hardware::SOUND3CNT_L) {
+    return hardware.sound->psg.sound3cnt_l;
+  } else if constexpr (Addr == hardware::SOUND3CNT_H) {
+    return hardware.sound->psg.sound3cnt_h;
+  } else if constexpr (Addr == hardware::SOUND3CNT_X) {
+    return hardware.sound->psg.sound3cnt_x;
+  } else if constexpr (Addr == hardware::SOUND4CNT_L) {
+    return hardware.sound->psg.sound4cnt_l;
+  } else if constexpr (Addr == hardware::SOUND4CNT_H) {
+    return hardware.sound->psg.sound4cnt_h;
+  } else if constexpr (Addr == hardware::SOUNDCNT_L) {
+    return hardware.sound->psg.soundcnt_l;
+  } else if constexpr (Addr == hardware::SOUNDCNT_X) {
+    return hardware.sound->psg.select_status_register(op);
+  } else if constexpr (Addr == hardware::SOUNDCNT_H) {
+    return hardware.sound->soundcnt_high;
+  } else if constexpr (Addr == hardware::SOUNDBIAS) {
+    return hardware.sound->soundbias;
+  } else if constexpr (Addr == hardware::FIFO_A) {
+    return hardware.sound->fifo_a;
+  } else if constexpr (Addr == hardware::FIFO_B) {
+    return hardware.sound->fifo_b;
+  } else if constexpr (Addr >= hardware::DMA0SAD &&
+                       Addr <= hardware::DMA3CNT_H) {
+    auto& dma = hardware.dmas->dma(
+        static_cast<Dma::DmaNumber>((Addr - hardware::DMA0SAD) / 0xc));
+    constexpr u32 offset = (Addr - hardware::DMA0SAD) % 0xc;
+    if constexpr (offset == 0) {
+      return dma.source;
+    } else if constexpr (offset == 4) {
+      return dma.dest;
+    } else if constexpr (offset == 8) {
+      return dma.count;
+    } else {
+      return dma.control();
+    }
+  } else {
+    // Registers that aren't emulated yet hold whatever was written
+    return stub_register<Addr>();
+  }
+}
+
+// Registers that only store what is written to them can be copied into
+// directly, the rest go through write_byte and on_after_write.
+template <typename T, typename = void>
+struct IsPlainRegister : std::is_integral<T> {};
+
+template <typename T>
+struct IsPlainRegister<T, std::void_t<typename T::Type>>
+    : std::bool_constant<
+          std::is_same_v<decltype(&T::write_byte),
+                         decltype(&Integer<typename T::Type>::write_byte)> &&
+          std::is_same_v<
+              decltype(&T::on_after_write),
+              decltype(&Integer<typename T::Type>::on_after_write)>> {};
+
+template <typename T>
+u8* register_bytes(T& reg) {
+  if constexpr (std::is_integral_v<T>) {
+    return reinterpret_cast<u8*>(&reg);
+  } else {
+    return reg.byte_span().data();
+  }
+}
+
+// Register accesses are 1, 2 or 4 bytes, which become a single load or store
+u32 load_io_bytes(const u8* bytes, u32 size) {
+  switch (size) {
+    case 2: {
+      u16 value;
+      std::memcpy(&value, bytes, sizeof(u16));
+      return value;
+    }
+    case 4: {
+      u32 value;
+      std::memcpy(&value, bytes, sizeof(u32));
+      return value;
+    }
+    default: {
+      u32 value = 0;
+      std::memcpy(&value, bytes, size);
+      return value;
+    }
+  }
+}
+
+// The word store only exists for registers that are at least a word wide
+template <std::size_t RegisterSize>
+void store_io_bytes(u8* bytes, u32 value, u32 size) {
+  if constexpr (RegisterSize >= sizeof(u32)) {
+    if (size == sizeof(u32)) {
+      std::memcpy(bytes, &value, sizeof(u32));
+      return;
+    }
+  }
+  if (size == sizeof(u16)) {
+    std::memcpy(bytes, &value, sizeof(u16));
+    return;
+  }
+  std::memcpy(bytes, &value, std::min<u32>(size, RegisterSize));
+}
+
+template <typename T>
+constexpr std::size_t plain_register_size() {
+  if constexpr (std::is_integral_v<T>) {
+    return sizeof(T);
+  } else {
+    return sizeof(typename T::Type);
+  }
+}
+
+template <u32 Addr>
+using IoRegisterType = std::remove_reference_t<decltype(io_register<Addr>(
+    std::declval<Mmu&>(), Mmu::DataOperation::Read))>;
+
+// The timer counters count up with the clock, not on events
+constexpr bool changes_without_event(u32 addr) {
+  return addr == hardware::TM0COUNTER || addr == hardware::TM1COUNTER ||
+         addr == hardware::TM2COUNTER || addr == hardware::TM3COUNTER;
+}
+
+template <u32 Addr>
+u32 read_io_register(Mmu& mmu, u32 offset, u32 size) {
+  if constexpr (changes_without_event(Addr)) {
+    mmu.count_volatile_read();
+  }
+  auto& reg = io_register<Addr>(mmu, Mmu::DataOperation::Read);
+  return load_io_bytes(register_bytes(reg) + offset, size);
+}
+
+template <u32 Addr>
+void write_io_register(Mmu& mmu, u32 offset, u32 value, u32 size) {
+  auto& reg = io_register<Addr>(mmu, Mmu::DataOperation::Write);
+  if constexpr (IsPlainRegister<IoRegisterType<Addr>>::value) {
+    store_io_bytes<plain_register_size<IoRegisterType<Addr>>()>(
+        register_bytes(reg) + offset, value, size);
+  } else if constexpr (std::is_same_v<IoRegisterType<Addr>, SoundFifo>) {
+    reg.write(value, size);
+  } else {
+    for (u32 i = 0; i < size; ++i) {
+      reg.write_byte(offset + i, static_cast<u8>(value >> (i * 8)));
+    }
+    reg.on_after_write();
+  }
+  if constexpr (Addr == hardware::IME || Addr == hardware::IE) {
+    mmu.hardware.cpu->check_interrupts();
+  }
+}
+
+struct IoHandlers {
+  u32 (*read)(Mmu&, u32 offset, u32 size);
+  void (*write)(Mmu&, u32 offset, u32 value, u32 size);
+  u32 size;
+};
+
+template <std::size_t... I>
+constexpr std::array<IoHandlers, sizeof...(I)> make_io_handlers(
+    std::index_sequence<I...>) {
+  return {{IoHandlers{
+      read_io_register<hardware::io_register_list[I].first>,
+      write_io_register<hardware::io_register_list[I].first>,
+      hardware::io_register_list[I].second}...}};
+}
+
+constexpr auto io_handlers = make_io_handlers(
+    std::make_index_sequence<hardware::io_register_list.size()>{});
+
+// Each byte of 0x04000000-0x040003ff points at the handlers of the register
+// holding it. Wave RAM and the gaps between registers take the slow path.
+struct IoSlot {
+  u8 handlers;
+  u8 offset;
+};
+
+constexpr u8 NoIoHandlers = 0xff;
+
+constexpr auto io_slots = [] {
+  std::array<IoSlot, 0x400> slots{};
+  for (auto& slot : slots) {
+    slot = {NoIoHandlers, 0};
+  }
+  for (std::size_t i = 0; i < hardware::io_register_list.size(); ++i) {
+    const auto [io_addr, size] = hardware::io_register_list[i];
+    for (u32 offset = 0; offset < size; ++offset) {
+      slots[io_addr - Mmu::IoRegistersBegin + offset] = {
+          static_cast<u8>(i), static_cast<u8>(offset)};
+    }
+  }
+  return slots;
+}();
+
+const IoSlot* io_slot(u32 addr) {
+  const u32 index = addr - Mmu::IoRegistersBegin;
+  if (index >= io_slots.size() || io_slots[index].handlers == NoIoHandlers) {
+    return nullptr;
+  }
+  return &io_slots[index];
+}
+}  // namespace
+
+u32 Mmu::read_io(u32 addr, u32 size) {
+  // Most accesses hit a single register
+  if (const IoSlot* slot = io_slot(addr);
+      slot != nullptr &&
+      slot->offset + size <= io_handlers[slot->handlers].size) {
+    return io_handlers[slot->handlers].read(*this, slot->offset, size);
+  }
+
+  u32 value = 0;
+  for (u32 done = 0; done < size;) {
+    const u32 current = addr + done;
+    u32 count = 0;
+    u32 chunk = 0;
+    if (const IoSlot* slot = io_slot(current); slot != nullptr) {
+      const IoHandlers& handlers = io_handlers[slot->handlers];
+      count = std::min(size - done, handlers.size - slot->offset);
+      chunk = handlers.read(*this, slot->offset, count);
+    } else {
+      const auto [io_addr, resolved_addr] = select_io_register(current);
+      const auto selected_hardware =
+          select_hardware(io_addr, DataOperation::Read);
+      count = std::min(size - done, static_cast<u32>(
+                                         selected_hardware.size_bytes() -
+                                         resolved_addr));
+      std::memcpy(&chunk,
+                  selected_hardware.byte_span().data() + resolved_addr, count);
+    }
+    value |= chunk << (done * 8);
+    done += count;
+  }
+  return value;
+}
+
+void Mmu::write_io(u32 addr, u32 value, u32 size) {
+  if (const IoSlot* slot = io_slot(addr);
+      slot != nullptr &&
+      slot->offset + size <= io_handlers[slot->handlers].size) {
+    io_handlers[slot->handlers].write(*this, slot->offset, value, size);
+    return;
+  }
+
+  for (u32 done = 0; done < size;) {
+    const u32 current = addr + done;
+    u32 chunk = value >> (done * 8);
+    u32 count = 0;
+    if (const IoSlot* slot = io_slot(current); slot != nullptr) {
+      const IoHandlers& handlers = io_handlers[slot->handlers];
+      count = std::min(size - done, handlers.size - slot->offset);
+      handlers.write(*this, slot->offset, chunk, count);
+    } else {
+      const auto [io_addr, resolved_addr] = select_io_register(current);
+      const auto selected_hardware =
+          select_hardware(io_addr, DataOperation::Write);
+      count = std::min(size - done, static_cast<u32>(
+                                         selected_hardware.size_bytes() -
+                                         resolved_addr));
+      selected_hardware.write_byte(resolved_addr,
+                                   to_bytes(chunk).subspan(0, count));
+    }
+    done += count;
+  }
+}
+
+TEST_CASE("RAM regions should mirror on the fast and slow paths") {
+  Mmu mmu;
+  mmu.set<u32>(0x02000010, 0x11223344);
+  CHECK(mmu.at<u32>(0x02040010) == 0x11223344);
+  CHECK(mmu.at<u16>(0x02fc0012) == 0x1122);
+  // Misaligned reads take the slow path
+  CHECK(mmu.at<u16>(0x02040011) == 0x2233);
+
+  mmu.set<u16>(0x05000402, 0x7fff);
+  CHECK(mmu.at<u16>(0x05000002) == 0x7fff);
+
+  mmu.set<u32>(0x06018000, 0xdeadbeef);
+  CHECK(mmu.at<u32>(0x06010000) == 0xdeadbeef);
+  CHECK(mmu.at<u32>(0x06030000) == 0xdeadbeef);
+
+  mmu.set<u8>(0x03ffff01, 0xab);
+  CHECK(mmu.at<u8>(0x03007f01) == 0xab);
+
+  std::vector<u8> rom(64_kb, 0);
+  rom[0x8004] = 0x42;
+  mmu.load_rom(std::move(rom));
+  CHECK(mmu.at<u8>(0x08008004) == 0x42);
+  CHECK(mmu.at<u8>(0x0a008004) == 0x42);
+}
+
+TEST_CASE("wait states should follow WAITCNT writes") {
+  Mmu mmu;
+  // 8/16 bit EWRAM accesses take 3 cycles, words 6
+  CHECK(mmu.wait_cycles(Mmu::EWramBegin, 1_nonseq, AccessWidth::Halfword) ==
+        3);
+  CHECK(mmu.wait_cycles(Mmu::EWramBegin, 1_nonseq, AccessWidth::Word) == 6);
+  CHECK(mmu.wait_cycles(Mmu::IWramBegin, 1_nonseq, AccessWidth::Word) == 1);
+
+  // WS0 defaults to 4/2
+  CHECK(mmu.wait_cycles(Mmu::RomRegion0Begin, 1_nonseq, AccessWidth::Word) ==
+        8);
+  CHECK(mmu.wait_cycles(Mmu::RomRegion0Begin, 1_seq, AccessWidth::Halfword) ==
+        3);
+
+  // WS0 3/1 and SRAM 8
+  mmu.set<u16>(hardware::WAITCNT, 0b1'01'11);
+  CHECK(mmu.wait_cycles(Mmu::RomRegion0Begin, 1_nonseq,
+                        AccessWidth::Halfword) == 4);
+  CHECK(mmu.wait_cycles(Mmu::RomRegion0Begin, 1_seq, AccessWidth::Word) == 4);
+  CHECK(mmu.wait_cycles(Mmu::SramBegin, 1_nonseq, AccessWidth::Byte) == 9);
+}
+
+TEST_CASE("IO accesses should split at register boundaries") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  mmu.hardware.cpu = &cpu;
+  mmu.hardware.dmas = &dmas;
+
+  // DMA3CNT_L and DMA3CNT_H in one write
+  mmu.set<u32>(hardware::DMA3CNT_L, 0x00000010);
+  CHECK(mmu.at<u16>(hardware::DMA3CNT_L) == 0x0010);
+  CHECK(mmu.at<u32>(hardware::DMA3SAD) == 0);
+
+  // Unemulated registers keep their halves apart
+  mmu.set<u32>(hardware::KEYCNT, 0x22221111);
+  CHECK(mmu.at<u16>(hardware::KEYCNT) == 0x1111);
+  CHECK(mmu.at<u16>(hardware::RCNT) == 0x2222);
+  CHECK(mmu.at<u8>(hardware::RCNT + 1) == 0x22);
+
+  // Writing a bit of IF acknowledges it
+  cpu.interrupts_requested.set_data(0b101);
+  mmu.set<u32>(hardware::IE, 0x00010003);
+  CHECK(cpu.interrupts_enabled.data() == 0x0003);
+  CHECK(cpu.interrupts_requested.data() == 0b100);
+}
+
+TEST_CASE("notify_code_write should fold writes across a mirror boundary") {
+  Mmu mmu;
+  const u32 first = BlockCache::code_page(Mmu::IWramBegin);
+  const u32 last = BlockCache::code_page(Mmu::IWramBegin + 0x7fff);
+  mmu.mark_code_page(first);
+  mmu.mark_code_page(last);
+
+  // The end of IWRAM and the start of its first mirror
+  mmu.notify_code_write(Mmu::IWramBegin + 0x7ffe, 4);
+  CHECK_FALSE(mmu.code_pages()[first]);
+  CHECK_FALSE(mmu.code_pages()[last]);
+}
+
+TEST_CASE("copy_memory should match an element by element transfer") {
+  Mmu mmu;
+  for (u32 i = 0; i < 8; ++i) {
+    mmu.set<u16>(Mmu::EWramBegin + i * 2, static_cast<u16>(0x1100 + i));
+  }
+
+  using Op = Mmu::AddrOp;
+  mmu.copy_memory({Mmu::EWramBegin, Op::Increment},
+                  {Mmu::IWramBegin, Op::Increment}, 8, 2);
+  CHECK(mmu.at<u16>(Mmu::IWramBegin + 14) == 0x1107);
+
+  // Copying forwards into an overlapping range repeats the first elements
+  mmu.copy_memory({Mmu::EWramBegin, Op::Increment},
+                  {Mmu::EWramBegin + 4, Op::Increment}, 6, 2);
+  CHECK(mmu.at<u16>(Mmu::EWramBegin + 8) == 0x1100);
+  CHECK(mmu.at<u16>(Mmu::EWramBegin + 14) == 0x1101);
+
+  mmu.set<u32>(Mmu::IWramBegin, 0x12345678);
+  mmu.copy_memory({Mmu::IWramBegin, Op::Fixed}, {Mmu::VramBegin, Op::Increment},
+                  16, 4);
+  CHECK(mmu.at<u32>(Mmu::VramBegin + 60) == 0x12345678);
+
+  mmu.copy_memory({Mmu::IWramBegin, Op::Increment},
+                  {Mmu::IWramBegin + 0x1c, Op::Decrement}, 8, 2);
+  CHECK(mmu.at<u16>(Mmu::IWramBegin + 0x1c) == 0x5678);
+  CHECK(mmu.at<u16>(Mmu::IWramBegin + 0x1a) == 0x1234);
+
+  // The end of IWRAM wraps around to the start
+  mmu.set<u32>(Mmu::VramBegin + 4, 0xcafef00d);
+  mmu.copy_memory({Mmu::VramBegin, Op::Increment},
+                  {Mmu::IWramEnd - 3, Op::Increment}, 2, 4);
+  CHECK(mmu.at<u32>(Mmu::IWramEnd - 3) == 0x12345678);
+  CHECK(mmu.at<u32>(Mmu::IWramBegin) == 0xcafef00d);
+}
+
 }  // namespace gb::advance
@@ -3,10 +3,13 @@
 #include <fmt/printf.h>
 #include <cstring>
 #include <functional>
+#include <memory>
 #include <variant>
 #include <vector>
 #include "error_handling.h"
+#include "gba/block_cache.h"
 #include "gba/dma.h"
+#include "gba/fastmem.h"
 #include "gba/hardware.h"
 #include "gba/input.h"
 #include "gba/lcd.h"
@@ -125,9 +128,39 @@ struct FlashMemory {
   }
 };
 
+enum class AccessWidth : u32 {
+  Byte,
+  Halfword,
+  Word,
+};
+
+template <typename T>
+[[nodiscard]] constexpr AccessWidth access_width() {
+  static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4);
+  switch (sizeof(T)) {
+    case 1:
+      return AccessWidth::Byte;
+    case 2:
+      return AccessWidth::Halfword;
+    default:
+      return AccessWidth::Word;
+  }
+}
+
+// Wait states of the first access of a burst and of the ones following it
+struct WaitStates {
+  u32 nonsequential = 0;
+  u32 sequential = 0;
+};
+
 class Waitcnt : public Integer<u32> {
  public:
-  using Integer::Integer;
+  explicit Waitcnt(u32 value) : Integer::Integer{value} {
+    update_wait_states();
+  }
+
+  void on_after_write() { update_wait_states(); }
+
   [[nodiscard]] u32 sram_wait_control() const {
     return decode_cycles(m_value & 0b11);
   }
@@ -152,6 +185,19 @@ class Waitcnt : public Integer<u32> {
 
   [[nodiscard]] bool enable_prefetch_buffer() const { return test_bit(14); }
 
+  [[nodiscard]] WaitStates wait_states(u32 addr, AccessWidth width) const {
+    const u32 region = addr >> 24;
+    if (region >= m_wait_states.size()) {
+      return {};
+    }
+    return m_wait_states[region][static_cast<u32>(width)];
+  }
+
+  // wait_states for every region and width, as [region * 3 + width]
+  [[nodiscard]] const WaitStates* wait_state_table() const noexcept {
+    return m_wait_states[0].data();
+  }
+
  private:
   static u32 decode_cycles(u32 value) {
     switch (value & 0b11) {
@@ -167,6 +213,43 @@ class Waitcnt : public Integer<u32> {
         GB_UNREACHABLE();
     }
   }
+
+  // Only changes when WAITCNT is written, so it's decoded once per region
+  void update_wait_states() {
+    for (u32 region = 0; region < m_wait_states.size(); ++region) {
+      const WaitStates narrow = [this, region]() -> WaitStates {
+        switch (region) {
+          case 0x02:
+            return {2, 2};
+          case 0x08:
+          case 0x09:
+            return {wait_zero_nonsequential(), wait_zero_sequential()};
+          case 0x0a:
+          case 0x0b:
+            return {wait_one_nonsequential(), wait_one_sequential()};
+          case 0x0c:
+          case 0x0d:
+            return {wait_two_nonsequential(), wait_two_sequential()};
+          case 0x0e:
+            return {sram_wait_control(), sram_wait_control()};
+          default:
+            return {};
+        }
+      }();
+      // A word on a 16 bit bus takes a second, sequential access
+      const bool bus_16 = region == 0x02 || region == 0x05 || region == 0x06 ||
+                          (region >= 0x08 && region <= 0x0d);
+      auto& states = m_wait_states[region];
+      states[static_cast<u32>(AccessWidth::Byte)] = narrow;
+      states[static_cast<u32>(AccessWidth::Halfword)] = narrow;
+      states[static_cast<u32>(AccessWidth::Word)] =
+          bus_16 ? WaitStates{narrow.nonsequential + 1 + narrow.sequential,
+                              narrow.sequential * 2 + 1}
+                 : narrow;
+    }
+  }
+
+  std::array<std::array<WaitStates, 3>, 16> m_wait_states{};
 };
 
 constexpr u32 memory_region(u32 addr) noexcept {
@@ -255,9 +338,22 @@ class Mmu {
 
     std::copy(bios_vblank_intr_wait.begin(), bios_vblank_intr_wait.end(),
               m_bios.begin() + VBlankIntrWaitAddr);
+    allocate_ram();
+    map_pages();
   }
 
-  [[nodiscard]] u32 wait_cycles(u32 addr, Cycles cycles);
+  Mmu(const Mmu&) = delete;
+  Mmu& operator=(const Mmu&) = delete;
+
+  [[nodiscard]] u32 wait_cycles(u32 addr,
+                                Cycles cycles,
+                                AccessWidth width) const {
+    const WaitStates wait_states = waitcnt.wait_states(addr, width);
+    return cycles.internal + cycles.nonsequential +
+           (cycles.nonsequential != 0 ? wait_states.nonsequential : 0) +
+           cycles.sequential +
+           (cycles.sequential != 0 ? wait_states.sequential : 0);
+  }
 
   void load_rom(std::vector<u8> data) {
     m_rom = std::move(data);
@@ -277,6 +373,10 @@ class Mmu {
           }
           return region;
         });
+    if (m_fastmem) {
+      map_fastmem_rom();
+    }
+    map_pages();
   }
 
   nonstd::span<u8> bios() { return m_bios; }
@@ -295,13 +395,63 @@ class Mmu {
 
   nonstd::span<u8> rom() { return m_rom; }
 
+  // Where GBA address 0 lives on the host, or nullptr without fastmem.
+  // Only RAM and ROM are mapped, everything else faults.
+  [[nodiscard]] u8* fastmem_base() const noexcept {
+    return m_fastmem ? m_fastmem->base() : nullptr;
+  }
+
+  // Bit n is set if every address in region n is mapped in fastmem: EWRAM,
+  // IWRAM and VRAM with all their mirrors. ROM ends where the cartridge does.
+  static constexpr u32 FastmemRegions = 1 << 0x02 | 1 << 0x03 | 1 << 0x06;
+
+  static constexpr u32 PageShift = 15;
+
+  // Host memory behind a 32KB page of the address space. Accesses resolve
+  // to read/write + (addr & mask), so the mask also applies mirroring.
+  // nullptr sends the access down the slow path: BIOS, IO, save memory,
+  // EEPROM, open bus and ROM writes.
+  struct MemoryPage {
+    u8* read = nullptr;
+    u8* write = nullptr;
+    u32 mask = 0;
+    // Code page of the start of the storage, for RAM that can hold code
+    u32 first_code_page = BlockCache::NoCodePage;
+    // Writes go to m_vram_writes
+    bool vram = false;
+  };
+
+  // The tables at() and set() go through, for the JIT to walk inline. A
+  // store has to go through set() when its code page is marked.
+  [[nodiscard]] const MemoryPage* pages() const noexcept {
+    return m_pages.data();
+  }
+
+  [[nodiscard]] const bool* code_pages() const noexcept {
+    return m_code_pages.data();
+  }
+
   template <typename T>
   void set(u32 addr, T value) {
+    if (const MemoryPage* page = fast_page<T>(addr);
+        page != nullptr && page->write != nullptr) {
+      const u32 offset = addr & page->mask;
+      std::memcpy(page->write + offset, &value, sizeof(T));
+      if (page->first_code_page != BlockCache::NoCodePage &&
+          m_code_pages[page->first_code_page +
+                       offset / BlockCache::CodePageSize]) {
+        notify_code_write(addr, sizeof(T));
+      }
+      if (page->vram) {
+        notify_vram_write(addr, sizeof(T));
+      }
+      return;
+    }
+
     if (memory_region(addr) == 0) {
       return;
     }
 
-    const auto converted = to_bytes(value);
     if constexpr (std::is_same_v<T, u8>) {
       if (memory_region(addr) == 0x0e000000) {
         if (m_flash_memory.push_byte(addr, value)) {
@@ -310,47 +460,42 @@ class Mmu {
       }
     }
     if (is_hardware_addr(addr)) {
-      set_hardware_bytes(addr, converted);
+      // Writes wider than a word are split into words
+      for (u32 i = 0; i < sizeof(T); i += sizeof(u32)) {
+        const u32 count = std::min<u32>(sizeof(T) - i, sizeof(u32));
+        u32 io_value = 0;
+        std::memcpy(&io_value, reinterpret_cast<const u8*>(&value) + i,
+                    count);
+        write_io(addr + i, io_value, count);
+      }
     } else {
-      set_bytes(addr, converted);
+      set_bytes(addr, to_bytes(value));
     }
   }
 
   void set_bytes(u32 addr, nonstd::span<const u8> bytes);
-  void set_hardware_bytes(u32 addr, nonstd::span<const u8> bytes);
 
   template <typename T>
   T at(u32 addr) {
+    if (const MemoryPage* page = fast_page<T>(addr);
+        page != nullptr && page->read != nullptr) {
+      T ret;
+      std::memcpy(&ret, page->read + (addr & page->mask), sizeof(T));
+      return ret;
+    }
+
     if constexpr (std::is_integral_v<T>) {
       if (m_eeprom_enabled && (addr & 0xff000000) == 0x0d000000) {
         return 1;
       }
     }
     if (is_hardware_addr(addr)) {
-      T ret{};
-
-      // Account for reads larger than the size of an io register.
-      alignas(T) u8 storage[sizeof(T)];
-
-      int num_bytes = sizeof(T);
-      while (num_bytes > 0) {
-        const auto [io_addr, resolved_addr] =
-            select_io_register(addr + (sizeof(T) - num_bytes));
-        const auto selected_hardware =
-            select_hardware(io_addr, DataOperation::Read);
-        const auto copy_size =
-            std::min(sizeof(T), selected_hardware.size_bytes());
-        assert((copy_size & (copy_size - 1)) == 0);
-
-        const auto* data =
-            selected_hardware.byte_span().subspan(resolved_addr).data();
-        std::copy_n(data, copy_size, &storage[sizeof(T) - num_bytes]);
-
-        num_bytes -= copy_size;
+      T ret;
+      for (u32 i = 0; i < sizeof(T); i += sizeof(u32)) {
+        const u32 count = std::min<u32>(sizeof(T) - i, sizeof(u32));
+        const u32 io_value = read_io(addr + i, count);
+        std::memcpy(reinterpret_cast<u8*>(&ret) + i, &io_value, count);
       }
-
-      std::memcpy(&ret, storage, sizeof(T));
-
       return ret;
     }
 
@@ -410,7 +555,8 @@ class Mmu {
 
     if (const u32 addr_region = addr >> 24;
         addr_region < m_memory_region_table.size()) {
-      return {m_memory_region_table[addr_region], addr - (addr_region << 24)};
+      return {m_memory_region_table[addr_region],
+              mirror_offset(addr_region, addr - (addr_region << 24))};
     }
 
     // fmt::printf("unimplemented select_storage addr %08x\n", addr);
@@ -422,7 +568,90 @@ class Mmu {
     m_write_handler = std::forward<Func>(func);
   }
 
+  void mark_code_page(u32 page) { m_code_pages[page] = true; }
+
+  // Drops cached blocks on every page in [addr, addr + size) holding code.
+  void notify_code_write(u32 addr, u32 size);
+
+  // VRAM written since the GPU's tile cache last decoded it, one bit per 32
+  // bytes, which is one 4bpp tile. Everything starts out written.
+  static constexpr u32 VramBlockSize = 32;
+  using VramWrites = std::array<u64, 96_kb / VramBlockSize / 64>;
+  [[nodiscard]] VramWrites& vram_writes() { return m_vram_writes; }
+
+  // Marks the VRAM blocks in [addr, addr + size) as written
+  void notify_vram_write(u32 addr, u32 size);
+
+  // For writes that go straight into the storage select_storage returns
+  void notify_write(u32 addr, u32 size) {
+    notify_code_write(addr, size);
+    notify_vram_write(addr, size);
+  }
+
+  // Number of reads so far of registers that change between events, the
+  // timer counters. A loop polling one of them can exit without an event.
+  [[nodiscard]] u32 volatile_reads() const noexcept { return m_volatile_reads; }
+  void count_volatile_read() noexcept { ++m_volatile_reads; }
+
  private:
+  static constexpr u32 PageSize = 1 << PageShift;
+  // Pages cover 0x00000000-0x0fffffff, the rest is open bus
+  static constexpr u32 PageCount = 0x10000000 >> PageShift;
+
+  template <typename T>
+  [[nodiscard]] const MemoryPage* fast_page(u32 addr) const {
+    if (addr >= 0x10000000 || (addr & (sizeof(T) - 1)) != 0) {
+      return nullptr;
+    }
+    return &m_pages[addr >> PageShift];
+  }
+
+  // Folds mirrors of the RAM regions back onto their storage
+  [[nodiscard]] static constexpr u32 mirror_offset(u32 region, u32 offset) {
+    switch (region) {
+      case 0x02:
+        return offset & 0x3ffff;
+      case 0x03:
+        return offset & 0x7fff;
+      case 0x05:
+      case 0x07:
+        return offset & 0x3ff;
+      case 0x06:
+        // The upper 32KB mirrors the 32KB below it
+        offset &= 0x1ffff;
+        return offset >= 0x18000 ? offset - 0x8000 : offset;
+      default:
+        return offset;
+    }
+  }
+
+  void allocate_ram();
+  void map_fastmem_rom();
+  void map_pages();
+
+  // Host memory behind [addr, addr + size) if it's one run of RAM, or of ROM
+  // when reading, that doesn't wrap around a mirror. nullptr otherwise.
+  [[nodiscard]] u8* storage_range(u32 addr, u32 size, bool write);
+
+  // The DMA transfer kernels behind copy_memory
+  template <typename T>
+  void copy_elements(AddrParam source, AddrParam dest, u32 count);
+  template <typename T>
+  static void fill_elements(u8* dest, const u8* source, u32 count);
+  template <typename T>
+  static void copy_strided(const u8* source,
+                           int source_stride,
+                           u8* dest,
+                           int dest_stride,
+                           u32 count);
+
+  // Accesses of up to 4 bytes to the IO registers, split at register
+  // boundaries and dispatched through a table generated from
+  // io_register_list
+  [[nodiscard]] u32 read_io(u32 addr, u32 size);
+  void write_io(u32 addr, u32 value, u32 size);
+
+  // The registers outside of io_register_list
   [[nodiscard]] IntegerRef select_hardware(u32 addr, DataOperation op);
 
   void eeprom_send_command(nonstd::span<const u8> source, u32 count);
@@ -431,10 +660,14 @@ class Mmu {
   nonstd::span<const u8> get_prefetched_opcode() const noexcept;
 
   std::vector<u8> m_bios = std::vector<u8>(16_kb, 0);
-  std::vector<u8> m_ewram = std::vector<u8>(256_kb, 0);
-  std::vector<u8> m_iwram = std::vector<u8>(32_kb, 0);
+  // EWRAM, IWRAM and VRAM live in fastmem when it's supported, and in
+  // m_ram otherwise
+  std::unique_ptr<Fastmem> m_fastmem;
+  std::vector<u8> m_ram;
+  nonstd::span<u8> m_ewram;
+  nonstd::span<u8> m_iwram;
+  nonstd::span<u8> m_vram;
   std::vector<u8> m_palette_ram = std::vector<u8>(1_kb, 0);
-  std::vector<u8> m_vram = std::vector<u8>(96_kb, 0);
   std::vector<u8> m_oam_ram = std::vector<u8>(1_kb, 0);
   std::vector<u8> m_rom;
   std::vector<u8> m_sram = std::vector<u8>(64_kb, 0xff);
@@ -467,6 +700,16 @@ class Mmu {
   }};
 
   bool m_eeprom_enabled = false;
+
+  std::array<bool, BlockCache::CodePageCount> m_code_pages{};
+  u32 m_volatile_reads = 0;
+  VramWrites m_vram_writes = [] {
+    VramWrites writes;
+    writes.fill(~u64{0});
+    return writes;
+  }();
+
+  std::vector<MemoryPage> m_pages = std::vector<MemoryPage>(PageCount);
 };
 
 }  // namespace gb::advance
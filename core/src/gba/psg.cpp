@@ -0,0 +1,257 @@
+#include "gba/psg.h"
+#include <doctest/doctest.h>
+#include <algorithm>
+#include "gba/audio_mixer.h"
+#include "gba/scheduler.h"
+
+namespace gb::advance {
+
+void PsgRegister::write_byte(unsigned int byte, u8 value) {
+  Integer::write_byte(byte, value);
+  m_psg->write_register(m_offset + byte, value);
+}
+
+Psg::Psg(Scheduler& scheduler, AudioMixer& mixer)
+    : m_scheduler{&scheduler}, m_mixer{&mixer} {
+  m_wave.source.set_timer_base(0);
+}
+
+PsgRegister& Psg::select_status_register(Mmu::DataOperation op) {
+  if (op == Mmu::DataOperation::Read) {
+    sync(m_scheduler->now());
+    const u16 status = (m_noise.is_enabled() ? 0b1000 : 0) |
+                       (m_wave.is_enabled() ? 0b0100 : 0) |
+                       (m_square2.is_enabled() ? 0b0010 : 0) |
+                       (m_square1.is_enabled() ? 0b0001 : 0);
+    soundcnt_x.set_data(
+        static_cast<u16>((soundcnt_x.data() & 0x80) | status));
+  }
+  return soundcnt_x;
+}
+
+void Psg::sync(u64 cycle) {
+  if (cycle <= m_cycle) {
+    return;
+  }
+  u64 ticks = (cycle - m_cycle) / CyclesPerTick;
+  while (ticks > 0) {
+    // Nothing changes until a channel or the sequencer steps
+    int step = m_sequencer_ticks;
+    const auto consider = [&step](bool enabled, int ticks_until_step) {
+      if (enabled && ticks_until_step >= 0) {
+        step = std::min(step, std::max(ticks_until_step, 1));
+      }
+    };
+    consider(m_square1.is_enabled(), m_square1.source.ticks_until_step());
+    consider(m_square2.is_enabled(), m_square2.source.ticks_until_step());
+    consider(m_wave.is_enabled(), m_wave.source.ticks_until_step());
+    consider(m_noise.is_enabled(), m_noise.source.ticks_until_step());
+    step = static_cast<int>(std::min<u64>(static_cast<u64>(step), ticks));
+
+    for (auto* channel : {&m_square1, &m_square2}) {
+      if (channel->is_enabled()) {
+        channel->update(step);
+      }
+    }
+    if (m_wave.is_enabled()) {
+      m_wave.update(step);
+    }
+    if (m_noise.is_enabled()) {
+      m_noise.update(step);
+    }
+    m_cycle += static_cast<u64>(step) * CyclesPerTick;
+    ticks -= static_cast<u64>(step);
+
+    m_sequencer_ticks -= step;
+    if (m_sequencer_ticks == 0) {
+      m_sequencer_ticks = 8192;
+      clock_sequencer();
+    }
+    update_output(m_cycle);
+  }
+}
+
+void Psg::clock_sequencer() {
+  m_square1.clock(m_sequencer_step);
+  m_square2.clock(m_sequencer_step);
+  m_wave.clock(m_sequencer_step);
+  m_noise.clock(m_sequencer_step);
+  if (m_sequencer_step == 2 || m_sequencer_step == 6) {
+    m_square1.source.clock_sweep();
+  }
+  m_sequencer_step = (m_sequencer_step + 1) & 0b111;
+}
+
+void Psg::update_output(u64 cycle) {
+  // NR51 picks the channels on each side, NR50 scales each side by 1 to 8
+  const u8 enabled = m_registers[0x21];
+  const u8 master = m_registers[0x20];
+  const std::array<u8, 4> volumes = {m_square1.volume(), m_square2.volume(),
+                                     m_wave.volume(), m_noise.volume()};
+  std::array<u16, 2> output{};
+  for (u32 i = 0; i < volumes.size(); ++i) {
+    output[0] += gb::test_bit(enabled, i + 4) ? volumes[i] : 0;
+    output[1] += gb::test_bit(enabled, i) ? volumes[i] : 0;
+  }
+  output[0] = static_cast<u16>(output[0] * (((master >> 4) & 0b111) + 1));
+  output[1] = static_cast<u16>(output[1] * ((master & 0b111) + 1));
+
+  if (output != m_output) {
+    m_output = output;
+    m_mixer->push_psg(cycle, output[0], output[1]);
+  }
+}
+
+void Psg::write_register(u32 offset, u8 value) {
+  sync(m_scheduler->now());
+  m_registers[offset] = value;
+
+  // Everything but NR52 ignores writes while the PSG is off
+  if (!m_power_on && offset != 0x24) {
+    return;
+  }
+
+  auto& square = offset < 0x08 ? m_square1 : m_square2;
+  switch (offset) {
+    // Square
+    case 0x00:
+      m_square1.source.set_sweep_period((value & 0x70) >> 4);
+      m_square1.source.set_sweep_negate((value & 0x8) != 0);
+      m_square1.source.set_sweep_shift(value & 0x7);
+      break;
+    case 0x02:
+    case 0x08:
+      square.source.set_duty_cycle((value & 0xc0) >> 6);
+      square.dispatch(SetLengthCommand{value & 0x3f});
+      break;
+    case 0x03:
+    case 0x09:
+      square.dispatch(SetStartingVolumeCommand{(value & 0xf0) >> 4});
+      square.dispatch(SetIncreaseVolumeCommand{(value & 0x08) != 0});
+      square.dispatch(SetPeriodCommand{value & 0x07});
+      if ((value & 0xf8) == 0) {
+        square.disable();
+      }
+      break;
+    case 0x04:
+    case 0x0c:
+      square.source.set_timer_base(frequency(offset));
+      break;
+    case 0x05:
+    case 0x0d:
+      square.source.set_timer_base(frequency(offset - 1));
+      square.dispatch(SetLengthEnabledCommand{(value & 0x40) != 0});
+      if ((value & 0x80) != 0) {
+        square.enable();
+      }
+      break;
+
+    // Wave. Only the selected bank plays, the 64 sample mode isn't
+    // emulated.
+    case 0x10:
+      wave_ram.set_playing_bank((value >> 6) & 1);
+      m_wave_samples = wave_ram.playing();
+      if ((value & 0x80) == 0) {
+        m_wave.disable();
+      }
+      break;
+    case 0x12:
+      m_wave.dispatch(SetLengthCommand{value});
+      break;
+    case 0x13:
+      // The forced 75% volume plays at 100%
+      m_wave.dispatch(
+          VolumeShiftCommand{(value & 0x80) != 0 ? 1 : (value & 0x60) >> 5});
+      break;
+    case 0x14:
+      m_wave.source.set_timer_base(frequency(offset));
+      break;
+    case 0x15:
+      m_wave.source.set_timer_base(frequency(offset - 1));
+      m_wave.dispatch(SetLengthEnabledCommand{(value & 0x40) != 0});
+      if ((value & 0x80) != 0) {
+        m_wave_samples = wave_ram.playing();
+        m_wave.enable();
+      }
+      break;
+
+    // Noise
+    case 0x18:
+      m_noise.dispatch(SetLengthCommand{value & 0x3f});
+      break;
+    case 0x19:
+      m_noise.dispatch(SetStartingVolumeCommand{(value & 0xf0) >> 4});
+      m_noise.dispatch(SetIncreaseVolumeCommand{(value & 0x8) != 0});
+      m_noise.dispatch(SetPeriodCommand{value & 0x7});
+      if ((value & 0xf8) == 0) {
+        m_noise.disable();
+      }
+      break;
+    case 0x1c:
+      m_noise.source.set_prescalar_divider((value & 0xf0) >> 4);
+      m_noise.source.set_num_stages((value & 0x8) != 0);
+      m_noise.source.set_clock_divisor(value & 0x7);
+      break;
+    case 0x1d:
+      m_noise.dispatch(SetLengthEnabledCommand{(value & 0x40) != 0});
+      if ((value & 0x80) != 0) {
+        m_noise.enable();
+      }
+      break;
+
+    case 0x24:
+      m_power_on = gb::test_bit(value, 7);
+      if (!m_power_on) {
+        m_square1.disable();
+        m_square2.disable();
+        m_wave.disable();
+        m_noise.disable();
+      }
+      break;
+  }
+  update_output(m_cycle);
+}
+
+TEST_CASE("Psg should play a square wave at its frequency") {
+  Scheduler scheduler;
+  std::vector<s16> output;
+  AudioMixer mixer{[&output](nonstd::span<const u8> bytes) {
+                     const auto* samples =
+                         reinterpret_cast<const s16*>(bytes.data());
+                     output.insert(output.end(), samples,
+                                   samples + bytes.size() / sizeof(s16));
+                   },
+                   {SampleFormat::S16, 32768, 64}};
+  Psg psg{scheduler, mixer};
+
+  psg.soundcnt_x.write_byte(0, 0x80);
+  // Square 1 on both sides at full volume with a 50% duty cycle
+  psg.soundcnt_l.write_byte(0, 0x77);
+  psg.soundcnt_l.write_byte(1, 0x11);
+  psg.sound1cnt_h.write_byte(0, 0x80);
+  psg.sound1cnt_h.write_byte(1, 0xf0);
+  // 131072 / (2048 - 1024) = 128 Hz
+  psg.sound1cnt_x.write_byte(0, 0x00);
+  psg.sound1cnt_x.write_byte(1, 0x84);
+
+  const u64 quarter_second = AudioMixer::CyclesPerSecond / 4;
+  scheduler.advance(quarter_second);
+  psg.sync(quarter_second);
+  mixer.mix_until(quarter_second, 0b10, 0x200);
+  CHECK(psg.select_status_register(Mmu::DataOperation::Read).data() ==
+        0x81);
+
+  // Rises when it starts, then falls and rises once in each of the 32
+  // periods. A high level is 15 * 8.
+  int edges = 0;
+  bool high = false;
+  for (std::size_t i = 0; i < output.size(); i += 2) {
+    if ((output[i] > 15 * 8 * 64 / 2) != high) {
+      high = !high;
+      ++edges;
+    }
+  }
+  CHECK(edges == 1 + 32 * 2);
+}
+
+}  // namespace gb::advance
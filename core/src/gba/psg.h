@@ -0,0 +1,130 @@
+#pragma once
+#include <array>
+#include "channel.h"
+#include "gba/mmu.h"
+#include "noise_source.h"
+#include "sound_mods/envelope_mod.h"
+#include "sound_mods/length_mod.h"
+#include "sound_mods/volume_shift_mod.h"
+#include "square_source.h"
+#include "utils.h"
+#include "wave_source.h"
+
+namespace gb::advance {
+class AudioMixer;
+class Psg;
+class Scheduler;
+
+// SOUND1CNT_L to SOUNDCNT_X. Every byte written is passed to the PSG, which
+// catches up to the write before applying it.
+class PsgRegister : public Integer<u16> {
+ public:
+  PsgRegister(Psg& psg, u32 offset)
+      : Integer::Integer{0}, m_psg{&psg}, m_offset{offset} {}
+
+  void write_byte(unsigned int byte, u8 value);
+
+ private:
+  Psg* m_psg;
+  u32 m_offset;
+};
+
+// Both 16 byte banks of wave RAM. The CPU sees the bank that isn't playing.
+class WaveRam {
+ public:
+  [[nodiscard]] std::size_t size_bytes() const noexcept { return 16; }
+
+  [[nodiscard]] nonstd::span<u8> byte_span() noexcept {
+    return m_banks[m_playing_bank ^ 1];
+  }
+
+  void write_byte(unsigned int byte, u8 value) noexcept {
+    m_banks[m_playing_bank ^ 1][byte] = value;
+  }
+
+  void on_after_write() const noexcept {}
+
+  [[nodiscard]] const std::array<u8, 16>& playing() const noexcept {
+    return m_banks[m_playing_bank];
+  }
+
+  void set_playing_bank(u32 bank) noexcept { m_playing_bank = bank; }
+
+ private:
+  std::array<std::array<u8, 16>, 2> m_banks{};
+  u32 m_playing_bank = 0;
+};
+
+// The four Game Boy channels, reusing the GB core's sources and mods. They
+// run on the GB clock, a quarter of the GBA one, and only catch up when a
+// register is accessed or a buffer is mixed. Catching up jumps straight to
+// the next point where a channel or the frame sequencer steps, and every
+// change in the output goes to the mixer as a single step.
+class Psg {
+ public:
+  static constexpr u32 CyclesPerTick = 4;
+
+  Psg(Scheduler& scheduler, AudioMixer& mixer);
+  Psg(const Psg&) = delete;
+  Psg& operator=(const Psg&) = delete;
+
+  PsgRegister sound1cnt_l{*this, 0x00};
+  PsgRegister sound1cnt_h{*this, 0x02};
+  PsgRegister sound1cnt_x{*this, 0x04};
+  PsgRegister sound2cnt_l{*this, 0x08};
+  PsgRegister sound2cnt_h{*this, 0x0c};
+  PsgRegister sound3cnt_l{*this, 0x10};
+  PsgRegister sound3cnt_h{*this, 0x12};
+  PsgRegister sound3cnt_x{*this, 0x14};
+  PsgRegister sound4cnt_l{*this, 0x18};
+  PsgRegister sound4cnt_h{*this, 0x1c};
+  PsgRegister soundcnt_l{*this, 0x20};
+  PsgRegister soundcnt_x{*this, 0x24};
+  WaveRam wave_ram;
+
+  // Runs the channels up to cycle
+  void sync(u64 cycle);
+
+  // SOUNDCNT_X, with the channel status bits brought up to date on reads
+  PsgRegister& select_status_register(Mmu::DataOperation op);
+
+ private:
+  friend class PsgRegister;
+
+  using SquareChannel = Channel<SquareSource, LengthMod<64>, EnvelopeMod>;
+  using WaveChannel = Channel<WaveSource, LengthMod<256>, VolumeShiftMod>;
+  using NoiseChannel = Channel<NoiseSource, LengthMod<64>, EnvelopeMod>;
+
+  // offset is from SOUND1CNT_L
+  void write_register(u32 offset, u8 value);
+
+  void clock_sequencer();
+  void update_output(u64 cycle);
+
+  [[nodiscard]] u16 frequency(u32 low_offset) const {
+    return static_cast<u16>((m_registers[low_offset + 1] & 0x07) << 8 |
+                            m_registers[low_offset]);
+  }
+
+  Scheduler* m_scheduler;
+  AudioMixer* m_mixer;
+
+  SquareChannel m_square1{SquareSource{true}};
+  SquareChannel m_square2{SquareSource{false}};
+  // WaveSource reads 16 bytes, so it plays a copy of the selected bank
+  std::array<u8, 16> m_wave_samples{};
+  WaveChannel m_wave{WaveSource{m_wave_samples}};
+  NoiseChannel m_noise;
+
+  // The bytes last written, for registers that combine two of them
+  std::array<u8, 0x28> m_registers{};
+  bool m_power_on = false;
+
+  u64 m_cycle = 0;
+  // Ticks until the 512 Hz frame sequencer next steps
+  int m_sequencer_ticks = 8192;
+  int m_sequencer_step = 0;
+  std::array<u16, 2> m_output{};
+};
+
+}  // namespace gb::advance
@@ -0,0 +1,147 @@
+#include "gba/scheduler.h"
+#include <doctest/doctest.h>
+#include <limits>
+#include <vector>
+
+namespace gb::advance {
+
+void Scheduler::schedule_at(EventType type, u64 due) {
+  const auto slot = static_cast<u32>(type);
+  m_due[slot] = due;
+  if (m_heap_index[slot] == NotScheduled) {
+    m_heap[m_heap_size] = type;
+    m_heap_index[slot] = static_cast<u8>(m_heap_size);
+    sift_up(m_heap_size++);
+  } else {
+    // The new time can be earlier or later than the old one
+    sift_up(m_heap_index[slot]);
+    sift_down(m_heap_index[slot]);
+  }
+}
+
+void Scheduler::cancel(EventType type) {
+  if (const u8 index = m_heap_index[static_cast<u32>(type)];
+      index != NotScheduled) {
+    remove_at(index);
+  }
+}
+
+int Scheduler::cycles_until_next_event() const noexcept {
+  if (m_heap_size == 0) {
+    return std::numeric_limits<int>::max();
+  }
+  const u64 due = m_due[static_cast<u32>(m_heap[0])];
+  if (due <= m_now) {
+    return 0;
+  }
+  return static_cast<int>(
+      std::min<u64>(due - m_now, std::numeric_limits<int>::max()));
+}
+
+void Scheduler::run_due_events() {
+  while (m_heap_size != 0) {
+    const EventType type = m_heap[0];
+    const auto slot = static_cast<u32>(type);
+    const u64 due = m_due[slot];
+    if (due > m_now) {
+      break;
+    }
+    remove_at(0);
+    m_handlers[slot](static_cast<u32>(m_now - due));
+  }
+}
+
+bool Scheduler::earlier(std::size_t lhs, std::size_t rhs) const noexcept {
+  const auto lhs_slot = static_cast<u32>(m_heap[lhs]);
+  const auto rhs_slot = static_cast<u32>(m_heap[rhs]);
+  return m_due[lhs_slot] != m_due[rhs_slot] ? m_due[lhs_slot] < m_due[rhs_slot]
+                                            : lhs_slot < rhs_slot;
+}
+
+void Scheduler::swap_entries(std::size_t lhs, std::size_t rhs) noexcept {
+  std::swap(m_heap[lhs], m_heap[rhs]);
+  m_heap_index[static_cast<u32>(m_heap[lhs])] = static_cast<u8>(lhs);
+  m_heap_index[static_cast<u32>(m_heap[rhs])] = static_cast<u8>(rhs);
+}
+
+void Scheduler::sift_up(std::size_t index) noexcept {
+  while (index != 0) {
+    const std::size_t parent = (index - 1) / 2;
+    if (!earlier(index, parent)) {
+      break;
+    }
+    swap_entries(index, parent);
+    index = parent;
+  }
+}
+
+void Scheduler::sift_down(std::size_t index) noexcept {
+  while (true) {
+    const std::size_t left = index * 2 + 1;
+    const std::size_t right = left + 1;
+    std::size_t smallest = index;
+    if (left < m_heap_size && earlier(left, smallest)) {
+      smallest = left;
+    }
+    if (right < m_heap_size && earlier(right, smallest)) {
+      smallest = right;
+    }
+    if (smallest == index) {
+      break;
+    }
+    swap_entries(index, smallest);
+    index = smallest;
+  }
+}
+
+void Scheduler::remove_at(std::size_t index) noexcept {
+  const std::size_t last = --m_heap_size;
+  m_heap_index[static_cast<u32>(m_heap[index])] = NotScheduled;
+  if (index != last) {
+    m_heap[index] = m_heap[last];
+    m_heap_index[static_cast<u32>(m_heap[index])] = static_cast<u8>(index);
+    sift_up(index);
+    sift_down(m_heap_index[static_cast<u32>(m_heap[index])]);
+  }
+}
+
+TEST_CASE("Scheduler should fire events in due order") {
+  Scheduler scheduler;
+  std::vector<EventType> fired;
+  for (const EventType type :
+       {EventType::Lcd, EventType::AudioSample, EventType::Timer0Overflow,
+        EventType::Irq}) {
+    scheduler.set_handler(type,
+                          [&fired, type](u32) { fired.push_back(type); });
+  }
+
+  scheduler.schedule(EventType::Lcd, 960);
+  scheduler.schedule(EventType::AudioSample, 380);
+  scheduler.schedule(EventType::Timer0Overflow, 100);
+  // Moving an event replaces the pending one
+  scheduler.schedule(EventType::Timer0Overflow, 2000);
+  CHECK(scheduler.cycles_until_next_event() == 380);
+
+  scheduler.advance(1000);
+  scheduler.run_due_events();
+  CHECK(fired == std::vector{EventType::AudioSample, EventType::Lcd});
+  CHECK(scheduler.cycles_until_next_event() == 1000);
+
+  scheduler.cancel(EventType::Timer0Overflow);
+  CHECK_FALSE(scheduler.scheduled(EventType::Timer0Overflow));
+  CHECK(scheduler.cycles_until_next_event() ==
+        std::numeric_limits<int>::max());
+
+  // Handlers can schedule events that are due right away
+  scheduler.set_handler(EventType::Lcd, [&](u32 late) {
+    CHECK(late == 10);
+    scheduler.schedule(EventType::Irq, 0);
+  });
+  scheduler.schedule(EventType::Lcd, 0);
+  scheduler.advance(10);
+  fired.clear();
+  scheduler.run_due_events();
+  CHECK(fired == std::vector{EventType::Irq});
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,79 @@
+#pragma once
+#include <array>
+#include <functional>
+#include <utility>
+#include "types.h"
+
+namespace gb::advance {
+
+enum class EventType : u32 {
+  Lcd,
+  Timer0Overflow,
+  Timer1Overflow,
+  Timer2Overflow,
+  Timer3Overflow,
+  AudioSample,
+  Irq,
+};
+
+// Keeps the emulated clock and a min-heap of pending events, at most one per
+// type. The CPU runs until the earliest one is due, then run_due_events
+// calls the handlers. Scheduling a type that is already pending moves it.
+class Scheduler {
+ public:
+  static constexpr std::size_t EventTypeCount = 7;
+
+  // late is how many cycles after its due time the event fired
+  using Handler = std::function<void(u32 late)>;
+
+  void set_handler(EventType type, Handler handler) {
+    m_handlers[static_cast<u32>(type)] = std::move(handler);
+  }
+
+  // Fires type cycles from now
+  void schedule(EventType type, u32 cycles) {
+    schedule_at(type, m_now + cycles);
+  }
+
+  // Fires type at an absolute cycle, which may already have passed
+  void schedule_at(EventType type, u64 due);
+  void cancel(EventType type);
+
+  [[nodiscard]] bool scheduled(EventType type) const noexcept {
+    return m_heap_index[static_cast<u32>(type)] != NotScheduled;
+  }
+
+  [[nodiscard]] u64 now() const noexcept { return m_now; }
+
+  void advance(u32 cycles) noexcept { m_now += cycles; }
+
+  // 0 when an event is already due
+  [[nodiscard]] int cycles_until_next_event() const noexcept;
+
+  // Fires every due event in order, including ones the handlers schedule
+  // for now
+  void run_due_events();
+
+ private:
+  static constexpr u8 NotScheduled = 0xff;
+
+  [[nodiscard]] bool earlier(std::size_t lhs, std::size_t rhs) const noexcept;
+  void swap_entries(std::size_t lhs, std::size_t rhs) noexcept;
+  void sift_up(std::size_t index) noexcept;
+  void sift_down(std::size_t index) noexcept;
+  void remove_at(std::size_t index) noexcept;
+
+  u64 m_now = 0;
+  std::array<Handler, EventTypeCount> m_handlers;
+  std::array<u64, EventTypeCount> m_due{};
+  // Heap of event types ordered by due time, ties go to the lower type
+  std::array<EventType, EventTypeCount> m_heap{};
+  std::size_t m_heap_size = 0;
+  std::array<u8, EventTypeCount> m_heap_index = [] {
+    std::array<u8, EventTypeCount> index{};
+    index.fill(NotScheduled);
+    return index;
+  }();
+};
+
+}  // namespace gb::advance
@@ -0,0 +1,137 @@
+#pragma once
+#include "types.h"
+
+namespace gb::advance {
+enum class ShiftType : u32 {
+  LogicalLeft = 0,
+  LogicalRight,
+  ArithmeticRight,
+  RotateRight,
+};
+
+struct ShifterOutput {
+  u32 value;
+  bool carry;
+};
+
+[[nodiscard]] constexpr u32 rotr(u32 value, u32 amount) {
+  amount &= 31;
+  return (value >> amount) | (value << ((32 - amount) & 31));
+}
+
+[[nodiscard]] constexpr int popcount(u32 value) {
+#ifdef __GNUC__
+  return __builtin_popcount(value);
+#else
+  int count = 0;
+  for (; value != 0; value &= value - 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+// Undefined for 0
+[[nodiscard]] constexpr int count_trailing_zeros(u32 value) {
+#ifdef __GNUC__
+  return __builtin_ctz(value);
+#else
+  int count = 0;
+  for (; (value & 1) == 0; value >>= 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+// The kernels take a register-specified amount (0-255). An amount of 0
+// leaves the value and carry untouched.
+
+[[nodiscard]] constexpr ShifterOutput logical_shift_left(u32 value,
+                                                         u32 amount,
+                                                         bool carry_in) {
+  const u64 wide = static_cast<u64>(value) << (amount > 33 ? 33 : amount);
+  return {static_cast<u32>(wide),
+          amount == 0 ? carry_in : ((wide >> 32) & 1) != 0};
+}
+
+[[nodiscard]] constexpr ShifterOutput logical_shift_right(u32 value,
+                                                          u32 amount,
+                                                          bool carry_in) {
+  // The bit shifted out last ends up in bit 31 of the low half
+  const u64 wide =
+      (static_cast<u64>(value) << 32) >> (amount > 33 ? 33 : amount);
+  return {static_cast<u32>(wide >> 32),
+          amount == 0 ? carry_in : ((wide >> 31) & 1) != 0};
+}
+
+[[nodiscard]] constexpr ShifterOutput arithmetic_shift_right(u32 value,
+                                                             u32 amount,
+                                                             bool carry_in) {
+  const s64 wide = static_cast<s64>(static_cast<s32>(value)) *
+                   (static_cast<s64>(1) << 32);
+  const s64 shifted = wide >> (amount > 32 ? 32 : amount);
+  return {static_cast<u32>(static_cast<u64>(shifted) >> 32),
+          amount == 0 ? carry_in : ((shifted >> 31) & 1) != 0};
+}
+
+[[nodiscard]] constexpr ShifterOutput rotate_right(u32 value,
+                                                   u32 amount,
+                                                   bool carry_in) {
+  const u32 result = rotr(value, amount);
+  return {result, amount == 0 ? carry_in : (result >> 31) != 0};
+}
+
+[[nodiscard]] constexpr ShifterOutput rotate_right_extended(u32 value,
+                                                            bool carry_in) {
+  return {(static_cast<u32>(carry_in) << 31) | (value >> 1),
+          (value & 1) != 0};
+}
+
+[[nodiscard]] constexpr ShifterOutput shift_by_register(ShiftType type,
+                                                        u32 value,
+                                                        u32 amount,
+                                                        bool carry_in) {
+  amount &= 0xff;
+  switch (type) {
+    case ShiftType::LogicalLeft:
+      return logical_shift_left(value, amount, carry_in);
+    case ShiftType::LogicalRight:
+      return logical_shift_right(value, amount, carry_in);
+    case ShiftType::ArithmeticRight:
+      return arithmetic_shift_right(value, amount, carry_in);
+    case ShiftType::RotateRight:
+      return rotate_right(value, amount, carry_in);
+  }
+  return {value, carry_in};
+}
+
+// Shift by a 5 bit immediate, where 0 encodes LSR #32, ASR #32 and RRX
+[[nodiscard]] constexpr ShifterOutput shift_by_immediate(ShiftType type,
+                                                         u32 value,
+                                                         u32 amount,
+                                                         bool carry_in) {
+  amount &= 31;
+  switch (type) {
+    case ShiftType::LogicalLeft:
+      return logical_shift_left(value, amount, carry_in);
+    case ShiftType::LogicalRight:
+      return logical_shift_right(value, amount == 0 ? 32 : amount, carry_in);
+    case ShiftType::ArithmeticRight:
+      return arithmetic_shift_right(value, amount == 0 ? 32 : amount,
+                                    carry_in);
+    case ShiftType::RotateRight:
+      return amount == 0 ? rotate_right_extended(value, carry_in)
+                         : rotate_right(value, amount, carry_in);
+  }
+  return {value, carry_in};
+}
+
+// The rotated 8 bit immediate of a data processing instruction
+[[nodiscard]] constexpr ShifterOutput rotated_immediate(u32 instruction,
+                                                        bool carry_in) {
+  return rotate_right(instruction & 0xff, ((instruction >> 8) & 0xf) * 2,
+                      carry_in);
+}
+
+}  // namespace gb::advance
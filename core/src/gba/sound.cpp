@@ -1,68 +1,103 @@
 #include "gba/sound.h"
-#include <SDL2/SDL_audio.h>
+#include <doctest/doctest.h>
 #include <fmt/printf.h>
+#include "gba/cpu.h"
 #include "gba/dma.h"
+#include "gba/mmu.h"
+#include "gba/scheduler.h"
+#include "gba/shifter.h"
 
 namespace gb::advance {
 
-void Sound::run_dma_transfer(u32 fifo_addr) {
-  const auto dmas = m_dmas->span();
-  const auto end = dmas.begin() + 3;
-  const auto found_dma =
-      std::find_if(dmas.begin() + 1, end, [fifo_addr](const auto& dma) {
-        return dma.dest == fifo_addr && dma.control().start_timing() ==
-                                            Dma::Control::StartTiming::Special;
-      });
-
-  if (found_dma != end) {
-    // Set fixed dest and 4 * 4 byte transfer
-    found_dma->count = 4;
-    found_dma->control().write_byte(0, 2 << 5);
-    found_dma->control().write_byte(
-        1, ((found_dma->control().data() >> 8) & 0xfa) | 0b1000'0100);
-    found_dma->run();
+void Sound::run_dma_transfer(SoundFifo& fifo, u32 fifo_addr) {
+  // Only DMA1 and DMA2 feed the FIFOs
+  for (u32 armed = m_dmas->armed(Dma::Control::StartTiming::Special) & 0b0110;
+       armed != 0; armed &= armed - 1) {
+    Dma& dma =
+        m_dmas->dma(static_cast<Dma::DmaNumber>(count_trailing_zeros(armed)));
+    if (dma.dest == fifo_addr) {
+      dma.run_fifo(fifo);
+      return;
+    }
   }
 }
 
-static constexpr u32 MasterCycles = 16777216 / 44100;
-
-void Sound::update(u32 cycles, int& next_event_cycles) {
-  m_fifo_timer += cycles;
-  m_master_timer += cycles;
-
-  // TODO: different sample rates
+Sound::Sound(AudioMixer::Callback sample_callback,
+             Scheduler& scheduler,
+             Dmas& dmas,
+             AudioFormat format)
+    : m_mixer{std::move(sample_callback), format},
+      psg{scheduler, m_mixer},
+      m_scheduler{&scheduler},
+      m_dmas{&dmas} {
+  m_scheduler->set_handler(EventType::AudioSample,
+                           [this](u32 late) { mix(late); });
+  m_scheduler->schedule(EventType::AudioSample, m_mixer.buffer_cycles());
+}
 
-  if (m_master_timer >= MasterCycles) {
-    m_master_timer -= MasterCycles;
-    SampleType mixed_sample = 0;
-    const auto sample_a =
-        static_cast<SampleType>(fifo_a.current_sample()) / 1024.0F;
-    const auto sample_b =
-        static_cast<SampleType>(fifo_b.current_sample()) / 1024.0F;
-    SDL_MixAudioFormat(reinterpret_cast<Uint8*>(&mixed_sample),
-                       reinterpret_cast<const Uint8*>(&sample_a), AUDIO_F32SYS,
-                       sizeof(SampleType), 50);
-    SDL_MixAudioFormat(reinterpret_cast<Uint8*>(&mixed_sample),
-                       reinterpret_cast<const Uint8*>(&sample_b), AUDIO_F32SYS,
-                       sizeof(SampleType), 50);
-    m_sample_buffer.push_back(mixed_sample);
-    m_sample_buffer.push_back(mixed_sample);
-    if (m_sample_buffer.size() >= 1024) {
-      m_sample_callback(m_sample_buffer);
-      m_sample_buffer.clear();
-    }
-  }
-  next_event_cycles = std::min(next_event_cycles,
-                               static_cast<int>(MasterCycles - m_master_timer));
+void Sound::mix(u32 late) {
+  const u64 now = m_scheduler->now();
+  psg.sync(now);
+  m_mixer.mix_until(now, soundcnt_high.data(), static_cast<u16>(soundbias));
+  m_scheduler->schedule_at(EventType::AudioSample,
+                           now - late + m_mixer.buffer_cycles());
 }
 
-void Sound::read_fifo_sample(SoundFifo& sound_fifo, u32 addr) {
+void Sound::read_fifo_sample(SoundFifo& sound_fifo,
+                             u32 addr,
+                             DirectSoundChannel channel) {
   if (sound_fifo.queued_samples() <= 16) {
-    run_dma_transfer(addr);
+    run_dma_transfer(sound_fifo, addr);
   }
   if (sound_fifo.queued_samples() > 0) {
     sound_fifo.read_sample();
+    m_mixer.push(m_scheduler->now(), channel, sound_fifo.current_sample());
   }
 }
 
+TEST_CASE("sound DMA should refill the FIFO four words at a time") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  Sound sound{[](nonstd::span<const u8>) {}, cpu.scheduler(), dmas};
+  mmu.hardware.cpu = &cpu;
+  mmu.hardware.dmas = &dmas;
+  mmu.hardware.sound = &sound;
+
+  // A word store queues its bytes lowest first
+  mmu.set<u32>(hardware::FIFO_B, 0x04030201);
+  CHECK(sound.fifo_b.queued_samples() == 4);
+  sound.read_fifo_b_sample();
+  CHECK(sound.fifo_b.current_sample() == 1);
+
+  for (u32 i = 0; i < 8; ++i) {
+    mmu.set<u32>(Mmu::EWramBegin + i * 4, 0x01010101 * (i + 1));
+  }
+  mmu.set<u32>(hardware::DMA1SAD, Mmu::EWramBegin);
+  mmu.set<u32>(hardware::DMA1DAD, hardware::FIFO_A);
+  mmu.set<u32>(hardware::DMA1CNT_L, 0xb600'0000);
+
+  sound.read_fifo_a_sample();
+  CHECK(sound.fifo_a.current_sample() == 1);
+  CHECK(sound.fifo_a.queued_samples() == 15);
+  CHECK(cpu.take_stalled_cycles() > 0);
+
+  // Still at most half full, so the channel repeats from where it left off
+  sound.read_fifo_a_sample();
+  CHECK(sound.fifo_a.queued_samples() == 30);
+
+  mmu.set<u16>(hardware::DMA1CNT_H, 0);
+  for (u32 i = 0; i < 14; ++i) {
+    sound.read_fifo_a_sample();
+  }
+  CHECK(sound.fifo_a.current_sample() == 4);
+  sound.read_fifo_a_sample();
+  CHECK(sound.fifo_a.current_sample() == 5);
+
+  // An empty FIFO holds its last sample
+  sound.fifo_a.clear();
+  sound.read_fifo_a_sample();
+  CHECK(sound.fifo_a.current_sample() == 5);
+}
+
 }  // namespace gb::advance
@@ -1,20 +1,40 @@
 #pragma once
-#include <functional>
-#include <vector>
+#include <array>
+#include "gba/audio_mixer.h"
+#include "gba/psg.h"
 #include "io_registers.h"
-#include "ring_buffer.h"
 #include "utils.h"
 
 namespace gb::advance {
+// The 32 byte queue behind FIFO_A and FIFO_B. Writing to a full FIFO drops
+// the oldest sample and reading an empty one keeps playing the last one, so
+// neither side needs to check first.
 class SoundFifo {
  public:
-  void write_byte([[maybe_unused]] unsigned int byte, u8 value) {
-    if (m_sample_buffer.size() >= m_sample_buffer.capacity()) {
-      m_sample_buffer.next();
+  static constexpr u32 Capacity = 32;
+
+  void write_byte([[maybe_unused]] unsigned int byte, u8 value) noexcept {
+    push(static_cast<s8>(value));
+  }
+
+  // Enqueues the low size bytes of value, lowest first, like a CPU store of
+  // that width
+  void write(u32 value, u32 size) noexcept {
+    if (m_size + size > Capacity) {
+      for (u32 i = 0; i < size; ++i) {
+        push(static_cast<s8>(value >> (i * 8)));
+      }
+      return;
+    }
+    for (u32 i = 0; i < size; ++i) {
+      m_samples[(m_begin + m_size + i) & CapacityMask] =
+          static_cast<s8>(value >> (i * 8));
     }
-    m_sample_buffer.push_back(value);
+    m_size += size;
   }
 
+  void write_word(u32 value) noexcept { write(value, sizeof(u32)); }
+
   [[nodiscard]] std::size_t size_bytes() const noexcept { return 4; }
 
   [[nodiscard]] nonstd::span<u8> byte_span() const noexcept {
@@ -22,21 +42,41 @@ class SoundFifo {
                             static_cast<nonstd::span<u8>::index_type>(0)};
   }
 
-  void clear() noexcept { m_sample_buffer.clear(); }
+  void clear() noexcept {
+    m_begin = 0;
+    m_size = 0;
+  }
 
   void on_after_write() const noexcept {}
 
-  void read_sample() { m_current_sample = m_sample_buffer.next(); }
+  void read_sample() noexcept {
+    if (m_size != 0) {
+      m_current_sample = m_samples[m_begin];
+      m_begin = (m_begin + 1) & CapacityMask;
+      --m_size;
+    }
+  }
 
   [[nodiscard]] s8 current_sample() const noexcept { return m_current_sample; }
 
-  [[nodiscard]] std::size_t queued_samples() const noexcept {
-    return m_sample_buffer.size();
-  }
+  [[nodiscard]] std::size_t queued_samples() const noexcept { return m_size; }
 
  private:
+  static constexpr u32 CapacityMask = Capacity - 1;
+
+  void push(s8 sample) noexcept {
+    if (m_size == Capacity) {
+      m_begin = (m_begin + 1) & CapacityMask;
+      --m_size;
+    }
+    m_samples[(m_begin + m_size) & CapacityMask] = sample;
+    ++m_size;
+  }
+
   s8 m_current_sample = 0;
-  RingBuffer<s8, 32> m_sample_buffer;
+  std::array<s8, Capacity> m_samples{};
+  u32 m_begin = 0;
+  u32 m_size = 0;
 };
 
 class SoundcntLow : public Integer<u16> {
@@ -71,34 +111,42 @@ class SoundcntHigh : public Integer<u16> {
 };
 
 class Dmas;
+class Scheduler;
 
 class Sound {
+  // Constructed before psg, which keeps a pointer to it
+  AudioMixer m_mixer;
+
  public:
-  using SampleType = float;
-  Sound(std::function<void(nonstd::span<SampleType>)> sample_callback,
-        Dmas& dmas)
-      : m_sample_callback{std::move(sample_callback)}, m_dmas{&dmas} {
-    m_sample_buffer.reserve(1024);
-  }
+  Sound(AudioMixer::Callback sample_callback,
+        Scheduler& scheduler,
+        Dmas& dmas,
+        AudioFormat format = {});
   SoundFifo fifo_a;
   SoundFifo fifo_b;
   u32 soundbias = 0x200;
 
   SoundcntHigh soundcnt_high{fifo_a, fifo_b};
+  Psg psg;
 
-  void run_dma_transfer(u32 fifo_addr);
-
-  void read_fifo_a_sample() { read_fifo_sample(fifo_a, hardware::FIFO_A); }
-  void read_fifo_b_sample() { read_fifo_sample(fifo_b, hardware::FIFO_B); }
+  // Refills fifo from the sound DMA channel pointed at fifo_addr, if any
+  void run_dma_transfer(SoundFifo& fifo, u32 fifo_addr);
 
-  void update(u32 cycles, int& next_event_cycles);
+  void read_fifo_a_sample() {
+    read_fifo_sample(fifo_a, hardware::FIFO_A, DirectSoundChannel::A);
+  }
+  void read_fifo_b_sample() {
+    read_fifo_sample(fifo_b, hardware::FIFO_B, DirectSoundChannel::B);
+  }
 
  private:
-  void read_fifo_sample(SoundFifo& sound_fifo, u32 addr);
-  std::vector<SampleType> m_sample_buffer{};
-  std::function<void(nonstd::span<SampleType>)> m_sample_callback;
+  // Mixes a buffer worth of frames, fired by the AudioSample event
+  void mix(u32 late);
+
+  void read_fifo_sample(SoundFifo& sound_fifo,
+                        u32 addr,
+                        DirectSoundChannel channel);
+  Scheduler* m_scheduler;
   Dmas* m_dmas;
-  u32 m_fifo_timer = 0;
-  u32 m_master_timer = 0;
 };
 }  // namespace gb::advance
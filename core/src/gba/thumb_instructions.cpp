@@ -26,7 +26,7 @@ u32 add_subtract(Cpu& cpu, u16 instruction) {
                         : cpu.reg(static_cast<Register>(register_or_value));
 
   common::data_processing<subtract ? Opcode::Sub : Opcode::Add, true>(
-      cpu, dest_reg, cpu.reg(src_reg), value, cpu.program_status().carry());
+      cpu, dest_reg, cpu.reg(src_reg), value, cpu.carry() != 0);
   return 1;
 }
 
@@ -35,7 +35,7 @@ u32 move_compare_add_subtract_immediate(Cpu& cpu, u16 instruction) {
   const u32 immediate = instruction & 0xff;
   common::data_processing<opcode, true>(cpu, dest_reg, cpu.reg(dest_reg),
                                         immediate,
-                                        cpu.program_status().carry());
+                                        cpu.carry() != 0);
   return 1;
 }
 
@@ -97,7 +97,7 @@ u32 alu_operation(Cpu& cpu, u16 instruction) {
         cpu, dest_reg,
         cpu.reg(translated_opcode == Opcode::Rsb ? src_reg : dest_reg),
         translated_opcode == Opcode::Rsb ? 0 : cpu.reg(src_reg),
-        cpu.program_status().carry());
+        cpu.carry() != 0);
   }
 
   return 1;
@@ -122,7 +122,7 @@ u32 hi_register_operation(Cpu& cpu, u16 instruction) {
     common::data_processing<translated_opcode,
                             translated_opcode == Opcode::Cmp>(
         cpu, dest_reg, cpu.reg(dest_reg), cpu.reg(src_reg),
-        cpu.program_status().carry());
+        cpu.carry() != 0);
   }
   return 2;
 }
@@ -135,7 +135,8 @@ u32 pc_relative_load(Cpu& cpu, u16 instruction) {
 
   cpu.set_reg(dest_reg, cpu.mmu()->at<u32>(addr));
 
-  return cpu.mmu()->wait_cycles(addr, load_store_cycles(dest_reg, true));
+  return cpu.mmu()->wait_cycles(addr, load_store_cycles(dest_reg, true),
+                                AccessWidth::Word);
 }
 
 template <bool load,
@@ -166,7 +167,8 @@ u32 load_store(Cpu& cpu, u16 instruction) {
     cpu.mmu()->set(resolved_addr, static_cast<Type>(cpu.reg(dest_reg)));
   }
   return cpu.mmu()->wait_cycles(resolved_addr,
-                                load_store_cycles(dest_reg, load));
+                                load_store_cycles(dest_reg, load),
+                                access_width<Type>());
 }
 
 template <bool load, Register dest_reg>
@@ -175,12 +177,13 @@ u32 sp_relative_load_store(Cpu& cpu, u16 instruction) {
 
   if constexpr (load) {
     const auto value = cpu.mmu()->at<u32>(addr & ~0b11);
-    cpu.set_reg(dest_reg, rotate_right(value, (addr & 0b11) * 8));
+    cpu.set_reg(dest_reg, rotr(value, (addr & 0b11) * 8));
   } else {
     cpu.mmu()->set(addr, cpu.reg(dest_reg));
   }
 
-  return cpu.mmu()->wait_cycles(addr, load_store_cycles(dest_reg, load));
+  return cpu.mmu()->wait_cycles(addr, load_store_cycles(dest_reg, load),
+                                AccessWidth::Word);
 }
 
 template <bool sp, Register dest_reg>
@@ -215,7 +218,8 @@ u32 push_pop_registers(Cpu& cpu, u16 instruction) {
   u32 cycles = 0;
 
   const auto add_cycles = [&cycles, &cpu](u32 addr, Register reg) {
-    cycles += cpu.mmu()->wait_cycles(addr, load_store_cycles(reg, load));
+    cycles += cpu.mmu()->wait_cycles(addr, load_store_cycles(reg, load),
+                                     AccessWidth::Word);
   };
 
   if constexpr (load) {
@@ -253,33 +257,6 @@ u32 push_pop_registers(Cpu& cpu, u16 instruction) {
   return cycles;
 }
 
-static int popcount(int num) {
-#ifdef __GNUC__
-  return __builtin_popcount(num);
-#else
-  int i = 0;
-  while (num) {
-    ++i;
-    num &= (num - 1);
-  }
-  return i;
-#endif
-}
-
-static int ctz(int num) {
-#ifdef __GNUC__
-  return __builtin_ctz(num);
-#else
-  int i = 0;
-  for (; i < 8 * sizeof(int); ++i) {
-    if (test_bit(num, i)) {
-      return i;
-    }
-  }
-  return i;
-#endif
-}
-
 template <bool load, Register base_reg>
 u32 multiple_load_store(Cpu& cpu, u16 instruction) {
   u32 base = cpu.reg(base_reg);
@@ -296,7 +273,7 @@ u32 multiple_load_store(Cpu& cpu, u16 instruction) {
     base += 64;
   } else {
     const auto count = popcount(reg_list);
-    const auto first_bit = ctz(reg_list);
+    const auto first_bit = count_trailing_zeros(reg_list);
 
     for (int i = first_bit; i < 8; ++i) {
       if (test_bit(instruction, i)) {
@@ -313,7 +290,8 @@ u32 multiple_load_store(Cpu& cpu, u16 instruction) {
           }
         }
         cycles += cpu.mmu()->wait_cycles(
-            base, load_store_cycles(load ? reg : base_reg, load));
+            base, load_store_cycles(load ? reg : base_reg, load),
+            AccessWidth::Word);
 
         base += 4;
       }
@@ -0,0 +1,72 @@
+#include "gba/tile_cache.h"
+#include <doctest/doctest.h>
+#include "gba/cpu.h"
+
+namespace gb::advance {
+
+void TileCache::decode_4bpp(u32 tile) {
+  const u8* pixels = &m_vram[tile * Mmu::VramBlockSize];
+  u64* rows = &m_rows[tile * TileSize];
+  for (u32 row = 0; row < TileSize; ++row) {
+    u32 packed;
+    std::memcpy(&packed, pixels + row * sizeof(u32), sizeof(u32));
+    // Spread nibble n out to byte n
+    u64 spread = packed;
+    spread = (spread | spread << 16) & 0x0000ffff0000ffff;
+    spread = (spread | spread << 8) & 0x00ff00ff00ff00ff;
+    spread = (spread | spread << 4) & 0x0f0f0f0f0f0f0f0f;
+    rows[row] = spread;
+  }
+}
+
+TEST_CASE("TileCache should decode tiles again after VRAM writes") {
+  Mmu mmu;
+  TileCache tile_cache{mmu.vram(), mmu.vram_writes()};
+
+  mmu.set<u32>(Mmu::VramBegin + 0x20, 0x76543210);
+  CHECK(tile_cache.row_4bpp(0x20, 0, false) == 0x0706050403020100);
+  CHECK(tile_cache.row_4bpp(0x20, 0, true) == 0x0001020304050607);
+  CHECK(tile_cache.row_8bpp(0x20, 0, false) == 0x76543210);
+
+  mmu.set<u16>(Mmu::VramBegin + 0x20, 0xffff);
+  CHECK(tile_cache.row_4bpp(0x20, 0, false) == 0x070605040f0f0f0f);
+
+  // DMA into the upper mirror of sprite VRAM
+  const u32 source = Mmu::EWramBegin;
+  mmu.set<u32>(source, 0x11111111);
+  mmu.copy_memory({source, Mmu::AddrOp::Fixed},
+                  {Mmu::VramBegin + 0x18020, Mmu::AddrOp::Increment}, 8,
+                  sizeof(u32));
+  CHECK(tile_cache.row_4bpp(0x10020, 7, false) == 0x0101010101010101);
+}
+
+TEST_CASE("TileCache should decode tiles again after LZ77UnCompVram") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  mmu.hardware.cpu = &cpu;
+  TileCache tile_cache{mmu.vram(), mmu.vram_writes()};
+
+  mmu.set<u32>(Mmu::VramBegin + 0x20, 0x76543210);
+  CHECK(tile_cache.row_4bpp(0x20, 0, false) == 0x0706050403020100);
+
+  // 32 bytes of 0x22, as four blocks of eight literals
+  u32 source = Mmu::EWramBegin;
+  mmu.set<u32>(source, 0x10 | 32 << 8);
+  source += sizeof(u32);
+  for (u32 block = 0; block < 4; ++block) {
+    mmu.set<u8>(source++, 0);
+    for (u32 i = 0; i < 8; ++i) {
+      mmu.set<u8>(source++, 0x22);
+    }
+  }
+
+  cpu.set_thumb(true);
+  cpu.set_reg(Register::R0, Mmu::EWramBegin);
+  cpu.set_reg(Register::R1, Mmu::VramBegin + 0x20);
+  // swi 0x12
+  (void)execute_software_interrupt(cpu, 0x12);
+  CHECK(tile_cache.row_4bpp(0x20, 0, false) == 0x0202020202020202);
+  CHECK(tile_cache.row_4bpp(0x20, 7, false) == 0x0202020202020202);
+}
+
+}  // namespace gb::advance
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstring>
+#include <nonstd/span.hpp>
+#include <vector>
+#include "gba/mmu.h"
+#include "types.h"
+
+namespace gb::advance {
+constexpr u32 TileSize = 8;
+
+// VRAM tiles as rows of 8 palette indices, a byte each with the leftmost
+// pixel in the low byte, so renderers take a tile row at a time and flipping
+// one is a byte swap. 4bpp tiles are decoded the first time they're read
+// after Mmu marks them written, 8bpp tiles already hold an index per byte.
+// Tiles running past the end of VRAM are transparent.
+class TileCache {
+ public:
+  TileCache(nonstd::span<const u8> vram, Mmu::VramWrites& writes)
+      : m_vram{vram},
+        m_writes{&writes},
+        m_rows(vram.size() / Mmu::VramBlockSize * TileSize) {}
+
+  // offset is where the tile starts in VRAM
+  [[nodiscard]] u64 row_4bpp(u32 offset, u32 row, bool horizontal_flip) {
+    if (offset + Mmu::VramBlockSize > m_vram.size()) {
+      return 0;
+    }
+    const u32 tile = offset / Mmu::VramBlockSize;
+    u64& written = (*m_writes)[tile / 64];
+    const u64 tile_bit = u64{1} << (tile % 64);
+    if ((written & tile_bit) != 0) {
+      decode_4bpp(tile);
+      written &= ~tile_bit;
+    }
+    return flip(m_rows[tile * TileSize + row], horizontal_flip);
+  }
+
+  [[nodiscard]] u64 row_8bpp(u32 offset, u32 row, bool horizontal_flip) const {
+    if (offset + 2 * Mmu::VramBlockSize > m_vram.size()) {
+      return 0;
+    }
+    u64 pixels;
+    std::memcpy(&pixels, &m_vram[offset + row * TileSize], sizeof(u64));
+    return flip(pixels, horizontal_flip);
+  }
+
+ private:
+  static u64 flip(u64 row, bool horizontal_flip) {
+    if (!horizontal_flip) {
+      return row;
+    }
+#ifdef _MSC_VER
+    return _byteswap_uint64(row);
+#else
+    return __builtin_bswap64(row);
+#endif
+  }
+
+  void decode_4bpp(u32 tile);
+
+  nonstd::span<const u8> m_vram;
+  Mmu::VramWrites* m_writes;
+  std::vector<u64> m_rows;
+};
+
+}  // namespace gb::advance
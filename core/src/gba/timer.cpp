@@ -1,88 +1,87 @@
 #include "gba/timer.h"
 #include <doctest/doctest.h>
+#include <algorithm>
 #include "gba/cpu.h"
+#include "gba/dma.h"
 #include "gba/sound.h"
 
 namespace gb::advance {
 
-bool Timer::increment_counter() {
-  const u16 next_counter = ++counter;
-  const bool did_overflow = next_counter == 0;
+Timer::Timer(Cpu& cpu, Sound& sound, int timer_number)
+    : m_cpu{&cpu},
+      m_sound{&sound},
+      m_timer_number{timer_number},
+      m_timer_interrupt{timer_interrupts[timer_number]},
+      m_overflow_event{static_cast<EventType>(
+          static_cast<u32>(EventType::Timer0Overflow) + timer_number)} {
+  m_cpu->scheduler().set_handler(
+      m_overflow_event, [this](u32 late) { on_overflow_event(late); });
+}
 
-  if (did_overflow) {
-    counter = reload_value;
-    if (control.interrupt()) {
-      m_cpu->interrupts_requested.set_interrupt(m_timer_interrupt, true);
-    }
-
-    if (m_sound->soundcnt_high.dma_sound_a_timer() == m_timer_number) {
-      m_sound->read_fifo_a_sample();
-    }
-    if (m_sound->soundcnt_high.dma_sound_b_timer() == m_timer_number) {
-      m_sound->read_fifo_b_sample();
-    }
+void Timer::sync() {
+  if (!running()) {
+    return;
   }
+  const u32 prescaler = control.cycles();
+  // The overflow event fires before the counter can wrap
+  const u64 ticks = std::min<u64>((m_cpu->scheduler().now() - m_start) /
+                                      prescaler,
+                                  0xffff - counter);
+  counter += static_cast<u16>(ticks);
+  m_start += ticks * prescaler;
+}
 
-  return did_overflow;
+void Timer::restart(bool reload) {
+  if (reload) {
+    counter = reload_value;
+  }
+  m_start = m_cpu->scheduler().now();
+  reschedule();
 }
-bool Timer::update(u32 cycles) {
-  if (control.enabled()) {
-    // bool did_overflow = false;
-    const u32 overflow_cycles = control.cycles();
-    m_cycles += cycles;
-
-#if 1
-    if (m_cycles >= overflow_cycles && !control.count_up()) {
-      const auto count =
-          overflow_cycles != 1 ? m_cycles / overflow_cycles : m_cycles;
-      m_cycles -= count * overflow_cycles;
-
-      const u32 next_counter = counter + count;
-      counter = next_counter & 0xffff;
-
-      if (next_counter > std::numeric_limits<u16>::max()) {
-        // TODO: Why does -1 work? Kirby's Nightmare in Dream Land was crackling
-        // without it
-        counter =
-            reload_value + next_counter - std::numeric_limits<u16>::max() - 1;
-        if (control.interrupt()) {
-          m_cpu->interrupts_requested.set_interrupt(m_timer_interrupt, true);
-        }
-
-        if (m_sound->soundcnt_high.dma_sound_a_timer() == m_timer_number) {
-          m_sound->read_fifo_a_sample();
-        }
-        if (m_sound->soundcnt_high.dma_sound_b_timer() == m_timer_number) {
-          m_sound->read_fifo_b_sample();
-        }
-        return true;
-      }
-    }
-
-#else
-    while (m_cycles >= overflow_cycles) {
-      m_cycles -= overflow_cycles;
-      if (!control.count_up()) {
-        const bool overflow = increment_counter();
-        did_overflow = did_overflow || overflow;
-      }
-    }
-    return did_overflow;
-#endif
+
+void Timer::reschedule() {
+  Scheduler& scheduler = m_cpu->scheduler();
+  if (!running()) {
+    scheduler.cancel(m_overflow_event);
+    return;
   }
-  return false;
+  // Overflows that were due earlier in the slice still fire one by one
+  const u64 ticks = 0x10000 - counter;
+  scheduler.schedule_at(m_overflow_event, m_start + ticks * control.cycles());
 }
 
-static bool handle_count_up(Timer& timer, bool prev_did_overflow, u32 cycles) {
-  return timer.control.count_up() && prev_did_overflow
-             ? timer.increment_counter()
-             : timer.update(cycles);
+void Timer::on_overflow_event(u32 late) {
+  counter = reload_value;
+  m_start = m_cpu->scheduler().now() - late;
+  overflow();
+  reschedule();
 }
 
-void Timers::update(u32 cycles) {
-  bool did_overflow = handle_count_up(timer1, timer0.update(cycles), cycles);
-  did_overflow = handle_count_up(timer2, did_overflow, cycles);
-  handle_count_up(timer3, did_overflow, cycles);
+void Timer::overflow() {
+  if (control.interrupt()) {
+    m_cpu->request_interrupt(m_timer_interrupt);
+  }
+
+  if (m_sound->soundcnt_high.dma_sound_a_timer() == m_timer_number) {
+    m_sound->read_fifo_a_sample();
+  }
+  if (m_sound->soundcnt_high.dma_sound_b_timer() == m_timer_number) {
+    m_sound->read_fifo_b_sample();
+  }
+
+  if (m_next != nullptr && m_next->control.enabled() &&
+      m_next->control.count_up()) {
+    m_next->increment_counter();
+  }
+}
+
+bool Timer::increment_counter() {
+  if (++counter != 0) {
+    return false;
+  }
+  counter = reload_value;
+  overflow();
+  return true;
 }
 
 TEST_CASE("Timer::Control::cycles() should produce the correct values") {
@@ -100,4 +99,36 @@ TEST_CASE("Timer::Control::cycles() should produce the correct values") {
   CHECK(control.cycles() == 1024);
 }
 
+TEST_CASE("Timers should count lazily and overflow on time") {
+  Mmu mmu;
+  Cpu cpu{mmu};
+  Dmas dmas{mmu, cpu};
+  Sound sound{[](auto) {}, cpu.scheduler(), dmas};
+  Timers timers{cpu, sound};
+  Scheduler& scheduler = cpu.scheduler();
+
+  timers.timer0.reload_value = 0xfff0;
+  timers.timer0.control.write_byte(0, 0b1100'0000);
+  timers.timer1.control.write_byte(0, 0b1000'0100);
+
+  scheduler.advance(8);
+  CHECK(timers.timer0.select_counter_register(Mmu::DataOperation::Read) ==
+        0xfff8);
+
+  // Three overflows in one slice are all counted
+  scheduler.advance(8 + 0x10 * 2 + 3);
+  scheduler.run_due_events();
+  CHECK(timers.timer1.counter == 3);
+  CHECK(timers.timer0.select_counter_register(Mmu::DataOperation::Read) ==
+        0xfff3);
+  CHECK(cpu.interrupts_requested.data() ==
+        (1U << static_cast<u32>(Interrupt::Timer0Overflow)));
+
+  // Switching to the 64 cycle prescaler keeps the count so far
+  timers.timer0.control.write_byte(0, 0b1000'0001);
+  scheduler.advance(64 * 2);
+  CHECK(timers.timer0.select_counter_register(Mmu::DataOperation::Read) ==
+        0xfff5);
+}
+
 }  // namespace gb::advance
@@ -3,6 +3,7 @@
 #include "gba/hardware.h"
 #include "gba/interrupts.h"
 #include "gba/mmu.h"
+#include "gba/scheduler.h"
 #include "utils.h"
 
 namespace gb::advance {
@@ -19,10 +20,15 @@ class Timer {
         : Integer::Integer{0}, m_timer{&timer} {}
 
     void write_byte(unsigned int byte, u8 value) {
-      if (byte == 0 && !enabled() && gb::test_bit(value, 7)) {
-        m_timer->counter = m_timer->reload_value;
+      if (byte != 0) {
+        Integer::write_byte(byte, value);
+        return;
       }
+      // The counter runs with the old settings up to this point
+      m_timer->sync();
+      const bool starting = !enabled() && gb::test_bit(value, 7);
       Integer::write_byte(byte, value);
+      m_timer->restart(starting);
     }
 
     [[nodiscard]] u32 cycles() const {
@@ -44,23 +50,26 @@ class Timer {
     Timer* m_timer;
   };
 
+  // Only up to date after sync() while the timer runs off the clock
   u16 counter = 0;
   u16 reload_value = 0;
   Control control{*this};
 
-  Timer(Cpu& cpu, Sound& sound, int timer_number)
-      : m_cpu{&cpu},
-        m_sound{&sound},
-        m_timer_number{timer_number},
-        m_timer_interrupt{timer_interrupts[timer_number]} {}
+  Timer(Cpu& cpu, Sound& sound, int timer_number);
 
+  // The timer that counts this one's overflows when it is in count up mode
+  void set_next(Timer& next) { m_next = &next; }
+
+  // Ticks a count up timer once, returning true when it overflows
   bool increment_counter();
 
-  bool update(u32 cycles);
+  // Brings counter up to the current cycle
+  void sync();
 
   u16& select_counter_register(Mmu::DataOperation op) {
     switch (op) {
       case Mmu::DataOperation::Read:
+        sync();
         return counter;
       case Mmu::DataOperation::Write:
         return reload_value;
@@ -76,11 +85,30 @@ class Timer {
       Interrupt::Timer3Overflow,
   };
 
+  // Timers that aren't counting up run off the clock
+  [[nodiscard]] bool running() const {
+    return control.enabled() && !control.count_up();
+  }
+
+  // Counting starts over from now after a control write
+  void restart(bool reload);
+
+  // Schedules the next overflow, or cancels it when the timer isn't running
+  void reschedule();
+
+  void on_overflow_event(u32 late);
+
+  // Interrupts, sound FIFOs and the count up cascade
+  void overflow();
+
   Cpu* m_cpu;
   Sound* m_sound;
+  Timer* m_next = nullptr;
   int m_timer_number;
   Interrupt m_timer_interrupt;
-  u32 m_cycles = 0;
+  EventType m_overflow_event;
+  // The cycle at which counter held its current value
+  u64 m_start = 0;
 };
 
 struct Timers {
@@ -93,8 +121,13 @@ struct Timers {
       : timer0{cpu, sound, 0},
         timer1{cpu, sound, 1},
         timer2{cpu, sound, 2},
-        timer3{cpu, sound, 3} {}
+        timer3{cpu, sound, 3} {
+    timer0.set_next(timer1);
+    timer1.set_next(timer2);
+    timer2.set_next(timer3);
+  }
 
-  void update(u32 cycles);
+  Timers(const Timers&) = delete;
+  Timers& operator=(const Timers&) = delete;
 };
 }  // namespace gb::advance
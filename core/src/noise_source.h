@@ -83,5 +83,10 @@ class NoiseSource {
     }
   }
   u8 volume() const { return output; }
+
+  // Ticks until update next shifts the LFSR, or -1 if it never will
+  [[nodiscard]] int ticks_until_step() const {
+    return prescalar_divider < 14 ? timer_base - timer : -1;
+  }
 };
 }  // namespace gb
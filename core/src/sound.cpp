@@ -3,7 +3,6 @@
 #include <fmt/ostream.h>
 #include <array>
 #include <numeric>
-#include <thread>
 #include "memory.h"
 #include "sound.h"
 #ifdef __EMSCRIPTEN__
@@ -15,13 +14,13 @@ static float dac_output(u8 volume) {
   return static_cast<float>(volume) / 15.0f;
 }
 
-Sound::Sound(Memory& memory, SDL_AudioDeviceID device)
+Sound::Sound(Memory& memory, AudioRing& audio_ring)
     : m_memory{&memory},
       square1{{true}},
       square2{{false}},
       wave_channel{{memory.get_range({0xff30, 0xff3f})}},
-      audio_device{device} {
-  sample_buffer.reserve(4096);
+      m_audio_ring{&audio_ring} {
+  sample_buffer.reserve(SOUND_PUSH_FRAMES);
   noise_samples.reserve(95);
 }
 
@@ -222,21 +221,13 @@ void Sound::update(int ticks) {
     const float left_sample = mix_samples(frame, left_output);
     const float right_sample = mix_samples(frame, right_output);
 
-    sample_buffer.push_back(left_sample);
-    sample_buffer.push_back(right_sample);
+    sample_buffer.push_back({left_sample, right_sample});
 
-    if (sample_buffer.size() >= SOUND_SAMPLE_BUFFER_SIZE * 2 &&
-        SDL_GetQueuedAudioSize(audio_device) <
-            SOUND_SAMPLE_BUFFER_SIZE * sizeof(float) / 2) {
-      if (SDL_QueueAudio(audio_device, sample_buffer.data(),
-                         sample_buffer.size() * sizeof(float))) {
-        std::cout << "SDL Error: " << SDL_GetError() << std::endl;
-      }
+    // The audio thread pulls from the ring, so this never waits on it.
+    // Pacing comes from vsync, and frames that don't fit are dropped.
+    if (sample_buffer.size() >= SOUND_PUSH_FRAMES) {
+      m_audio_ring->push(sample_buffer);
       sample_buffer.clear();
-      while (SDL_GetQueuedAudioSize(audio_device) >
-             SOUND_SAMPLE_BUFFER_SIZE * sizeof(float) * 2) {
-        std::this_thread::yield();
-      }
     }
   });
 #if 1
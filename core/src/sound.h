@@ -1,7 +1,7 @@
 #pragma once
-#include <SDL2/SDL.h>
 #include <functional>
 #include <vector>
+#include "audio_ring.h"
 #include "channel.h"
 #include "constants.h"
 #include "noise_source.h"
@@ -62,9 +62,9 @@ class Sound {
   OutputControl right_output;
 
   std::vector<u8> noise_samples;
-  std::vector<float> sample_buffer;
+  std::vector<StereoFrame> sample_buffer;
 
-  SDL_AudioDeviceID audio_device;
+  AudioRing* m_audio_ring;
 
   bool sound_power_on = false;
 
@@ -72,7 +72,7 @@ class Sound {
                                   const OutputControl& control) const;
 
  public:
-  Sound(Memory& memory, SDL_AudioDeviceID device);
+  Sound(Memory& memory, AudioRing& audio_ring);
 
   u8 handle_memory_read(u16 addr) const;
   void handle_memory_write(u16 addr, u8 value);
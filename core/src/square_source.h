@@ -75,5 +75,8 @@ class SquareSource {
   }
 
   u8 volume() const { return enabled ? output : 0; }
+
+  // Ticks until update next moves through the duty cycle
+  [[nodiscard]] int ticks_until_step() const { return timer; }
 };
 }  // namespace gb
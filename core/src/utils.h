@@ -100,20 +100,6 @@ template <typename T, typename U>
   return (value & ~mask) | (((value & mask) + 1) & mask);
 }
 
-[[nodiscard]] constexpr u32 rotate_right(u32 val, u32 amount) {
-  constexpr std::size_t end_shift = sizeof(val) * 8 - 1;
-
-  for (unsigned i = 0; i < amount; ++i) {
-    val = ((val & 1) << end_shift) | (val >> 1);
-  }
-
-  return val;
-}
-
-[[nodiscard]] constexpr u32 arithmetic_shift_right(u32 val, u32 amount) {
-  return static_cast<s32>(val) >> amount;
-}
-
 template <int from, int to, typename T>
 [[nodiscard]] constexpr T convert_space(T value) {
   return (value * to) / from;
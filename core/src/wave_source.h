@@ -35,5 +35,8 @@ class WaveSource {
   }
 
   u8 volume() const { return enabled ? output : 0; }
+
+  // Ticks until update next moves to the following sample
+  [[nodiscard]] int ticks_until_step() const { return timer; }
 };
 }  // namespace gb
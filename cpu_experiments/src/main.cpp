@@ -23,6 +23,8 @@
 #include "gba/dma.h"
 #include "gba/gpu.h"
 #include "gba/sound.h"
+#include "gba/m4a.h"
+#include "audio_ring.h"
 #include "debugger/disassembly_view.h"
 #include "debugger/hardware_thread.h"
 #include "imgui_memory_editor.h"
@@ -128,6 +130,9 @@ static std::vector<gb::u8> load_file(const std::string_view file_name) {
 struct Args {
   std::string_view rom_path;
   bool execute = false;
+  bool jit = false;
+  bool jit_verify = false;
+  bool m4a_hle = false;
 };
 
 void run_emulator_and_debugger(const Args args) {
@@ -153,22 +158,33 @@ void run_emulator_and_debugger(const Args args) {
       1080,
       SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
 
+  // The mixer synthesizes at whatever rate the device runs at, so SDL
+  // doesn't need to resample
+  constexpr int preferred_sample_rate = 48000;
+  gb::AudioRing audio_ring{preferred_sample_rate, 64};
+
   SDL_AudioSpec want;
   SDL_AudioSpec have;
 
   memset(&want, 0, sizeof(want));
-  want.freq = 44100;
+  want.freq = preferred_sample_rate;
   want.format = AUDIO_F32SYS;
   want.channels = 2;
   want.samples = 1024;
-  want.callback = nullptr;
+  want.callback = gb::AudioRing::sdl_callback;
+  want.userdata = &audio_ring;
 
   SDL_AudioDeviceID audio_device;
-  if ((audio_device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0)) == 0) {
+  if ((audio_device = SDL_OpenAudioDevice(nullptr, 0, &want, &have,
+                                          SDL_AUDIO_ALLOW_FREQUENCY_CHANGE)) ==
+      0) {
     fmt::print(std::cerr, "Failed to open audio {}\n", SDL_GetError());
     return;
   }
 
+  AudioFormat audio_format{};
+  audio_format.sample_rate = static_cast<u32>(have.freq);
+
   SDL_PauseAudioDevice(audio_device, 0);
 
   SDL_GLContext gl_context = SDL_GL_CreateContext(window);
@@ -185,13 +201,19 @@ void run_emulator_and_debugger(const Args args) {
 
   Mmu mmu;
 
-  mmu.load_rom(load_file(args.rom_path));
+  std::vector<u8> rom = load_file(args.rom_path);
+  if (args.m4a_hle && !hle::m4a::install(rom)) {
+    fmt::print(std::cerr, "The m4a sound driver wasn't found\n");
+  }
+  mmu.load_rom(std::move(rom));
 
   DisassemblyInfo arm_disassembly;
   DisassemblyInfo thumb_disassembly;
   DisassemblyInfo iwram_disassembly;
 
   Cpu cpu{mmu};
+  cpu.set_jit_enabled(args.jit || args.jit_verify);
+  cpu.set_jit_verification(args.jit_verify);
   ProgramStatus program_status = cpu.program_status();
   program_status.set_irq_enabled(true);
   cpu.set_program_status(program_status);
@@ -202,15 +224,14 @@ void run_emulator_and_debugger(const Args args) {
   Lcd lcd{cpu, dmas, gpu};
   Input input;
 
-  auto sample_callback =
-      [audio_device](nonstd::span<Sound::SampleType> samples) {
-        if (SDL_QueueAudio(audio_device, samples.data(),
-                           sizeof(Sound::SampleType) * samples.size()) < 0) {
-          fmt::print(std::cerr, "{}\n", SDL_GetError());
-        }
-      };
+  // The mixer hands over interleaved f32 frames, the ring's layout
+  auto sample_callback = [&audio_ring](nonstd::span<const u8> frames) {
+    constexpr auto frame_size = static_cast<int>(sizeof(gb::StereoFrame));
+    audio_ring.push({reinterpret_cast<const gb::StereoFrame*>(frames.data()),
+                     frames.size() / frame_size});
+  };
 
-  Sound sound{sample_callback, dmas};
+  Sound sound{sample_callback, cpu.scheduler(), dmas, audio_format};
 
   Timers timers{cpu, sound};
 
@@ -523,6 +544,7 @@ void run_emulator_and_debugger(const Args args) {
   ImGui_ImplSDL2_Shutdown();
   ImGui::DestroyContext();
 
+  SDL_CloseAudioDevice(audio_device);
   SDL_GameControllerClose(controller);
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
@@ -547,8 +569,13 @@ int main(int argc, char** argv) {
 
   if (argc < 2) {
     static constexpr const char* usage = R"(
-usage: cpu_experiments <path-to-rom> [--execute]
+usage: cpu_experiments <path-to-rom> [--execute] [--jit] [--jit-verify]
+                       [--m4a-hle]
   --execute: start the emulator immediately
+  --jit: compile hot code to x86-64 (needs GBEMU_ENABLE_JIT)
+  --jit-verify: like --jit, but rerun compiled blocks on the interpreter
+                and stop at the first difference
+  --m4a-hle: mix the m4a sound driver natively
 )";
     std::puts(usage);
     return 1;
@@ -559,6 +586,12 @@ usage: cpu_experiments <path-to-rom> [--execute]
   for (int i = 1; i < argc; ++i) {
     if (std::strcmp(argv[i], "--execute") == 0) {
       args.execute = true;
+    } else if (std::strcmp(argv[i], "--jit") == 0) {
+      args.jit = true;
+    } else if (std::strcmp(argv[i], "--jit-verify") == 0) {
+      args.jit_verify = true;
+    } else if (std::strcmp(argv[i], "--m4a-hle") == 0) {
+      args.m4a_hle = true;
     } else {
       args.rom_path = argv[i];
     }